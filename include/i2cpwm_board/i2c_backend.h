@@ -0,0 +1,101 @@
+/**
+ *
+   \file
+   \brief      pluggable I2C bus backends used by the PCA9685 controller
+   \author     Bradan Lane Studio <info@bradanlane.com>
+   \copyright  Copyright (c) 2016, Bradan Lane Studio
+
+  The controller performs all of its I2C transactions through one of these backends:
+    - linux: the /dev/i2c-N device using ioctl(I2C_SLAVE) and the SMBus helpers of libi2c
+    - sim: an in-memory model of up to 62 PCA9685 boards on each bus, optionally behind a TCA9548A multiplexer, which counts transactions and bytes
+    - faulty: the sim model with the time of each transaction on a real bus and injected write errors
+
+  The sim and faulty backends need no hardware and are used by the i2cpwm_benchmark and i2cpwm_replay executables.
+*/
+
+#ifndef I2CPWM_BOARD_I2C_BACKEND_H
+#define I2CPWM_BOARD_I2C_BACKEND_H
+
+/// one write of a combined transfer; data[0] is the register followed by the register values
+typedef struct _i2c_write_msg {
+	int address;				// 7 bit address
+	int length;					// bytes of data including the register
+	unsigned char* data;
+} i2c_write_msg;
+
+#define I2C_WRITE_MSG_MAX 42	// the most messages of one combined transfer (I2C_RDWR_IOCTL_MAX_MSGS)
+
+/// the operations of an I2C bus; every operation returns a negative value on error
+typedef struct _i2c_backend {
+	const char* name;
+	int (*open) (const char* device);												// returns the handle of the bus
+	void (*close) (int handle);
+	int (*set_address) (int handle, int address);									// 7 bit address of subsequent transactions
+	int (*read_byte) (int handle, int reg);											// returns the register value
+	int (*write_byte) (int handle, int reg, int value);
+	int (*write_word) (int handle, int reg, int value);								// SMBus write word data; the low byte goes to reg and the high byte to reg+1
+	int (*send_byte) (int handle, int value);										// a write of one byte without a register, eg the control register of a multiplexer
+	int (*write_block) (int handle, int reg, int length, const unsigned char* data);	// length is limited to I2C_SMBUS_BLOCK_MAX
+	int (*write_multi) (int handle, const i2c_write_msg* msgs, int count);			// writes to any addresses as one transfer with repeated START; returns count
+	unsigned long (*functionality) (int handle);										// I2C_FUNC_* bits supported by the adapter
+} i2c_backend;
+
+extern const i2c_backend i2c_backend_linux;
+extern const i2c_backend i2c_backend_sim;
+extern const i2c_backend i2c_backend_faulty;
+
+/// returns the backend with the given name or NULL
+const i2c_backend* i2c_backend_find (const char* name);
+
+
+#define I2C_SIM_BUSES 8		// devices the sim and faulty backends can open; each device is a separate bus of boards
+
+/// transaction counters of all buses of the sim and faulty backends
+typedef struct _i2c_sim_stats {
+	unsigned long long calls;			// operations of the backend; each is a syscall with the linux backend
+	unsigned long long transactions;	// every read or write; each is one START .. STOP on the bus
+	unsigned long long bytes;			// bytes on the bus including the address and register bytes
+	unsigned long long address_changes;
+	unsigned long long errors;			// failed transactions including injected errors
+	unsigned long long bus_ns;			// time the transactions would have taken on the bus
+} i2c_sim_stats;
+
+/// power on reset of every simulated board and clearing of the counters
+void i2c_sim_reset (void);
+void i2c_sim_get_stats (i2c_sim_stats* stats);
+void i2c_sim_clear_stats (void);
+
+/// returns the 256 registers of the board at the 7 bit address of a bus (0.. in the order the devices were opened)
+/// and multiplexer channel (0..7 or -1 for a board directly on the bus) or NULL
+const unsigned char* i2c_sim_registers (int bus, int channel, int address);
+
+/// return the board at the 7 bit address of a bus and multiplexer channel (-1 for a board directly on the bus) to its power on state, eg a brown out
+void i2c_sim_power_cycle (int bus, int channel, int address);
+
+/**
+ *  model a TCA9548A multiplexer on the bus of a device; a board at each address is modelled behind each of its 8 channels
+ *
+ *@param device the device name the bus is opened with
+ *@param address the 7 bit address of the multiplexer, eg 0x70, or 0 to remove it
+ *@returns 0 on success or -1 when every bus is in use
+ */
+int i2c_sim_set_mux (const char* device, int address);
+
+/**
+ *  restrict the adapter features reported by every bus of the sim and faulty backends, eg to model an SMBus only controller
+ *
+ *@param funcs the I2C_FUNC_* bits; transfers which need other bits fail with EOPNOTSUPP; 0 restores every feature of the model
+ */
+void i2c_sim_set_functionality (unsigned long funcs);
+
+/**
+ *  timing and errors of the faulty backend
+ *
+ *@param bus_hz the I2C clock, eg 100000 or 400000; each byte takes 9 clocks
+ *@param latency_us a fixed latency of every transaction, eg the syscall and driver overhead
+ *@param error_rate the probability (0.0 .. 1.0) of a write failing
+ *@param delay non-zero to sleep for the time of each transaction rather than only counting it
+ */
+void i2c_sim_set_faults (int bus_hz, int latency_us, double error_rate, int delay);
+
+#endif
@@ -0,0 +1,169 @@
+/**
+ *
+   \file
+   \brief      public interface of the controller for I2C interfaced 16 channel PWM boards with PCA9685 chip
+   \author     Bradan Lane Studio <info@bradanlane.com>
+   \copyright  Copyright (c) 2016, Bradan Lane Studio
+
+  The controller is built as the i2cpwm_controller library. The i2cpwm_board node starts it with i2cpwm_controller_start().
+  Tools which run without a ROS master, such as i2cpwm_benchmark and i2cpwm_replay, open the buses with i2cpwm_controller_open() or
+  i2cpwm_controller_open_buses() and call the topic subscribers and services directly.
+*/
+
+#ifndef I2CPWM_BOARD_I2CPWM_CONTROLLER_H
+#define I2CPWM_BOARD_I2CPWM_CONTROLLER_H
+
+#include <ros/ros.h>
+#include <std_srvs/Empty.h>
+#include <geometry_msgs/Twist.h>
+
+#include "i2cpwm_board/ServoArray.h"
+#include "i2cpwm_board/ServoFrame.h"
+#include "i2cpwm_board/ServoMotion.h"
+#include "i2cpwm_board/PoseRecall.h"
+#include "i2cpwm_board/ServosConfig.h"
+#include "i2cpwm_board/DriveMode.h"
+#include "i2cpwm_board/IntValue.h"
+#include "i2cpwm_board/SavePose.h"
+
+// topic subscribers
+void servos_absolute (const i2cpwm_board::ServoArray::ConstPtr& msg);
+void servos_proportional (const i2cpwm_board::ServoArray::ConstPtr& msg);
+void servos_frame (const i2cpwm_board::ServoFrame::ConstPtr& msg);
+void servos_drive (const geometry_msgs::Twist::ConstPtr& msg);
+void servos_motion (const i2cpwm_board::ServoMotion::ConstPtr& msg);
+void pose_absolute (const i2cpwm_board::ServoArray::ConstPtr& msg);
+void pose_proportional (const i2cpwm_board::ServoArray::ConstPtr& msg);
+void pose_recall (const i2cpwm_board::PoseRecall::ConstPtr& msg);
+
+// services
+bool set_pwm_frequency (i2cpwm_board::IntValue::Request &req, i2cpwm_board::IntValue::Response &res);
+bool config_servos (i2cpwm_board::ServosConfig::Request &req, i2cpwm_board::ServosConfig::Response &res);
+bool config_drive_mode (i2cpwm_board::DriveMode::Request &req, i2cpwm_board::DriveMode::Response &res);
+bool stop_servos (std_srvs::Empty::Request& req, std_srvs::Empty::Response& res);
+bool commit_pose (std_srvs::Empty::Request& req, std_srvs::Empty::Response& res);
+bool save_pose (i2cpwm_board::SavePose::Request &req, i2cpwm_board::SavePose::Response &res);
+
+/**
+ *  load the parameters, initialize the boards and advertise the topics and services of the controller
+ *
+ *@param n the node handle used for the topics, services and parameters
+ *@returns 0 on success or -1 if the I2C bus could not be opened or the I/O threads of the output scheduler could not be started
+ */
+int i2cpwm_controller_start (ros::NodeHandle& n);
+
+/// stop the I/O threads and close the I2C buses
+void i2cpwm_controller_stop (void);
+
+/// one I2C bus of i2cpwm_controller_open_buses()
+typedef struct _i2cpwm_bus_config {
+	const char* device;		// the I2C device, eg "/dev/i2c-1"
+	int boards;				// boards on the bus; boards are numbered sequentially across the buses
+	int address;			// 7 bit address of the first board on the bus or 0 for 0x40
+	int mux;				// 7 bit address of the TCA9548A multiplexer the boards are behind or 0 when they are directly on the bus
+	int channel;			// multiplexer channel (0..7) of the boards; a device listed again is the same bus
+} i2cpwm_bus_config;
+
+/**
+ *  open an I2C bus and initialize the first board without the parameter server
+ *
+ *@param device the I2C device, eg "/dev/i2c-1"; ignored by the sim and faulty backends
+ *@param backend the name of the bus backend: "linux", "sim" or "faulty"
+ *@param frequency the PWM frequency in Hz
+ *@returns 0 on success or -1 on error
+ */
+int i2cpwm_controller_open (const char* device, const char* backend, int frequency);
+
+/**
+ *  open several I2C buses and initialize the first board without the parameter server
+ *
+ *@param backend the name of the bus backend: "linux", "sim" or "faulty"
+ *@param frequency the PWM frequency in Hz
+ *@param buses the buses in the order their boards are numbered
+ *@param count the number of buses
+ *@returns 0 on success or -1 on error
+ */
+int i2cpwm_controller_open_buses (const char* backend, int frequency, const i2cpwm_bus_config* buses, int count);
+
+/// start an I/O thread for each open bus; the subscribers then only queue commands for the buses
+void i2cpwm_controller_io_start (void);
+
+/// wait until the I/O threads have written everything queued so far
+void i2cpwm_controller_sync (void);
+
+/**
+ *  check the boards for resets in idle bus time; call before i2cpwm_controller_io_start()
+ *
+ *@param rate boards of each bus checked per second or 0 to disable
+ */
+void i2cpwm_controller_verify (int rate);
+
+/**
+ *  write the staged values on the ticks of the output scheduler rather than as each message arrives; call before i2cpwm_controller_io_start()
+ *
+ *@param rate ticks per second or 0 to follow the PWM frequency
+ */
+void i2cpwm_controller_schedule (int rate);
+
+/**
+ *  select how the block writes of a frame are sent; the bus must be open
+ *
+ *A transport the adapter of a bus does not support, according to its I2C_FUNCS, is replaced by the fastest one it does.
+ *@param name "rdwr" for one I2C_RDWR transfer per frame, "smbus" for an address change and I2C block writes per board,
+ *"word" or "byte" for SMBus writes of two registers or one register, or "auto" for the fastest the adapters support
+ *@returns 0 on success or -1 for an invalid name
+ */
+int i2cpwm_controller_transport (const char* name);
+
+/**
+ *  limit the size of the block writes of the transport
+ *
+ *@param bytes the most register bytes (4..64) of one block write or 0 for the limit of the transport
+ *@returns 0 on success or -1 for an invalid size
+ */
+int i2cpwm_controller_burst (int bytes);
+
+/**
+ *  lock the memory of the process and prefault the stack of the calling thread; call before i2cpwm_controller_io_start()
+ *  so the I/O threads are started with small, locked and prefaulted stacks
+ *
+ *@returns 0 on success or -1 if the memory could not be locked, eg without CAP_IPC_LOCK
+ */
+int i2cpwm_controller_realtime (void);
+
+/**
+ *  set the options i2cpwm_controller_start() subscribes to a topic with; in the realtime mode, set after
+ *  i2cpwm_controller_realtime(), their factory deserializes the messages into the pool of their type
+ *
+ *@param topic the name of a topic of the controller, eg "servos_absolute"
+ *@param ops set to the topic, queue size, subscriber and message factory of the topic
+ *@returns 0 on success or -1 if the controller has no topic of the name
+ */
+int i2cpwm_controller_subscribe_options (const char* topic, ros::SubscribeOptions& ops);
+
+/// the stages of a servo message reported to the trace hook
+enum i2cpwm_trace_stages {
+	I2CPWM_TRACE_RECEIVED   = 0,	// the subscriber has been entered
+	I2CPWM_TRACE_CONVERTED  = 1,	// every value has been converted to a pulse and staged or queued for its bus
+	I2CPWM_TRACE_QUEUED     = 2,	// the end of the message has been passed to the buses; without I/O threads the buses have already been written
+	I2CPWM_TRACE_WRITTEN    = 3		// a bus has written a frame; it includes the message with the stamp and every earlier message of the bus
+};
+
+/**
+ *  the trace hook; it is called from the ROS spin thread and, for I2CPWM_TRACE_WRITTEN, from the I/O thread of each bus so it must be thread safe
+ *
+ *@param stage one of the i2cpwm_trace_stages
+ *@param stamp the CLOCK_MONOTONIC time in nanoseconds the message was received, which identifies the message
+ *@param buses bit mask of the buses of the message for I2CPWM_TRACE_QUEUED and of the bus for I2CPWM_TRACE_WRITTEN
+ *@param now the CLOCK_MONOTONIC time in nanoseconds of the stage
+ */
+typedef void (*i2cpwm_trace_hook) (int stage, long long stamp, unsigned int buses, long long now);
+
+/**
+ *  report the stages of every servos_absolute, servos_proportional, servos_frame and servos_drive message; call before i2cpwm_controller_io_start()
+ *
+ *@param hook the trace hook or NULL to stop tracing
+ */
+void i2cpwm_controller_trace (i2cpwm_trace_hook hook);
+
+#endif
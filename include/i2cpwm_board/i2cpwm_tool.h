@@ -0,0 +1,74 @@
+/**
+ *
+   \file
+   \brief      bag replay, servo configuration and bus layout shared by the i2cpwm_benchmark and i2cpwm_replay executables
+   \author     Bradan Lane Studio <info@bradanlane.com>
+   \copyright  Copyright (c) 2016, Bradan Lane Studio
+
+  The tools run the controller without a ROS master or PWM hardware. The boards are opened with the sim or faulty
+  backend and the servo topics of a bag are delivered to handlers, which call the controller's topic subscribers.
+*/
+
+#ifndef I2CPWM_BOARD_I2CPWM_TOOL_H
+#define I2CPWM_BOARD_I2CPWM_TOOL_H
+
+#include "i2cpwm_board/i2cpwm_controller.h"
+
+/// the servo topics of a bag
+typedef enum i2cpwm_tool_topics {
+	I2CPWM_TOOL_ABSOLUTE = 0,
+	I2CPWM_TOOL_PROPORTIONAL,
+	I2CPWM_TOOL_FRAME,
+	I2CPWM_TOOL_DRIVE,
+	I2CPWM_TOOL_TOPICS
+} i2cpwm_tool_topics;
+
+/// the names of the topics in the order of i2cpwm_tool_topics
+extern const char* i2cpwm_tool_topic_names[I2CPWM_TOOL_TOPICS];
+
+/// the receivers of the messages of a bag; bag is the record time of the message relative to the first message of the bag
+typedef struct _i2cpwm_tool_handlers {
+	void (*open) (unsigned int messages);		// called once the bag is open with the number of its messages or NULL
+	void (*servos) (int topic, const i2cpwm_board::ServoArray::ConstPtr& msg, long long bag);	// I2CPWM_TOOL_ABSOLUTE or I2CPWM_TOOL_PROPORTIONAL
+	void (*frame) (const i2cpwm_board::ServoFrame::ConstPtr& msg, long long bag);
+	void (*drive) (const geometry_msgs::Twist::ConstPtr& msg, long long bag);
+} i2cpwm_tool_handlers;
+
+/// returns the CLOCK_MONOTONIC time in nanoseconds
+long long i2cpwm_tool_now (void);
+
+/**
+ *  open the sim or faulty backend with the boards of the servos split evenly across buses and multiplexer channels
+ *
+ *Any remaining boards are on the last bus without a multiplexer. The multiplexers are modelled at 0x70.
+ *
+ *@param backend the name of the bus backend: "sim" or "faulty"
+ *@param frequency the PWM frequency in Hz
+ *@param servos the servos, 16 per board (1..992)
+ *@param buses the buses (1..4); at most one per board
+ *@param mux the multiplexer channels of each bus (1..8) or 0 for boards directly on the buses
+ *@returns 0 on success or -1 after printing the error
+ */
+int i2cpwm_tool_open_buses (const char* backend, int frequency, int servos, int buses, int mux);
+
+/**
+ *  configure every servo as a standard servo and the first four as the wheels of a mecanum drive through the controller services
+ *
+ *@param servos the servos to configure
+ */
+void i2cpwm_tool_configure (int servos);
+
+/**
+ *  deliver the servos_absolute, servos_proportional, servos_frame and servos_drive messages of a bag to the handlers
+ *
+ *Topics are matched by name so any namespace is accepted.
+ *
+ *@param filename the bag
+ *@param speed the multiple of the recorded rate; 0 delivers the messages as fast as they are handled
+ *@param handlers the receivers of the messages
+ *@param start set to the monotonic time the first message was due or NULL
+ *@returns the number of messages delivered or -1 after printing the error
+ */
+int i2cpwm_tool_replay_bag (const char* filename, double speed, const i2cpwm_tool_handlers* handlers, long long* start);
+
+#endif
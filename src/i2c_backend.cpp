@@ -0,0 +1,674 @@
+/**
+ *
+   \file
+   \brief      I2C bus backends: linux /dev/i2c-N, an in-memory PCA9685 model and the model with injected latency and errors
+   \author     Bradan Lane Studio <info@bradanlane.com>
+   \copyright  Copyright (c) 2016, Bradan Lane Studio
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      - Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      - Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      - The name of Bradan Lane, Bradan Lane Studio nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL BRADAN LANE STUDIOS BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+  Please send comments, questions, or patches to info@bradanlane.com
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <time.h>
+extern "C" {
+  #include <linux/i2c-dev.h>
+  #include <i2c/smbus.h>
+}
+
+#include "i2cpwm_board/i2c_backend.h"
+
+
+/// @cond PRIVATE_NO_PUBLIC DOC
+
+// ------------------------------------------------------------------------------------------------------------------------------------
+// linux /dev/i2c-N
+// ------------------------------------------------------------------------------------------------------------------------------------
+
+static int _linux_open (const char* device)
+{
+	return open (device, O_RDWR);
+}
+
+static void _linux_close (int handle)
+{
+	if (handle > 0)
+		close (handle);
+}
+
+static int _linux_set_address (int handle, int address)
+{
+	return ioctl (handle, I2C_SLAVE, address);
+}
+
+static int _linux_read_byte (int handle, int reg)
+{
+	return i2c_smbus_read_byte_data (handle, reg);
+}
+
+static int _linux_write_byte (int handle, int reg, int value)
+{
+	return i2c_smbus_write_byte_data (handle, reg, value);
+}
+
+static int _linux_send_byte (int handle, int value)
+{
+	return i2c_smbus_write_byte (handle, value);
+}
+
+static int _linux_write_word (int handle, int reg, int value)
+{
+	return i2c_smbus_write_word_data (handle, reg, value);
+}
+
+static int _linux_write_block (int handle, int reg, int length, const unsigned char* data)
+{
+	return i2c_smbus_write_i2c_block_data (handle, reg, length, data);
+}
+
+static int _linux_write_multi (int handle, const i2c_write_msg* msgs, int count)
+{
+	struct i2c_msg i2c_msgs[I2C_WRITE_MSG_MAX];
+	struct i2c_rdwr_ioctl_data transfer;
+
+	if ((count < 1) || (count > I2C_WRITE_MSG_MAX)) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (int i=0; i<count; i++) {
+		i2c_msgs[i].addr = msgs[i].address;
+		i2c_msgs[i].flags = 0;		// write
+		i2c_msgs[i].len = msgs[i].length;
+		i2c_msgs[i].buf = msgs[i].data;
+	}
+	transfer.msgs = i2c_msgs;
+	transfer.nmsgs = count;
+	return ioctl (handle, I2C_RDWR, &transfer);
+}
+
+static unsigned long _linux_functionality (int handle)
+{
+	unsigned long funcs = 0;
+
+	if (0 > ioctl (handle, I2C_FUNCS, &funcs))
+		return 0;
+	return funcs;
+}
+
+
+// ------------------------------------------------------------------------------------------------------------------------------------
+// in-memory PCA9685 model
+// ------------------------------------------------------------------------------------------------------------------------------------
+
+#define _SIM_HANDLE     0x7F00      // handle of the first simulated bus; each device opened gets its own bus
+#define _SIM_FIRST      0x40        // the PCA9685 hardware address range is 0x40..0x7F
+#define _SIM_BOARDS     64
+#define _SIM_ALLCALL    0x70        // power on ALLCALL address; no board is modelled at this address
+#define _SIM_SEGMENTS   9           // the boards directly on the bus and the boards behind each of the 8 channels of a TCA9548A
+
+enum sim_regs {
+	_MODE1      = 0x00,
+	_MODE2      = 0x01,
+	_SUBADR1    = 0x02,
+	_SUBADR2    = 0x03,
+	_SUBADR3    = 0x04,
+	_ALLCALLADR = 0x05,
+	_LED0_ON_L  = 0x06,
+	_ALL_LED    = 0xFA,
+	_PRESCALE   = 0xFE,
+	_RESTART    = 0x80,
+	_AI         = 0x20,
+	_SLEEP      = 0x10,
+	_SUB1       = 0x08,
+	_ALLCALL    = 0x01
+};
+
+typedef struct _sim_model {
+	char device[64];						// device name the bus was opened with
+	unsigned char regs[_SIM_SEGMENTS][_SIM_BOARDS][256];	// segment 0 is on the bus; segment 1+n is behind channel n of the multiplexer
+	int address;							// the I2C_SLAVE address
+	int mux_address;						// 7 bit address of the TCA9548A or 0 without a multiplexer
+	int mux_control;						// bit mask of the connected channels
+	int mux_pending;						// control register written by the current transaction; connected at its STOP or -1
+	unsigned int seed;						// each bus is used by one thread so each has its own random sequence
+} sim_model;
+
+typedef struct _sim_bus {
+	sim_model models[I2C_SIM_BUSES];
+	int count;
+	int bus_hz;
+	int latency_us;
+	double error_rate;
+	int delay;
+	unsigned long functionality;			// I2C_FUNC_* bits reported by every bus or 0 for all the model supports
+	i2c_sim_stats stats;					// updated with atomic adds as the buses may be used by different threads
+} sim_bus;
+
+static sim_bus _sim;
+static int _sim_ready = 0;
+
+#define _SIM_COUNT(field, n) __atomic_fetch_add (&(_sim.stats.field), (n), __ATOMIC_RELAXED)
+
+
+static void _sim_power_on (unsigned char* regs)
+{
+	int i;
+
+	memset (regs, 0, 256);
+	regs[_MODE1] = _SLEEP | _ALLCALL;
+	regs[_MODE2] = 0x04;
+	regs[_SUBADR1] = 0xE2;
+	regs[_SUBADR2] = 0xE4;
+	regs[_SUBADR3] = 0xE8;
+	regs[_ALLCALLADR] = _SIM_ALLCALL << 1;
+	for (i=0; i<16; i++)
+		regs[_LED0_ON_L + (4*i) + 3] = 0x10;	// full OFF
+	regs[_PRESCALE] = 0x1E;
+}
+
+
+// an adapter rejects the transfers it does not support just as a real one does
+static int _sim_supports (unsigned long funcs)
+{
+	if (_sim.functionality && ((_sim.functionality & funcs) != funcs)) {
+		errno = EOPNOTSUPP;
+		return 0;
+	}
+	return 1;
+}
+
+
+static void _sim_init (void)
+{
+	if (_sim_ready)
+		return;
+	_sim_ready = 1;
+	_sim.bus_hz = 400000;
+	i2c_sim_reset ();
+}
+
+
+static sim_model* _sim_model (int handle)
+{
+	int index = handle - _SIM_HANDLE;
+
+	if ((index < 0) || (index >= _sim.count))
+		return NULL;
+	return &(_sim.models[index]);
+}
+
+
+/**
+ * \private method to find the bus of a device name, adding a bus the first time a name is used
+ *
+ *@returns the index of the bus or -1 when every bus is in use
+ */
+static int _sim_find (const char* device)
+{
+	int i;
+
+	for (i=0; i<_sim.count; i++) {
+		if (0 == strncmp (_sim.models[i].device, device, sizeof(_sim.models[i].device) - 1))
+			return i;
+	}
+	if (_sim.count == I2C_SIM_BUSES)
+		return -1;
+	_sim.count++;
+	strncpy (_sim.models[i].device, device, sizeof(_sim.models[i].device) - 1);
+	return i;
+}
+
+
+/**
+ * \private method to determine if the boards of a segment of a bus are connected
+ *
+ *The boards on the bus are always connected; the boards behind a channel of the multiplexer only when the channel is.
+ */
+static int _sim_connected (const sim_model* mp, int segment)
+{
+	return ((segment == 0) || (mp->mux_address && (mp->mux_control & (1 << (segment - 1)))));
+}
+
+
+/**
+ * \private method to determine if a simulated board responds to an address
+ *
+ *A board responds to its own address, the ALLCALL address when ALLCALL is enabled and SUBADR1 when SUB1 is enabled.
+ */
+static int _sim_responds (const sim_model* mp, int segment, int board, int address)
+{
+	const unsigned char* regs = mp->regs[segment][board];
+
+	if (!_sim_connected (mp, segment))
+		return 0;
+	if ((_SIM_FIRST + board) == _SIM_ALLCALL)
+		return 0;
+	if ((_SIM_FIRST + board) == address)
+		return 1;
+	if ((regs[_MODE1] & _ALLCALL) && ((regs[_ALLCALLADR] >> 1) == address))
+		return 1;
+	if ((regs[_MODE1] & _SUB1) && ((regs[_SUBADR1] >> 1) == address))
+		return 1;
+	return 0;
+}
+
+
+static void _sim_write_register (unsigned char* regs, int reg, unsigned char value)
+{
+	if ((reg >= _ALL_LED) && (reg < _PRESCALE)) {
+		// the ALL_LED registers are written to every channel
+		for (int i=0; i<16; i++)
+			regs[_LED0_ON_L + (4*i) + (reg - _ALL_LED)] = value;
+		return;
+	}
+	if ((reg == _PRESCALE) && !(regs[_MODE1] & _SLEEP))
+		return;		// the prescale can only be changed while the oscillator is off
+	if (reg == _MODE1)
+		value &= ~_RESTART;
+	regs[reg] = value;
+}
+
+
+/**
+ * \private method to account for one transaction and decide if it fails
+ *
+ *@param mp the bus
+ *@param bytes the bytes on the bus including the address byte
+ *@param inject non-zero if errors may be injected
+ *@returns 0 or -1 for an injected error
+ */
+static int _sim_transaction (sim_model* mp, int bytes, int inject)
+{
+	long long ns = (((long long)bytes * 9 * 1000000000LL) / _sim.bus_hz) + ((long long)_sim.latency_us * 1000);
+
+	_SIM_COUNT (transactions, 1);
+	_SIM_COUNT (bytes, bytes);
+	_SIM_COUNT (bus_ns, ns);
+
+	if (_sim.delay && (ns > 0)) {
+		struct timespec t = { (time_t)(ns / 1000000000LL), (long)(ns % 1000000000LL) };
+		nanosleep (&t, NULL);
+	}
+
+	if (inject && (_sim.error_rate > 0.0) && (((double)rand_r (&(mp->seed)) / (double)RAND_MAX) < _sim.error_rate)) {
+		_SIM_COUNT (errors, 1);
+		errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * \private method to write registers of every simulated board which responds to an address
+ *
+ *The multiplexer keeps the last byte written to it, including the register byte, as its control register.
+ *@param length the number of register values or -1 for an SMBus send byte where reg is the only byte
+ *@returns the number of devices written; 0 when no device acknowledged the address
+ */
+static int _sim_apply (sim_model* mp, int address, int reg, int length, const unsigned char* data)
+{
+	int segment, board, i, count = 0;
+
+	if (mp->mux_address && (mp->mux_address == address)) {
+		mp->mux_pending = (length > 0) ? data[length-1] : reg;
+		count++;
+	}
+	for (segment=0; segment<_SIM_SEGMENTS; segment++) {
+		for (board=0; board<_SIM_BOARDS; board++) {
+			if (!_sim_responds (mp, segment, board, address))
+				continue;
+			unsigned char* regs = mp->regs[segment][board];
+			int r = reg;
+			for (i=0; i<length; i++) {		// a send byte only sets the register pointer of a PCA9685
+				_sim_write_register (regs, r, data[i]);
+				if (regs[_MODE1] & _AI)
+					r = (r + 1) & 0xFF;
+			}
+			count++;
+		}
+	}
+	if (!count) {
+		_SIM_COUNT (errors, 1);
+		errno = ENXIO;
+	}
+	return count;
+}
+
+
+/**
+ * \private method to end a transaction with a STOP; a channel selection of the multiplexer takes effect at the STOP
+ */
+static void _sim_stop (sim_model* mp)
+{
+	if (mp->mux_pending >= 0)
+		mp->mux_control = mp->mux_pending;
+	mp->mux_pending = -1;
+}
+
+
+static int _sim_write (int handle, int reg, int length, const unsigned char* data, int inject)
+{
+	sim_model* mp = _sim_model (handle);
+
+	_SIM_COUNT (calls, 1);
+	if (!mp) {
+		errno = EBADF;
+		return -1;
+	}
+	if (0 > _sim_transaction (mp, 2 + ((length > 0) ? length : 0), inject))
+		return -1;
+	int count = _sim_apply (mp, mp->address, reg, length, data);
+	_sim_stop (mp);
+	return count ? 0 : -1;
+}
+
+
+/**
+ * \private method to write a combined transfer
+ *
+ *The messages are one transaction; after a message which is not acknowledged the adapter stops the transfer
+ *so the messages which follow it are not written.
+ */
+static int _sim_transfer (int handle, const i2c_write_msg* msgs, int count, int inject)
+{
+	sim_model* mp = _sim_model (handle);
+	int i, bytes = 0;
+
+	_SIM_COUNT (calls, 1);
+	if (!mp) {
+		errno = EBADF;
+		return -1;
+	}
+	if ((count < 1) || (count > I2C_WRITE_MSG_MAX)) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (i=0; i<count; i++)
+		bytes += 1 + msgs[i].length;	// address byte of each START or repeated START
+	if (0 > _sim_transaction (mp, bytes, inject))
+		return -1;
+
+	for (i=0; i<count; i++) {
+		if ((msgs[i].length < 1) || !_sim_apply (mp, msgs[i].address, msgs[i].data[0], msgs[i].length - 1, &(msgs[i].data[1]))) {
+			_sim_stop (mp);
+			return -1;
+		}
+	}
+	_sim_stop (mp);
+	return count;
+}
+
+
+static int _sim_open (const char* device)
+{
+	_sim_init ();
+	int i = _sim_find (device);
+	if (i < 0) {
+		errno = ENODEV;
+		return -1;
+	}
+	_sim.models[i].address = -1;
+	return _SIM_HANDLE + i;
+}
+
+static void _sim_close (int handle)
+{
+}
+
+static int _sim_set_address (int handle, int address)
+{
+	sim_model* mp = _sim_model (handle);
+
+	_SIM_COUNT (calls, 1);
+	if (!mp || (address < 0x03) || (address > 0x77)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (address != mp->address)
+		_SIM_COUNT (address_changes, 1);
+	mp->address = address;
+	return 0;
+}
+
+static int _sim_read_byte (int handle, int reg)
+{
+	sim_model* mp = _sim_model (handle);
+
+	_SIM_COUNT (calls, 1);
+	if (!mp) {
+		errno = EBADF;
+		return -1;
+	}
+
+	// write of the register address, repeated START and read of one byte; a broadcast address can not be read
+	int board = mp->address - _SIM_FIRST;
+	if (0 > _sim_transaction (mp, 4, 0))
+		return -1;
+	for (int segment=0; (board >= 0) && (board < _SIM_BOARDS) && (segment < _SIM_SEGMENTS); segment++) {
+		if (_sim_responds (mp, segment, board, mp->address))
+			return mp->regs[segment][board][reg & 0xFF];
+	}
+	_SIM_COUNT (errors, 1);
+	errno = ENXIO;
+	return -1;
+}
+
+static int _sim_write_byte (int handle, int reg, int value)
+{
+	unsigned char data = (unsigned char)value;
+	return _sim_write (handle, reg, 1, &data, 0);
+}
+
+static int _sim_write_word (int handle, int reg, int value)
+{
+	if (!_sim_supports (I2C_FUNC_SMBUS_WRITE_WORD_DATA))
+		return -1;
+	unsigned char data[2] = { (unsigned char)(value & 0xFF), (unsigned char)((value >> 8) & 0xFF) };	// SMBus words are sent low byte first
+	return _sim_write (handle, reg, 2, data, 0);
+}
+
+static int _sim_send_byte (int handle, int value)
+{
+	sim_model* mp = _sim_model (handle);
+
+	_SIM_COUNT (calls, 1);
+	if (!mp) {
+		errno = EBADF;
+		return -1;
+	}
+	if (0 > _sim_transaction (mp, 2, 0))
+		return -1;
+	int count = _sim_apply (mp, mp->address, value & 0xFF, -1, NULL);
+	_sim_stop (mp);
+	return count ? 0 : -1;
+}
+
+static int _sim_write_block (int handle, int reg, int length, const unsigned char* data)
+{
+	if ((length < 1) || (length > I2C_SMBUS_BLOCK_MAX)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (!_sim_supports (I2C_FUNC_SMBUS_WRITE_I2C_BLOCK))
+		return -1;
+	return _sim_write (handle, reg, length, data, 0);
+}
+
+static int _sim_write_multi (int handle, const i2c_write_msg* msgs, int count)
+{
+	if (!_sim_supports (I2C_FUNC_I2C))
+		return -1;
+	return _sim_transfer (handle, msgs, count, 0);
+}
+
+static unsigned long _sim_functionality (int handle)
+{
+	return _sim.functionality ? _sim.functionality : (I2C_FUNC_I2C | I2C_FUNC_SMBUS_BYTE_DATA | I2C_FUNC_SMBUS_WORD_DATA | I2C_FUNC_SMBUS_I2C_BLOCK);
+}
+
+
+// the faulty backend is the same model with injected write errors; the timing is set with i2c_sim_set_faults()
+
+static int _faulty_write_byte (int handle, int reg, int value)
+{
+	unsigned char data = (unsigned char)value;
+	return _sim_write (handle, reg, 1, &data, 1);
+}
+
+static int _faulty_write_word (int handle, int reg, int value)
+{
+	if (!_sim_supports (I2C_FUNC_SMBUS_WRITE_WORD_DATA))
+		return -1;
+	unsigned char data[2] = { (unsigned char)(value & 0xFF), (unsigned char)((value >> 8) & 0xFF) };
+	return _sim_write (handle, reg, 2, data, 1);
+}
+
+static int _faulty_write_block (int handle, int reg, int length, const unsigned char* data)
+{
+	if ((length < 1) || (length > I2C_SMBUS_BLOCK_MAX)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (!_sim_supports (I2C_FUNC_SMBUS_WRITE_I2C_BLOCK))
+		return -1;
+	return _sim_write (handle, reg, length, data, 1);
+}
+
+static int _faulty_write_multi (int handle, const i2c_write_msg* msgs, int count)
+{
+	if (!_sim_supports (I2C_FUNC_I2C))
+		return -1;
+	return _sim_transfer (handle, msgs, count, 1);
+}
+
+/// @endcond PRIVATE_NO_PUBLIC DOC
+
+
+// ------------------------------------------------------------------------------------------------------------------------------------
+// public backends
+// ------------------------------------------------------------------------------------------------------------------------------------
+
+const i2c_backend i2c_backend_linux = {
+	"linux", _linux_open, _linux_close, _linux_set_address, _linux_read_byte, _linux_write_byte, _linux_write_word, _linux_send_byte, _linux_write_block, _linux_write_multi, _linux_functionality
+};
+
+const i2c_backend i2c_backend_sim = {
+	"sim", _sim_open, _sim_close, _sim_set_address, _sim_read_byte, _sim_write_byte, _sim_write_word, _sim_send_byte, _sim_write_block, _sim_write_multi, _sim_functionality
+};
+
+const i2c_backend i2c_backend_faulty = {
+	"faulty", _sim_open, _sim_close, _sim_set_address, _sim_read_byte, _faulty_write_byte, _faulty_write_word, _sim_send_byte, _faulty_write_block, _faulty_write_multi, _sim_functionality
+};
+
+
+const i2c_backend* i2c_backend_find (const char* name)
+{
+	static const i2c_backend* backends[] = { &i2c_backend_linux, &i2c_backend_sim, &i2c_backend_faulty };
+
+	for (unsigned int i=0; i<(sizeof(backends)/sizeof(backends[0])); i++) {
+		if (0 == strcmp (name, backends[i]->name))
+			return backends[i];
+	}
+	return NULL;
+}
+
+
+void i2c_sim_reset (void)
+{
+	_sim_init ();
+	for (int i=0; i<I2C_SIM_BUSES; i++) {
+		sim_model* mp = &(_sim.models[i]);
+		for (int segment=0; segment<_SIM_SEGMENTS; segment++) {
+			for (int board=0; board<_SIM_BOARDS; board++)
+				_sim_power_on (mp->regs[segment][board]);
+		}
+		mp->address = -1;
+		mp->mux_control = 0;		// every channel of the multiplexer is disconnected at power on
+		mp->mux_pending = -1;
+		mp->seed = i + 1;
+	}
+	i2c_sim_clear_stats ();
+}
+
+void i2c_sim_get_stats (i2c_sim_stats* stats)
+{
+	_sim_init ();
+	*stats = _sim.stats;
+}
+
+void i2c_sim_clear_stats (void)
+{
+	memset (&(_sim.stats), 0, sizeof(_sim.stats));
+}
+
+const unsigned char* i2c_sim_registers (int bus, int channel, int address)
+{
+	_sim_init ();
+	if ((bus < 0) || (bus >= I2C_SIM_BUSES) || (channel < -1) || (channel > 7) || (address < _SIM_FIRST) || (address >= (_SIM_FIRST + _SIM_BOARDS)))
+		return NULL;
+	return _sim.models[bus].regs[channel + 1][address - _SIM_FIRST];
+}
+
+void i2c_sim_power_cycle (int bus, int channel, int address)
+{
+	_sim_init ();
+	if ((bus < 0) || (bus >= I2C_SIM_BUSES) || (channel < -1) || (channel > 7) || (address < _SIM_FIRST) || (address >= (_SIM_FIRST + _SIM_BOARDS)))
+		return;
+	_sim_power_on (_sim.models[bus].regs[channel + 1][address - _SIM_FIRST]);
+}
+
+int i2c_sim_set_mux (const char* device, int address)
+{
+	_sim_init ();
+	int i = _sim_find (device);
+	if (i < 0)
+		return -1;
+	_sim.models[i].mux_address = address;
+	_sim.models[i].mux_control = 0;
+	_sim.models[i].mux_pending = -1;
+	return 0;
+}
+
+void i2c_sim_set_functionality (unsigned long funcs)
+{
+	_sim_init ();
+	_sim.functionality = funcs;
+}
+
+
+void i2c_sim_set_faults (int bus_hz, int latency_us, double error_rate, int delay)
+{
+	_sim_init ();
+	_sim.bus_hz = (bus_hz > 0) ? bus_hz : 400000;
+	_sim.latency_us = (latency_us > 0) ? latency_us : 0;
+	_sim.error_rate = error_rate;
+	_sim.delay = delay;
+}
@@ -0,0 +1,471 @@
+/**
+ *
+   \file
+   \brief      benchmark of the I2C PWM controller using the in-memory PCA9685 bus backends
+   \author     Bradan Lane Studio <info@bradanlane.com>
+   \copyright  Copyright (c) 2016, Bradan Lane Studio
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      - Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      - Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      - The name of Bradan Lane, Bradan Lane Studio nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL BRADAN LANE STUDIOS BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+  Please send comments, questions, or patches to info@bradanlane.com
+
+*/
+
+/**
+  The benchmark runs without a ROS master or PWM hardware. Messages are delivered to the controller's topic subscribers
+  as fast as they are handled; the latency of a message is the time its subscriber takes, including all I2C transactions.
+  With the I/O threads, the latency also includes the time until the I/O threads have written the message.
+
+  \code{.sh}
+  # replay a recorded bag of servos_absolute, servos_proportional and servos_drive messages
+  rosrun i2cpwm_board i2cpwm_benchmark --bag robot.bag
+
+  # a synthetic stream of 20000 messages to 32 servos on a 100kHz bus with 50us per transaction and 1% write errors
+  rosrun i2cpwm_board i2cpwm_benchmark --backend faulty --messages 20000 --servos 32 --bus-hz 100000 --latency-us 50 --error-rate 0.01
+
+  # 8 boards split across two buses, each written by its own I/O thread, with the time of each transaction spent on the bus
+  rosrun i2cpwm_board i2cpwm_benchmark --backend faulty --servos 128 --buses 2 --delay
+
+  # 4 boards at the same addresses behind 4 channels of a TCA9548A written with one I2C_RDWR transfer per channel
+  rosrun i2cpwm_board i2cpwm_benchmark --servos 64 --mux 4 --transport rdwr
+
+  # a pose of 128 servos per message sent as compact ServoFrame messages
+  rosrun i2cpwm_board i2cpwm_benchmark --servos 128 --frames
+
+  # an SMBus only adapter with word writes (I2C_FUNC_SMBUS_BYTE_DATA | I2C_FUNC_SMBUS_WORD_DATA) and the transport picked from its I2C_FUNCS
+  rosrun i2cpwm_board i2cpwm_benchmark --funcs 0x00F00000 --transport auto
+
+  # the realtime mode with the I/O threads; fails if the controller allocates once the first messages have been handled
+  rosrun i2cpwm_board i2cpwm_benchmark --servos 64 --io-thread --realtime
+
+  # the same on the ticks of a 1kHz output scheduler; each message waits for the next tick
+  rosrun i2cpwm_board i2cpwm_benchmark --servos 64 --messages 2000 --schedule 1000 --realtime
+  \endcode
+
+  Each message is serialized and handed to the options the controller subscribes to its topic with. As roscpp does,
+  their helper deserializes it into a message from the factory of the topic, which is the message pool in the realtime
+  mode, and calls the subscriber.
+
+  Heap allocations are counted by replacing malloc, calloc, realloc and the aligned allocators; operator new allocates
+  with them. Every allocation of the I/O threads is counted, including the ticks of the output scheduler between the
+  messages, and every allocation of the benchmark thread while a message is deserialized and handled. The messages the
+  benchmark builds and serializes are not counted, nor is the ROS transport, eg the receive buffer and callback queue
+  entry of each message, as the benchmark runs without a ROS master.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <getopt.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include <ros/ros.h>
+#include <ros/serialization.h>
+
+#include "i2cpwm_board/i2cpwm_controller.h"
+#include "i2cpwm_board/i2cpwm_tool.h"
+#include "i2cpwm_board/i2c_backend.h"
+
+
+/// @cond PRIVATE_NO_PUBLIC DOC
+
+typedef struct _benchmark_options {
+	const char* backend;
+	const char* transport;
+	const char* bag;
+	int messages;
+	int servos;
+	int frequency;
+	int bus_hz;
+	int latency_us;
+	double error_rate;
+	int delay;
+	int buses;
+	int mux;
+	int io_thread;
+	int frames;
+	int verify;
+	unsigned long funcs;
+	int burst;
+	int realtime;
+	int schedule;
+} benchmark_options;
+
+#define WARMUP_MESSAGES 16						// messages before the steady state; the first writes initialize the boards
+
+static std::vector<long long> _latencies;		// nanoseconds of each delivered message
+static unsigned long long _topic_counts[I2CPWM_TOOL_TOPICS];
+static unsigned long long _message_bytes = 0;	// serialized size of the delivered servo messages
+static int _sync = 0;							// non-zero to wait for the I/O threads after each message
+static ros::SubscribeOptions _subscriptions[I2CPWM_TOOL_TOPICS];	// the options the controller subscribes to each topic with
+static boost::shared_ptr<ros::M_string> _connection_header;
+static unsigned long long _allocations = 0;		// heap allocations by tracked threads
+static unsigned long long _steady_start = 0;	// allocations when the first message after the warmup was delivered
+static __thread int _untracked = 0;				// non-zero on the benchmark thread outside the subscribers; the I/O threads are always tracked
+
+
+extern "C" {
+
+void* __libc_malloc (size_t size);
+void* __libc_calloc (size_t count, size_t size);
+void* __libc_realloc (void* p, size_t size);
+void* __libc_memalign (size_t alignment, size_t size);
+void __libc_free (void* p);
+
+
+void* malloc (size_t size)
+{
+	if (!_untracked)
+		__atomic_fetch_add (&_allocations, 1, __ATOMIC_RELAXED);
+	return __libc_malloc (size);
+}
+
+
+void* calloc (size_t count, size_t size)
+{
+	if (!_untracked)
+		__atomic_fetch_add (&_allocations, 1, __ATOMIC_RELAXED);
+	return __libc_calloc (count, size);
+}
+
+
+void* realloc (void* p, size_t size)
+{
+	if (!_untracked)
+		__atomic_fetch_add (&_allocations, 1, __ATOMIC_RELAXED);
+	return __libc_realloc (p, size);
+}
+
+
+void* memalign (size_t alignment, size_t size)
+{
+	if (!_untracked)
+		__atomic_fetch_add (&_allocations, 1, __ATOMIC_RELAXED);
+	return __libc_memalign (alignment, size);
+}
+
+
+void* aligned_alloc (size_t alignment, size_t size)
+{
+	return memalign (alignment, size);
+}
+
+
+int posix_memalign (void** p, size_t alignment, size_t size)
+{
+	*p = memalign (alignment, size);
+	return *p ? 0 : ENOMEM;
+}
+
+
+void free (void* p)
+{
+	__libc_free (p);
+}
+
+}
+
+
+static void _usage (const char* name)
+{
+	fprintf (stderr,
+		"usage: %s [options]\n"
+		"  --backend NAME      sim or faulty (default sim)\n"
+		"  --transport NAME    smbus, rdwr, word, byte or auto (default smbus)\n"
+		"  --burst BYTES       the most register bytes of one block write (4..64); 0 uses the limit of the transport (default 0)\n"
+		"  --funcs MASK        I2C_FUNCS bits the modelled adapter reports; transfers needing other bits fail (default every feature)\n"
+		"  --bag FILE          replay the servos_absolute, servos_proportional, servos_frame and servos_drive topics of a bag\n"
+		"  --messages N        number of synthetic messages when no bag is given (default 10000)\n"
+		"  --servos N          servos of the synthetic stream, 16 per board (default 16)\n"
+		"  --frequency HZ      PWM frequency (default 50)\n"
+		"  --bus-hz HZ         I2C clock of the modelled bus (default 400000)\n"
+		"  --latency-us US     fixed latency of each transaction (default 0)\n"
+		"  --error-rate P      probability of a write error with the faulty backend (default 0)\n"
+		"  --delay             sleep for the modelled time of each transaction\n"
+		"  --buses N           split the boards of the servos across N buses (default 1); more than one bus uses the I/O threads\n"
+		"  --mux N             split the boards of each bus across N channels of a TCA9548A multiplexer at 0x70\n"
+		"  --io-thread         write each bus from its own I/O thread\n"
+		"  --frames            send the synthetic servo messages as ServoFrame rather than ServoArray\n"
+		"  --verify HZ         check this many boards of each bus per second in idle bus time; uses the I/O threads\n"
+		"  --realtime          lock the memory and prefault the stacks; fails if the controller allocates after the first messages\n"
+		"  --schedule HZ       write the staged values on the ticks of the output scheduler; uses the I/O threads\n",
+		name);
+}
+
+
+/**
+ * \private method to deliver a serialized message the way roscpp does
+ *
+ *The helper of the subscription deserializes the message into a message from its factory and calls the subscriber.
+ *The message is released once the subscriber has returned, so a pooled message is free for the next one.
+ *@param topic the topic of the message
+ *@param serialized the message with its length
+ */
+static void _deliver (int topic, const ros::SerializedMessage& serialized)
+{
+	ros::SubscriptionCallbackHelperDeserializeParams params;
+	params.buffer = serialized.message_start;
+	params.length = serialized.num_bytes - (serialized.message_start - serialized.buf.get());
+	params.connection_header = _connection_header;
+
+	if (_latencies.size() == WARMUP_MESSAGES)
+		_steady_start = __atomic_load_n (&_allocations, __ATOMIC_RELAXED);
+	long long start = i2cpwm_tool_now ();
+	_untracked = 0;
+	{
+		ros::SubscriptionCallbackHelperCallParams call;
+		call.event = ros::MessageEvent<void const> (_subscriptions[topic].helper->deserialize (params), _connection_header, ros::Time::now(), false, ros::MessageEvent<void const>::CreateFunction());
+		_subscriptions[topic].helper->call (call);
+	}
+	if (_sync)
+		i2cpwm_controller_sync ();
+	_untracked = 1;
+	_latencies.push_back (i2cpwm_tool_now () - start);
+	_topic_counts[topic]++;
+}
+
+
+static void _deliver_servos (int topic, const i2cpwm_board::ServoArray::ConstPtr& msg, long long)
+{
+	_message_bytes += ros::serialization::serializationLength (*msg);
+	_deliver (topic, ros::serialization::serializeMessage (*msg));
+}
+
+
+static void _deliver_frame (const i2cpwm_board::ServoFrame::ConstPtr& msg, long long)
+{
+	_message_bytes += ros::serialization::serializationLength (*msg);
+	_deliver (I2CPWM_TOOL_FRAME, ros::serialization::serializeMessage (*msg));
+}
+
+
+static void _deliver_drive (const geometry_msgs::Twist::ConstPtr& msg, long long)
+{
+	_deliver (I2CPWM_TOOL_DRIVE, ros::serialization::serializeMessage (*msg));
+}
+
+
+/**
+ * \private method to deliver a synthetic stream: a sweep of every servo with proportional values,
+ *an absolute value for every servo on every fourth message and a Twist on every fourth message when there is a drive
+ *
+ *With frames, the same values are sent as ServoFrame messages.
+ */
+static int _replay_synthetic (int messages, int servos, int frames)
+{
+	int k, i;
+
+	for (k=0; k<messages; k++) {
+		if ((servos >= 4) && ((k % 4) == 3)) {
+			geometry_msgs::Twist::Ptr twist (new geometry_msgs::Twist);
+			twist->linear.x = 0.3 * sin (k * 0.01);
+			twist->linear.y = 0.1 * cos (k * 0.01);
+			twist->angular.z = 0.5 * sin (k * 0.003);
+			_deliver_drive (twist, 0);
+			continue;
+		}
+
+		if (frames) {
+			i2cpwm_board::ServoFrame::Ptr frame (new i2cpwm_board::ServoFrame);
+			frame->first_servo = 1;
+			for (i=1; i<=servos; i++) {
+				if ((k % 4) == 2)
+					frame->counts.push_back (283 + (int)(100.0 * (0.5 + 0.5 * sin ((k * 0.02) + i))));
+				else
+					frame->values.push_back (sin ((k * 0.02) + i));
+			}
+			_deliver_frame (frame, 0);
+			continue;
+		}
+
+		i2cpwm_board::ServoArray::Ptr msg (new i2cpwm_board::ServoArray);
+		int absolute = ((k % 4) == 2);
+		for (i=1; i<=servos; i++) {
+			i2cpwm_board::Servo servo;
+			servo.servo = i;
+			if (absolute)
+				servo.value = 283 + (int)(100.0 * (0.5 + 0.5 * sin ((k * 0.02) + i)));
+			else
+				servo.value = sin ((k * 0.02) + i);
+			msg->servos.push_back (servo);
+		}
+		_deliver_servos (absolute ? I2CPWM_TOOL_ABSOLUTE : I2CPWM_TOOL_PROPORTIONAL, msg, 0);
+	}
+	return messages;
+}
+
+
+static const i2cpwm_tool_handlers _handlers = { NULL, _deliver_servos, _deliver_frame, _deliver_drive };
+
+
+static long long _percentile (const std::vector<long long>& sorted, int percent)
+{
+	if (sorted.empty())
+		return 0;
+	size_t index = (size_t)(((sorted.size() - 1) * percent) / 100);
+	return sorted[index];
+}
+
+/// @endcond PRIVATE_NO_PUBLIC DOC
+
+
+int main (int argc, char **argv)
+{
+	benchmark_options options = { "sim", "smbus", NULL, 10000, 16, 50, 400000, 0, 0.0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+	_untracked = 1;
+
+	static struct option long_options[] = {
+		{ "backend",	required_argument,	NULL, 'b' },
+		{ "transport",	required_argument,	NULL, 't' },
+		{ "bag",		required_argument,	NULL, 'r' },
+		{ "messages",	required_argument,	NULL, 'n' },
+		{ "servos",		required_argument,	NULL, 's' },
+		{ "frequency",	required_argument,	NULL, 'f' },
+		{ "bus-hz",		required_argument,	NULL, 'c' },
+		{ "latency-us",	required_argument,	NULL, 'l' },
+		{ "error-rate",	required_argument,	NULL, 'e' },
+		{ "delay",		no_argument,		NULL, 'd' },
+		{ "buses",		required_argument,	NULL, 'u' },
+		{ "mux",		required_argument,	NULL, 'm' },
+		{ "io-thread",	no_argument,		NULL, 'i' },
+		{ "frames",		no_argument,		NULL, 'a' },
+		{ "verify",		required_argument,	NULL, 'v' },
+		{ "funcs",		required_argument,	NULL, 'k' },
+		{ "burst",		required_argument,	NULL, 'x' },
+		{ "realtime",	no_argument,		NULL, 'z' },
+		{ "schedule",	required_argument,	NULL, 'g' },
+		{ "help",		no_argument,		NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int opt;
+	while (-1 != (opt = getopt_long (argc, argv, "b:t:r:n:s:f:c:l:e:du:m:iav:k:x:zg:h", long_options, NULL))) {
+		switch (opt) {
+			case 'b': options.backend = optarg; break;
+			case 't': options.transport = optarg; break;
+			case 'r': options.bag = optarg; break;
+			case 'n': options.messages = atoi (optarg); break;
+			case 's': options.servos = atoi (optarg); break;
+			case 'f': options.frequency = atoi (optarg); break;
+			case 'c': options.bus_hz = atoi (optarg); break;
+			case 'l': options.latency_us = atoi (optarg); break;
+			case 'e': options.error_rate = atof (optarg); break;
+			case 'd': options.delay = 1; break;
+			case 'u': options.buses = atoi (optarg); break;
+			case 'm': options.mux = atoi (optarg); break;
+			case 'i': options.io_thread = 1; break;
+			case 'a': options.frames = 1; break;
+			case 'v': options.verify = atoi (optarg); break;
+			case 'k': options.funcs = strtoul (optarg, NULL, 0); break;
+			case 'x': options.burst = atoi (optarg); break;
+			case 'z': options.realtime = 1; break;
+			case 'g': options.schedule = atoi (optarg); break;
+			default: _usage (argv[0]); return 1;
+		}
+	}
+	if (0 == strcmp (options.backend, "linux")) {
+		fprintf (stderr, "The benchmark only runs with the sim and faulty backends\n");
+		return 1;
+	}
+	if (options.schedule < 0) {
+		fprintf (stderr, "Invalid scheduler rate %d :: rates must be 0 or greater\n", options.schedule);
+		return 1;
+	}
+	ros::Time::init ();
+
+	i2c_sim_reset ();
+	i2c_sim_set_functionality (options.funcs);
+	i2c_sim_set_faults (options.bus_hz, options.latency_us, 0.0, 0);	// no errors or delays while the boards are set up
+	if (0 > i2cpwm_tool_open_buses (options.backend, options.frequency, options.servos, options.buses, options.mux))
+		return 1;
+	if (0 > i2cpwm_controller_burst (options.burst)) {
+		fprintf (stderr, "Invalid burst %d :: bursts must be between 4 and 64 bytes or 0\n", options.burst);
+		return 1;
+	}
+	if (0 > i2cpwm_controller_transport (options.transport)) {
+		fprintf (stderr, "Invalid transport %s :: transports are smbus, rdwr, word, byte and auto\n", options.transport);
+		return 1;
+	}
+	i2cpwm_tool_configure (options.servos);
+	if (options.realtime)
+		i2cpwm_controller_realtime ();	// the benchmark still runs when the memory cannot be locked
+	for (int i=0; i<I2CPWM_TOOL_TOPICS; i++)
+		i2cpwm_controller_subscribe_options (i2cpwm_tool_topic_names[i], _subscriptions[i]);	// after the realtime mode so the topics use the pools
+	_connection_header = boost::make_shared<ros::M_string> ();
+	if (options.io_thread || (options.buses > 1) || (options.verify > 0) || options.schedule) {
+		if (options.schedule)
+			i2cpwm_controller_schedule (options.schedule);
+		i2cpwm_controller_verify (options.verify);
+		i2cpwm_controller_io_start ();
+		_sync = 1;
+	}
+
+	i2c_sim_set_faults (options.bus_hz, options.latency_us, options.error_rate, options.delay);
+	i2c_sim_clear_stats ();
+	_latencies.reserve (options.bag ? 100000 : options.messages);
+
+	long long start = i2cpwm_tool_now ();
+	int count = options.bag ? i2cpwm_tool_replay_bag (options.bag, 0.0, &_handlers, NULL) : _replay_synthetic (options.messages, options.servos, options.frames);
+	long long elapsed = i2cpwm_tool_now () - start;
+	unsigned long long steady_allocations = (count > WARMUP_MESSAGES) ? (__atomic_load_n (&_allocations, __ATOMIC_RELAXED) - _steady_start) : 0;
+
+	i2cpwm_controller_stop ();
+	if (count <= 0) {
+		fprintf (stderr, "No messages were delivered\n");
+		return 1;
+	}
+
+	i2c_sim_stats stats;
+	i2c_sim_get_stats (&stats);
+	std::sort (_latencies.begin(), _latencies.end());
+
+	double seconds = elapsed / 1e9;
+	printf ("backend               %s (%s)\n", options.backend, options.transport);
+	printf ("buses                 %d%s\n", options.buses, _sync ? " with I/O threads" : "");
+	if (options.mux)
+		printf ("mux channels/bus      %d\n", options.mux);
+	printf ("messages              %d (absolute %llu, proportional %llu, frame %llu, drive %llu)\n", count, _topic_counts[I2CPWM_TOOL_ABSOLUTE], _topic_counts[I2CPWM_TOOL_PROPORTIONAL], _topic_counts[I2CPWM_TOOL_FRAME], _topic_counts[I2CPWM_TOOL_DRIVE]);
+	unsigned long long servo_messages = count - _topic_counts[I2CPWM_TOOL_DRIVE];
+	printf ("message bytes/msg     %.1f (servo messages)\n", servo_messages ? ((double)_message_bytes / servo_messages) : 0.0);
+	printf ("elapsed               %.3f s\n", seconds);
+	printf ("throughput            %.0f msgs/s\n", count / seconds);
+	printf ("backend calls/msg     %.2f\n", (double)stats.calls / count);
+	printf ("transactions/msg      %.2f\n", (double)stats.transactions / count);
+	printf ("bytes/msg             %.2f\n", (double)stats.bytes / count);
+	printf ("address changes/msg   %.2f\n", (double)stats.address_changes / count);
+	printf ("bus time/msg          %.1f us\n", (stats.bus_ns / 1000.0) / count);
+	printf ("errors                %llu\n", stats.errors);
+	printf ("latency p50           %.1f us\n", _percentile (_latencies, 50) / 1000.0);
+	printf ("latency p99           %.1f us\n", _percentile (_latencies, 99) / 1000.0);
+	printf ("latency max           %.1f us\n", _latencies.back() / 1000.0);
+	printf ("heap allocations/msg  %.2f (after %d messages)\n", (count > WARMUP_MESSAGES) ? ((double)steady_allocations / (count - WARMUP_MESSAGES)) : 0.0, WARMUP_MESSAGES);
+	if (options.realtime && steady_allocations) {
+		fprintf (stderr, "The controller made %llu heap allocations after %d messages :: the realtime mode must not allocate\n", steady_allocations, WARMUP_MESSAGES);
+		return 1;
+	}
+	return 0;
+}
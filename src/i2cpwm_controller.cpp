@@ -50,13 +50,20 @@
     - public topic subscribers: 
 		- servos_absolute()
 		- servos_proportional()
+		- servos_frame()
 		- servos_drive()
+		- servos_motion()
+		- pose_absolute()
+		- pose_proportional()
+		- pose_recall()
     - public services:
 		- set_pwm_frequency()
 		- set_active_board()
 		- config_servos()
 		- config_drive_mode()
 		- stop_servos()
+		- commit_pose()
+		- save_pose()
  
   The code is currently authored in C and should be rewritten as proper C++.
  
@@ -115,6 +122,18 @@
   This enables servo motion to be generalized to a standard proportion of ±1.0.
   Use of the config_servos() service is required before proportional control is available. 
 
+  The servos_frame() topic sets a run of consecutive servos from a dense array of absolute or proportional values.
+  It is a compact alternative to the absolute and proportional topics for poses of many servos.
+
+  The pose_absolute() and pose_proportional() topics stage the values of any number of servos, across boards and buses, without writing them.
+  The commit_pose() service then applies the whole pose at once so a robot never holds a partly updated pose.
+  Poses used again and again are kept in a pose library, loaded from the poses parameter or stored with the save_pose() service,
+  and the pose_recall() topic moves to one of them with a single message, at once or blended along a motion profile.
+
+  The servos_motion() topic moves servos to proportional values along a linear, trapezoidal or s-curve motion profile.
+  The node computes the motion on each tick of its output scheduler so the client only sends the target and the duration or limits of the motion.
+  The topic is enabled by the motion_profiles parameter.
+
   
 \section drivemode ROBOT DRIVE MODE
 
@@ -126,6 +145,7 @@
   The geometry_msgs::Twist providesf linear and angular velocity measured in m/s (meters per second) and r/s (radians per second) respectively.
   To perform the necessary calculations, data about the drive system is required.
   Use config_drive_mode() to provide the RPM of the drive wheels, their radius, and the track distance between left and right. These values determine speed and turn rates.
+  An optional acceleration limits how fast the wheels change speed; the output scheduler then ramps the drive servos to each new speed.
 
   Specifiy the desired drive mode with the `mode` property to cofig_drive_mode(). This package supports three drive modes:
   
@@ -156,13 +176,52 @@
   Additionally, when drive control is a product of positional feedback - such as line following and navigation via camera vision - drive encoders are usually not required._
 
   The stop_servos() service is provided as convenience to stop all servos and place then is a powered off state. This is different from setting each servo to its center value.
-  The stop service is useful as a safety operation.
+  The stop service is useful as a safety operation. The deadlines parameter does the same, or holds the servos or moves them to a pose,
+  when the publisher of a topic stops sending messages, eg a servos_drive planner which has died.
+
+\section parameters PARAMETERS
+
+  The following parameters are read from the parameter server at startup:
+
+    parameter | default | description
+    ----------|---------|------------
+    i2c_device_number | 1 | the linux I2C device, eg '1' for /dev/i2c-1
+    i2c_buses | | optional list of I2C buses, eg '[{device: 1, boards: 4}, {device: 0, boards: 2, address: 0x41}]'; boards are numbered sequentially across the buses and each bus is written by its own I/O thread; when omitted all boards are on i2c_device_number; boards behind a TCA9548A multiplexer add its address and channel, eg '{device: 1, boards: 2, mux: 0x71, channel: 3}', and entries for the same device share its bus and I/O thread
+    i2c_transport | auto | how frames are written: 'rdwr' sends the block writes of all boards of a frame as one combined I2C_RDWR transfer with repeated START; 'smbus' changes the I2C_SLAVE address and uses I2C block writes for each board; 'word' and 'byte' use SMBus writes of two registers or one register for adapters without block writes; 'auto' uses the first of these the I2C_FUNCS of every adapter supports
+    i2c_burst_max | 0 | the most register bytes (4..64) of one block write; 0 uses the limit of the transport, 64 bytes (a whole board) for 'rdwr' and 32 bytes for 'smbus'
+    i2c_backend | linux | the I2C bus backend: 'linux' for the I2C device, 'sim' for an in-memory model of the boards or 'faulty' for the model with injected write errors
+    pwm_frequency | 50 | the initial PWM frequency in Hz
+    broadcast_address | 0x70 | I2C address used to write the same values to all boards in one transaction: stop_servos(), set_pwm_frequency(), and identical values for the same channels of every board; 0x70 is the ALLCALL address, any other address is programmed as SUBADR1 of each board; 0 disables broadcast
+    servo_config | | an array of {servo, center, direction, range} used to configure servos for proportional control; an optional 'offset' (0..4095) sets the start of the servo's pulse
+    drive_config | | the drive mode: {mode, rpm, radius, track, scale, acceleration, servos} with the values of the config_drive_mode() service, where servos is an array of {servo, position}; an acceleration greater than 0 enables the output scheduler
+    diagnostics_rate | 1.0 | publish I2C bus and callback statistics on the 'diagnostics' topic this many times per second; 0 disables
+    state_rate | 0.0 | publish the pulse values last written to the boards on the 'servos_state' topic, a ServoArray of the servo and pulse width of each written channel, at most this many times per second and only when a value has changed or a subscriber has joined; 0 disables the topic
+    phase_stagger | false | start the pulse of each channel of a board at a different point (channel * 256) of the PWM period to spread the current draw
+    io_thread | false | perform all I2C transactions in a dedicated I/O thread for each bus; subscribers and services only validate and queue commands; always enabled with more than one bus
+    io_thread_priority | 0 | SCHED_FIFO priority (1..99) of the I/O thread; 0 uses the default scheduler
+    io_thread_cpu | -1 | CPU the I/O thread is bound to; -1 allows any CPU; with several buses the I/O thread of each further bus uses the next CPU
+    conflate_commands | false | keep only the newest value of each servo when the bus falls behind; stop_servos, commit_pose, pose_recall and servos_motion keep their order with the values sent before and after them; the servos_drive topic queue is reduced to the newest Twist; enables the I/O thread
+    output_scheduler | false | write staged servo values once per tick of a fixed rate scheduler rather than as each message arrives; enables the I/O thread
+    output_rate | 0 | ticks per second of the output scheduler; 0 follows the PWM frequency
+    verify_rate | 0 | boards of each bus checked per second in idle bus time; a board found reset, eg by a brown out, is initialized again and its last written channel values are restored, and a sampled channel which does not match its last written value is written again; failing boards are retried with backoff; enables the I/O thread
+    motion_profiles | false | enable the servos_motion topic which moves servos along linear, trapezoidal or s-curve motion profiles interpolated on each tick of the output scheduler; enables the output scheduler
+    poses | | the pose library: an array of {id (1..32), name, absolute, servos} where servos is an array of {servo, value}, eg '[{id: 1, name: park, absolute: false, servos: [{servo: 1, value: 0.0}]}]'; proportional values use servo_config
+    realtime | false | lock the memory of the process with mlockall(), prefault the stacks of the ROS spin thread and the I/O threads and deserialize the messages of every topic into a pool of reused messages of its type, so handling a message neither page faults nor allocates; needs CAP_IPC_LOCK or a large enough RLIMIT_MEMLOCK; building with -DI2CPWM_REALTIME=ON also compiles out the debug logging of the servo write path
+    deadlines | | an array of {topic, timeout, failsafe, pose} which applies a fail-safe when a servo topic has had no message for timeout msec, eg '[{topic: servos_drive, timeout: 250, failsafe: coast}]'; the failsafe is 'coast' (the default) to power off every servo with one broadcast transaction per bus, 'hold' to keep the last values and end any motion, or 'pose' to move to the pose id of the pose library; a topic is watched from its first message; enables the output scheduler
 
 \section testing TESTING
 
   Basic testing is available from the command line. Start the I2C PWM node with `roslaunch i2cpwm_board i2cpwm_node.launch` (or `roscore` and `rosrun i2cpwm_board i2cpwm_board`) and then proceed with 
   example commands contained within the documentation for each service and topic subscriber.
 
+  The controller is also available as the `i2cpwm_board/I2CPWMNodelet` nodelet, eg `roslaunch i2cpwm_board i2cpwm_nodelet.launch`.
+  A planner loaded into the same nodelet manager passes its messages to the controller as shared pointers without serialization.
+
+  Hardware-free testing uses the 'sim' or 'faulty' I2C backend. The `i2cpwm_benchmark` executable replays a bag of recorded servos_absolute, servos_proportional and servos_drive messages,
+  or a synthetic stream, through the controller and reports the throughput, I2C transactions and bytes per message and the latency percentiles, eg `rosrun i2cpwm_board i2cpwm_benchmark --bag robot.bag`.
+  The `i2cpwm_replay` executable replays a bag at its recorded rate, or as fast as possible, and writes a CSV trace of when each message was received,
+  converted, queued and written by its buses, eg `rosrun i2cpwm_board i2cpwm_replay --bag robot.bag --io-thread --trace robot.csv`.
+
  */
 
 #include <stdio.h>
@@ -175,17 +234,26 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <malloc.h>
+#include <sys/mman.h>
 extern "C" {
   #include <linux/i2c-dev.h>
   #include <i2c/smbus.h>
 }
 #include <ros/ros.h>
 #include <ros/console.h>
+#include <boost/make_shared.hpp>
 
 // messages used for any service with no parameters
 #include <std_srvs/Empty.h>
 // messages used for drive movement topic
 #include <geometry_msgs/Twist.h>
+// messages used to publish bus statistics
+#include <diagnostic_msgs/DiagnosticArray.h>
 
 // messages used for the absolute and proportional movement topics
 #include "i2cpwm_board/Servo.h"
@@ -202,15 +270,11 @@ extern "C" {
 // request/response of the integer parameter services
 #include "i2cpwm_board/IntValue.h"
 
+#include "i2cpwm_board/i2c_backend.h"
+#include "i2cpwm_board/i2cpwm_controller.h"
 
-/// @cond PRIVATE_NO_PUBLIC DOC
 
-typedef struct _servo_config {
-    int center;
-    int range;
-    int direction;
-    int mode_pos;
-} servo_config;
+/// @cond PRIVATE_NO_PUBLIC DOC
 
 typedef struct _drive_mode {
 	int mode;
@@ -218,6 +282,9 @@ typedef struct _drive_mode {
 	float radius;
 	float track;
 	float scale;
+	float max_rate;		// the max m/s is ((rpm/60) * (2*PI*radius)); computed when the drive mode is configured
+	float inv_max_rate;	// 1 / max_rate or 0 when the drive mode is not configured
+	float acceleration;	// the most change of wheel speed in m/s per second or 0 to step to each new speed
 } drive_mode;
 
 enum drive_modes {
@@ -238,10 +305,20 @@ enum drive_mode_positions {
 };
 
 #define _BASE_ADDR   0x40
+#define _ALLCALL_ADDR 0x70          // power on default ALLCALL address of every PCA9685
 #ifndef _PI
 #define _PI 3.14159265358979323846
 #endif
 #define _CONST(s) ((char*)(s))
+#define _FIXED_ONE  65536           // 1.0 as 16.16 fixed point
+#define _VALUE_ONE  16777216        // 1.0 as 8.24 fixed point; a proportional value keeps nearly all of the bits of its float
+
+// debug logging of the servo write path; builds with I2CPWM_REALTIME compile it out
+#ifdef I2CPWM_REALTIME
+#define _WRITE_DEBUG(...)
+#else
+#define _WRITE_DEBUG(...) ROS_DEBUG(__VA_ARGS__)
+#endif
 
 enum pwm_regs {
   // Registers/etc.
@@ -262,23 +339,334 @@ enum pwm_regs {
   __RESTART            = 0x80,
   __SLEEP              = 0x10,      // enable low power mode
   __ALLCALL            = 0x01,
+  __SUB1               = 0x08,      // respond to the I2C address in SUBADR1
+  __AUTO_INCREMENT     = 0x20,      // register address auto increment for burst writes
   __INVRT              = 0x10,      // invert the output control logic
   __OUTDRV             = 0x04
 };
 
 #define MAX_BOARDS 62
 #define MAX_SERVOS (16*MAX_BOARDS)
+#define MAX_BURST_CHANNELS (I2C_SMBUS_BLOCK_MAX/4)	// each channel is 4 registers; an I2C block write is limited to 32 bytes
+#define MAX_RDWR_CHANNELS 16						// an I2C_RDWR message is not limited so all 16 channels of a board fit in one write
+
+/*
+ the configured servos are kept in dense slots so a loop over the configured servos only touches as many cache lines
+ as there are servos. the registry only maps servo numbers to slots and is only ever appended to; the values of each slot
+ are kept in the configuration snapshot, one array per field sized to the slots in use.
+*/
+typedef struct _servo_registry {
+    int count;                              // used slots (0..count-1)
+    unsigned short slot[MAX_SERVOS];        // slot + 1 of each servo (1..992) or 0 when the servo has not been configured
+    unsigned short servo[MAX_SERVOS];       // servo number of each slot
+} servo_registry;
+
+/*
+ the configuration of the servos and of the drive mode is published as an immutable snapshot. the callbacks and I/O threads
+ read the snapshot without locks; a change is made to a private copy which replaces the snapshot in one pointer swap, and the
+ previous snapshot is freed once no reader can still hold it. a recalibration therefore never stalls a reader and readers
+ never see a partly applied change, eg only some of the servos of a config_servos() request.
+*/
+typedef struct _config_snapshot {
+    drive_mode drive;                               // the active drive mode
+    int count;                                      // slots of the registry with values in this snapshot
+    int capacity;                                   // slots the arrays have room for
+    int drive_count[POSITION_INVALID];
+    int* drive_servos[POSITION_INVALID];            // servos assigned to each drive position; each array has room for capacity servos
+    long long* scale;                               // direction * range/2 as 16.16 fixed point; computed when the servo is configured
+    short* center;                                  // -1 for a servo only configured with a drive position
+    short* range;
+    short* offset;                                  // ON count (0..4095) of the pulse or -1 to use the phase stagger default
+    signed char* direction;
+    signed char* mode_pos;
+} config_snapshot;
+
+typedef struct _pwm_frame {
+	unsigned char regs[4*16];				// ON_L, ON_H, OFF_L, OFF_H image of each of the 16 channels of a board
+	unsigned char shadow[4*16];				// the last ON_L, ON_H, OFF_L, OFF_H values successfully written to each channel
+	unsigned int dirty;						// bit mask of channels staged since the last flush
+	unsigned int cached;					// bit mask of channels where the shadow is known to match the hardware
+	unsigned int known;						// bit mask of channels with a value in the shadow
+	unsigned int seq;						// odd while the shadow is being updated; readers on other threads retry when it changes
+	int queued;								// non-zero when the board is in the list of boards of the current frame
+} pwm_frame;
+
+typedef struct _frame_block {
+	int channel;							// first channel of the block write
+	int count;								// channels of the block write
+	int lo, hi;								// first and last register (relative to LED0_ON_L) of the block actually written
+} frame_block;
+
+enum transports {
+	TRANSPORT_SMBUS     = 0,    // an I2C_SLAVE address change and SMBus I2C block writes for each board
+	TRANSPORT_RDWR      = 1,    // the block writes of every board of a frame in one I2C_RDWR transfer
+	TRANSPORT_WORD      = 2,    // SMBus word writes of two registers each for adapters without I2C block writes
+	TRANSPORT_BYTE      = 3     // SMBus byte writes of one register each; every adapter supports these
+};
+
+typedef struct _frame_transfer {
+	i2c_write_msg msgs[I2C_WRITE_MSG_MAX];
+	unsigned char data[I2C_WRITE_MSG_MAX][(4*MAX_RDWR_CHANNELS)+1];	// register followed by the register values
+	pwm_frame* frames[I2C_WRITE_MSG_MAX];							// frame and block of each message
+	frame_block blocks[I2C_WRITE_MSG_MAX];
+	int count;
+} frame_transfer;
+
+enum io_commands {
+	IO_NONE             = 0,
+	IO_CHANNEL          = 1,        // stage the start/end values of a servo
+	IO_FLUSH            = 2,        // end of a message - write the staged frame
+	IO_STOP             = 3,        // stop all servos on all boards
+	IO_FREQUENCY        = 4,        // set the PWM frequency of the active board
+	IO_EXIT             = 5,        // terminate the I/O thread
+	IO_MOTION           = 6,        // start a motion profile of a servo to the pulse width in start
+	IO_POSE             = 7,        // stage every servo of the bus in the committed pose buffer in servo
+	IO_RECALL           = 8         // stage the register images of the boards of the bus in the stored pose in servo
+};
+
+enum motion_profiles {
+	PROFILE_LINEAR      = 0,        // constant velocity
+	PROFILE_TRAPEZOIDAL = 1,        // constant acceleration, cruise and constant deceleration
+	PROFILE_SCURVE      = 2         // cosine velocity profile; the velocity is continuous and zero at both ends
+};
 
-servo_config _servo_configs[MAX_SERVOS];    // we can support up to 62 boards (1..62), each with 16 PWM devices (1..16)
-drive_mode _active_drive;					// used when converting Twist geometry to PWM values and which servos are for motion
-int _last_servo = -1;
+typedef struct _motion_request {
+	int profile;                        // one of the motion_profiles
+	float duration;                     // seconds for the move or 0 to use the velocity and acceleration limits
+	float velocity;                     // the most pulse counts per second
+	float acceleration;                 // pulse counts per second squared or 0 for no limit
+	int rest;                           // pulse width a powered off servo moves from or 0 to go straight to the end
+} motion_request;
+
+typedef struct _io_command {
+	int command;
+	int servo;
+	int start;
+	int end;
+	long long stamp;                    // monotonic time in nanoseconds the message causing an IO_FLUSH was received
+	motion_request motion;              // IO_MOTION only
+} io_command;
+
+typedef struct _servo_motion {
+	long long t0;                       // tick in nanoseconds of the monotonic clock when the motion started
+	float from;                         // pulse width at the start of the motion
+	float to;                           // pulse width at the end of the motion
+	float duration;                     // seconds
+	float ramp;                         // fraction of the duration spent accelerating and again decelerating with PROFILE_TRAPEZOIDAL
+	int profile;
+	int active;
+} servo_motion;
+
+#define IO_RING_SIZE 1024               // must be a power of 2
+#define IO_STACK_SIZE (256*1024)        // stack of each I/O thread in the realtime mode rather than the default of several MB which is all locked
+#define PREFAULT_STACK (128*1024)       // bytes of the stack of a thread touched by the realtime mode before the first message
+
+typedef struct _io_config {
+	bool enabled;                       // the I/O threads have been requested with the io_thread parameter
+	bool conflate;                      // channel values are posted to the mailbox where only the newest value of each servo is kept
+	bool scheduled;                     // staged values are flushed once per tick rather than at the end of each message
+	int rate;                           // ticks per second of the output scheduler or 0 to follow the PWM frequency
+	int priority;                       // SCHED_FIFO priority (1..99) or 0 for the default scheduler
+	int cpu;                            // CPU to bind the thread of the first bus to or -1 for any; the thread of each further bus uses the next CPU
+} io_config;
+
+typedef struct _io_worker {
+	pthread_t thread;
+	unsigned int ticks;                 // output scheduler ticks so far
+	unsigned int overruns;              // ticks which started more than one period late and were skipped
+	long late_max;                      // largest lateness of a tick in nanoseconds
+	int running;                        // non-zero once the I/O thread owns the I2C handle
+	int busy;                           // non-zero while the I/O thread is performing commands
+	sem_t wakeup;                       // posted by the producer when commands are ready
+	unsigned int head;                  // next ring slot to write; only written by the producer (the ROS spin thread)
+	unsigned int tail;                  // next ring slot to read; only written by the consumer (the I/O thread)
+	io_command ring[IO_RING_SIZE];
+} io_worker;
+
+#define VERIFY_RETRIES 3                    // failed checks of a board before the verifier reports it as not responding
+#define VERIFY_BACKOFF_MAX 64               // most checks of a failing board which are skipped between its retries
+
+typedef struct _board_health {
+	int failures;                           // consecutive checks of the board which failed
+	int skip;                               // checks of the board still to skip before it is retried
+	int channel;                            // next channel sampled
+} board_health;
+
+#define MAX_BUSES 4                         // I2C adapters, eg i2c-0, i2c-1 and a bit-banged bus
+#define MAILBOX_PENDING 0x80000000          // a mailbox slot holds (MAILBOX_PENDING | start << 16 | end) or 0 when empty
+#define MAILBOX_WORDS ((MAX_BOARDS+31)/32)
+
+typedef struct _pose_buffer {
+	unsigned int values[MAX_SERVOS];        // (MAILBOX_PENDING | start << 16 | end) of each servo of the pose or 0
+	unsigned int boards[MAILBOX_WORDS];     // bit mask of boards with at least one servo in the pose
+	unsigned int buses;                     // buses which have not yet staged the committed pose; 0 once the buffer is free
+} pose_buffer;
+
+#define MAX_POSES 32                        // poses of the pose library (ids 1..32)
+
+typedef struct _stored_pose {
+	char name[32];
+	unsigned char regs[MAX_BOARDS][4*16];   // ON_L, ON_H, OFF_L, OFF_H image of each board ready for its block writes
+	unsigned int channels[MAX_BOARDS];      // bit mask of the channels of each board in the pose
+	unsigned int boards[MAILBOX_WORDS];     // bit mask of boards with at least one channel in the pose
+	int servos;                             // servos in the pose; 0 when the id has not been stored
+	unsigned int buses;                     // buses which have not yet staged a recall of the pose
+} stored_pose;
+
+enum deadline_topics {
+	DEADLINE_ABSOLUTE   = 0,
+	DEADLINE_PROPORTIONAL = 1,
+	DEADLINE_FRAME      = 2,
+	DEADLINE_DRIVE      = 3,
+	DEADLINE_MOTION     = 4,
+	DEADLINE_TOPICS     = 5
+};
+
+enum failsafe_actions {
+	FAILSAFE_COAST      = 0,        // power off every servo, eg 'coast' rather than 'brake'
+	FAILSAFE_HOLD       = 1,        // keep the last written values and end any motion in progress
+	FAILSAFE_POSE       = 2         // move to a pose of the pose library
+};
+
+typedef struct _topic_deadline {
+	const char* topic;
+	long long timeout;                      // nanoseconds without a message before the fail-safe or 0 when the topic is not watched
+	int failsafe;                           // one of the failsafe_actions
+	int pose;                               // pose id (1..32) of FAILSAFE_POSE
+	long long stamp;                        // receive time of the newest message of the topic or 0 before the first
+} topic_deadline;
+
+typedef struct _i2c_bus {
+	int index;                              // position in _buses
+	char name[64];                          // the I2C device, eg /dev/i2c-1
+	int device;                             // linux I2C device number, eg 1 for /dev/i2c-1
+	int handle;                             // file handle of the device
+	int active_address;                     // used to determine if I2C SLAVE change is needed
+	int mux_address;                        // 7 bit address of a TCA9548A multiplexer on the bus or 0 without a multiplexer
+	int mux_channel;                        // used to determine if a multiplexer channel change is needed; -1 when unknown
+	unsigned int board_mask[MAILBOX_WORDS]; // bit mask of the boards (zero based) on this bus
+	int active_boards[MAX_BOARDS];          // activated boards (zero based) of this bus in the order of their multiplexer channels
+	int active_count;
+	int frame_boards[MAX_BOARDS];           // boards (zero based) of this bus with staged channel values in the current frame
+	int frame_board_count;
+	long long frame_stamp;                  // receive time of the oldest message with values in the current frame
+	long long mailbox_stamp;                // receive time of the oldest message with values for this bus in the mailbox
+	long long frame_newest;                 // receive time of the newest message with values in the current frame; only kept for the trace hook
+	long long mailbox_newest;               // receive time of the newest message with values for this bus in the mailbox; only kept for the trace hook
+	frame_transfer transfer;                // combined transfer being assembled for the rdwr transport
+	int motion_servos[MAX_SERVOS];          // servos of this bus with a motion profile in progress
+	int motion_count;
+	long long tick;                         // deadline of the current tick of the output scheduler in nanoseconds
+	int verify_board;                       // next position in the active boards of the bus to check
+	long long verify_next;                  // monotonic time in nanoseconds of the next check
+	long long deadline_missed[DEADLINE_TOPICS]; // stamp of the message of each topic whose deadline this bus has handled
+	io_worker worker;                       // single producer / single consumer command ring between ROS callbacks and this bus
+} i2c_bus;
+
+servo_registry _servos;                     // slots of the servos in use; we can support up to 62 boards (1..62), each with 16 PWM devices (1..16)
+config_snapshot* _config = NULL;            // the published configuration; replaced only by _config_publish()
+int _config_epoch = 0;                      // selects the reader count new readers of the snapshot use
+int _config_readers[2];                     // readers in each epoch; a replaced snapshot is freed when both epochs have drained
 
 int _pwm_boards[MAX_BOARDS];                // we can support up to 62 boards (1..62)
-int _active_board = 0;                      // used to determine if I2C SLAVE change is needed
-int _controller_io_handle;                  // linux file handle for I2C
+pwm_frame _pwm_frames[MAX_BOARDS];          // staged and last written channel values for each board; writes of unchanged values are skipped
+int _board_bus[MAX_BOARDS];                 // bus (index into _buses) of each board or -1 when the board is not assigned to a bus
+int _board_address[MAX_BOARDS];             // 7 bit I2C address of each board on its bus
+int _board_channel[MAX_BOARDS];             // multiplexer channel (0..7) of each board or -1 when the board is directly on its bus
+board_health _board_health[MAX_BOARDS];     // verifier state of each board; only used by the I/O thread of its bus
+i2c_bus _buses[MAX_BUSES];                  // each bus has its own file handle, frame and I/O thread so buses are written in parallel
+int _bus_count = 0;
+unsigned int _flush_buses = 0;              // buses with channels queued since the last flush; only used by the ROS spin thread
+int _transport = TRANSPORT_SMBUS;           // how the block writes of a frame are sent
+int _burst_channels = MAX_BURST_CHANNELS;   // the most channels of one block write; limited by the transport and the i2c_burst_max parameter
+int _burst_max = 0;                         // the i2c_burst_max parameter: the most register bytes of one write or 0 for the limit of the transport
+const char* _transport_names[] = { "smbus", "rdwr", "word", "byte" };
+int _active_board = 0;                      // used to determine which board services and topics work on
+int _broadcast_address = _ALLCALL_ADDR;     // ALLCALL or SUBADR1 address used to write the same value to all boards; 0 disables broadcast
+int _mode1 = __ALLCALL | __AUTO_INCREMENT;  // MODE1 value programmed into each board
+const i2c_backend* _bus = &i2c_backend_linux;	// every I2C transaction is performed through the bus backend
 int _controller_io_device;                  // linux file for I2C
 
 int _pwm_frequency = 50;                    // frequency determines the size of a pulse width; higher numbers make RC servos buzz
+bool _phase_stagger = false;                // spread the start of the pulses of the channels of a board across the PWM period
+int _verify_rate = 0;                       // boards of each bus checked per second by the verifier in idle bus time; 0 disables
+
+io_config _io_config = { false, false, false, 0, 0, -1 };    // settings shared by the I/O threads of all buses
+
+servo_motion _motions[MAX_SERVOS];          // motion profile of each servo; only used by the I/O thread of the bus of the servo
+bool _motion_profiles = false;              // the servos_motion topic has been enabled with the motion_profiles parameter
+bool _realtime = false;                     // the memory is locked and the stacks prefaulted; set with the realtime parameter or i2cpwm_controller_realtime()
+
+unsigned int _servo_mailbox[MAX_SERVOS];    // newest unwritten value of each servo when commands are conflated
+unsigned int _mailbox_boards[MAILBOX_WORDS];// bit mask of boards with at least one pending mailbox slot
+pose_buffer _poses[2];                      // the back buffer is filled by the pose topics while the I/O threads stage the other
+int _pose_back = 0;                         // index of the back buffer; only used by the ROS spin thread
+int _pose_servos = 0;                       // servos in the back buffer
+stored_pose _stored_poses[MAX_POSES];       // pose library; written by the ROS spin thread and read by the I/O threads while recalled
+topic_deadline _deadlines[DEADLINE_TOPICS] = { {"servos_absolute"}, {"servos_proportional"}, {"servos_frame"}, {"servos_drive"}, {"servos_motion"} };
+int _deadline_count = 0;                    // topics with a deadline; the deadlines are checked on each tick of the output scheduler
+const char* _failsafe_names[] = { "coast", "hold", "pose" };
+
+enum stats_counters {
+	STAT_WRITES         = 0,    // I2C write transactions
+	STAT_WRITE_ERRORS   = 1,    // I2C write transactions which failed
+	STAT_WRITE_BYTES    = 2,    // register bytes written
+	STAT_ADDRESS_SWITCHES = 3,  // I2C_SLAVE address changes
+	STAT_FRAMES         = 4,    // frames flushed
+	STAT_ABSOLUTE       = 5,    // servos_absolute messages
+	STAT_PROPORTIONAL   = 6,    // servos_proportional messages
+	STAT_DRIVE          = 7,    // servos_drive messages
+	STAT_TRANSFERS      = 8,    // combined I2C_RDWR transfers
+	STAT_MUX_SWITCHES   = 9,    // multiplexer channel changes
+	STAT_MOTION         = 10,   // servos_motion messages
+	STAT_FRAME          = 11,   // servos_frame messages
+	STAT_VERIFY_READS   = 12,   // boards checked by the verifier
+	STAT_VERIFY_ERRORS  = 13,   // checks which could not read a board
+	STAT_VERIFY_MISMATCHES = 14,// sampled channels which did not match the shadow
+	STAT_BOARD_RESETS   = 15,   // boards found reset and restored
+	STAT_POSES          = 16,   // committed poses
+	STAT_RECALLS        = 17,   // pose_recall messages
+	STAT_DEADLINES      = 18,   // missed topic deadlines which applied a fail-safe
+	STAT_COUNTERS       = 19
+};
+
+enum stats_histograms {
+	HIST_WRITE          = 0,    // duration of an I2C write transaction
+	HIST_ADDRESS        = 1,    // duration of an I2C_SLAVE address change
+	HIST_ABSOLUTE       = 2,    // duration of the servos_absolute callback
+	HIST_PROPORTIONAL   = 3,    // duration of the servos_proportional callback
+	HIST_DRIVE          = 4,    // duration of the servos_drive callback
+	HIST_LATENCY        = 5,    // time from the start of a callback until its values have been written to the bus
+	HIST_FRAME          = 6,    // duration of the servos_frame callback
+	STAT_HISTOGRAMS     = 7
+};
+
+#define STATS_BUCKETS 32            // histogram bucket n counts durations from 2^(n-1) up to 2^n nanoseconds
+#define STATS_THREADS (MAX_BUSES+2) // threads with their own statistics; any further threads share the last slot
+
+typedef struct _stats_histogram {
+	unsigned int count[STATS_BUCKETS];
+	unsigned long long max;
+} stats_histogram;
+
+typedef struct _thread_stats {
+	int shared;                                 // non-zero if more than one thread writes to this slot
+	unsigned long long counters[STAT_COUNTERS];
+	stats_histogram histograms[STAT_HISTOGRAMS];
+} thread_stats;
+
+thread_stats _stats[STATS_THREADS];         // each thread updates only its own slot so no locks or atomic read-modify-write are needed
+int _stats_threads = 0;
+static __thread thread_stats* _thread_stats = NULL;
+long long _message_stamp = 0;               // receive time of the message being handled by the ROS spin thread
+i2cpwm_trace_hook _trace_hook = NULL;       // called at each stage of every servo message or NULL; set with i2cpwm_controller_trace()
+double _diagnostics_rate = 1.0;             // statistics are published this many times per second; 0 disables publishing
+ros::Publisher _diagnostics_pub;
+double _state_rate = 0.0;                   // the most times per second the servos_state topic is published; 0 disables the topic
+ros::Publisher _state_pub;
+i2cpwm_board::ServoArray _state_msg;        // reused for every publish; room for every servo is reserved when the topic is advertised
+unsigned int _state_seq[MAX_BOARDS];        // shadow sequence number of each board when the servos_state topic was last published
+int _state_subscribers = 0;                 // subscribers of the servos_state topic at its last publish
 
 
 /// @endcond PRIVATE_NO_PUBLIC DOC
@@ -338,6 +726,99 @@ static float _absmax (float v1, float v2)
 
 
 
+/**
+ * \private method to read the monotonic clock
+ *
+ *@returns the time in nanoseconds
+ */
+static long long _stats_now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (((long long)ts.tv_sec) * 1000000000LL) + ts.tv_nsec;
+}
+
+
+/**
+ * \private method to get the statistics slot of the calling thread
+ *
+ *@returns the slot, which is assigned the first time a thread records a statistic
+ */
+static thread_stats* _stats_slot (void)
+{
+	if (!_thread_stats) {
+		int slot = __atomic_fetch_add (&_stats_threads, 1, __ATOMIC_RELAXED);
+		if (slot >= (STATS_THREADS-1)) {
+			slot = STATS_THREADS-1;
+			__atomic_store_n (&(_stats[slot].shared), 1, __ATOMIC_RELAXED);
+		}
+		_thread_stats = &(_stats[slot]);
+	}
+	return _thread_stats;
+}
+
+
+/**
+ * \private method to add to one of the stats_counters
+ *
+ *@param counter one of the stats_counters
+ *@param n the amount to add
+ */
+static void _stats_count (int counter, unsigned long long n)
+{
+	thread_stats* sp = _stats_slot ();
+	unsigned long long* cp = &(sp->counters[counter]);
+
+	if (sp->shared)
+		__atomic_fetch_add (cp, n, __ATOMIC_RELAXED);
+	else
+		__atomic_store_n (cp, *cp + n, __ATOMIC_RELAXED);	// a single writer; the store only has to be untorn for the reader
+}
+
+
+/**
+ * \private method to add a duration to one of the stats_histograms
+ *
+ *@param histogram one of the stats_histograms
+ *@param start the monotonic time in nanoseconds from _stats_now() when the measured interval started
+ */
+static void _stats_time (int histogram, long long start)
+{
+	long long ns = _stats_now () - start;
+	thread_stats* sp = _stats_slot ();
+	stats_histogram* hp = &(sp->histograms[histogram]);
+
+	if (ns < 1)
+		ns = 1;
+	int bucket = 64 - __builtin_clzll ((unsigned long long)ns);
+	if (bucket >= STATS_BUCKETS)
+		bucket = STATS_BUCKETS-1;
+
+	if (sp->shared)
+		__atomic_fetch_add (&(hp->count[bucket]), 1, __ATOMIC_RELAXED);
+	else
+		__atomic_store_n (&(hp->count[bucket]), hp->count[bucket] + 1, __ATOMIC_RELAXED);
+	if ((unsigned long long)ns > __atomic_load_n (&(hp->max), __ATOMIC_RELAXED))
+		__atomic_store_n (&(hp->max), (unsigned long long)ns, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * \private method to report a stage of a servo message to the trace hook
+ *
+ *@param stage one of the i2cpwm_trace_stages
+ *@param stamp the receive time of the message from _stats_now(), which identifies it
+ *@param buses bit mask of the buses of the stage
+ */
+static void _trace (int stage, long long stamp, unsigned int buses)
+{
+	if (_trace_hook)
+		_trace_hook (stage, stamp, buses, _stats_now ());
+}
+
+
+
 /**
  \private method to smooth a speed value
  
@@ -359,316 +840,2898 @@ static int _smoothing (float speed)
 /**
    \private method to convert meters per second to a proportional value in the range of ±1.0
  
+   @param drivep the drive mode
    @param speed float requested speed in meters per second
    @returns float value (±1.0) for servo speed
  */
-static float _convert_mps_to_proportional (float speed)
+static float _convert_mps_to_proportional (const drive_mode* drivep, float speed)
 {
 	/* we use the drive mouter output rpm and wheel radius to compute the conversion */
+	/* the max m/s is ((rpm/60) * (2*PI*radius)) and is computed once by _config_drive_mode() */
 
-	float initial, max_rate;	// the max m/s is ((rpm/60) * (2*PI*radius))
-
-	initial = speed;
-	
-	if (_active_drive.rpm <= 0.0) {
-        ROS_ERROR("Invalid active drive mode RPM %6.4f :: RPM must be greater than 0", _active_drive.rpm);
-		return 0.0;
-	}
-	if (_active_drive.radius <= 0.0) {
-        ROS_ERROR("Invalid active drive mode radius %6.4f :: wheel radius must be greater than 0", _active_drive.radius);
+	if (drivep->inv_max_rate <= 0.0) {
+        ROS_ERROR("Invalid active drive mode RPM %6.4f and radius %6.4f :: RPM and wheel radius must be greater than 0", drivep->rpm, drivep->radius);
 		return 0.0;
 	}
 
-	max_rate = (_active_drive.radius * _PI * 2) * (_active_drive.rpm / 60.0);
+	float proportional = speed * drivep->inv_max_rate;
+	// proportional = _absmin (proportional, 1.0);
 
-	speed = speed / max_rate;
-	// speed = _absmin (speed, 1.0);
-
-	ROS_DEBUG("%6.4f = convert_mps_to_proportional ( speed(%6.4f) / ((radus(%6.4f) * pi(%6.4f) * 2) * (rpm(%6.4f) / 60.0)) )", speed, initial, _active_drive.radius, _PI, _active_drive.rpm);
-	return speed;
+	_WRITE_DEBUG("%6.4f = convert_mps_to_proportional ( speed(%6.4f) / max_rate(%6.4f) )", proportional, speed, drivep->max_rate);
+	return proportional;
 }
 
 
 
 /**
- * \private method to set a pulse frequency
+ * \private method to select the I2C slave address for subsequent transactions on a bus
  *
- *The pulse defined by start/stop will be active on all channels until any subsequent call changes it.
- *@param frequency an int value (1..15000) indicating the pulse frequency where 50 is typical for RC servos
- *Example _set_frequency (68)  // set the pulse frequency to 68Hz
+ *@param busp the bus
+ *@param address an int value of the 7 bit I2C address, eg 0x40 for the first board
+ *@returns 0 on success or -1 on error
  */
-static void _set_pwm_frequency (int freq)
+static int _set_slave_address (i2c_bus* busp, int address)
 {
-    int prescale;
-    char oldmode, newmode;
-    int res;
-
-    _pwm_frequency = freq;   // save to global
-    
-	ROS_DEBUG("_set_pwm_frequency prescale");
-    float prescaleval = 25000000.0; // 25MHz
-    prescaleval /= 4096.0;
-    prescaleval /= (float)freq;
-    prescaleval -= 1.0;
-    //ROS_INFO("Estimated pre-scale: %6.4f", prescaleval);
-    prescale = floor(prescaleval + 0.5);
-    // ROS_INFO("Final pre-scale: %d", prescale);
-
+	if (busp->active_address == address)
+		return 0;
 
-	ROS_INFO("Setting PWM frequency to %d Hz", freq);
-
-    nanosleep ((const struct timespec[]){{1, 000000L}}, NULL); 
+	long long start = _stats_now ();
+	_stats_count (STAT_ADDRESS_SWITCHES, 1);
 
+	if (0 > _bus->set_address (busp->handle, address)) {
+		ROS_FATAL ("Failed to acquire bus access and/or talk to I2C slave at address 0x%02X on /dev/i2c-%d", address, busp->device);
+		busp->active_address = -1;
+		return -1; /* exit(1) */   /* additional ERROR HANDLING information is available with 'errno' */
+	}
+	busp->active_address = address;
+	_stats_time (HIST_ADDRESS, start);
+	return 0;
+}
 
-    oldmode = i2c_smbus_read_byte_data (_controller_io_handle, __MODE1);
-    newmode = (oldmode & 0x7F) | 0x10; // sleep
 
-    if (0 > i2c_smbus_write_byte_data (_controller_io_handle, __MODE1, newmode)) // go to sleep
-        ROS_ERROR("Unable to set PWM controller to sleep mode"); 
+/**
+ * \private method to select the multiplexer channel of a board for subsequent transactions on a bus
+ *
+ *A channel selection takes effect at the STOP of its transaction so a channel can not be changed within a combined transfer.
+ *@param busp the bus
+ *@param channel an int value (0..7) of the channel or -1 for a board directly on the bus, which is reached on any channel
+ *@returns 0 on success or -1 on error
+ */
+static int _set_mux_channel (i2c_bus* busp, int channel)
+{
+	if ((channel < 0) || (busp->mux_channel == channel))
+		return 0;
 
-    if (0 >  i2c_smbus_write_byte_data(_controller_io_handle, __PRESCALE, (int)(floor(prescale))))
-        ROS_ERROR("Unable to set PWM controller prescale"); 
+	if (0 > _set_slave_address (busp, busp->mux_address))
+		return -1;
 
-    if (0 > i2c_smbus_write_byte_data(_controller_io_handle, __MODE1, oldmode))
-        ROS_ERROR("Unable to set PWM controller to active mode"); 
+	// a PCA9685 which responds to the same address as its ALLCALL address takes a single byte as a register pointer only
+	_stats_count (STAT_MUX_SWITCHES, 1);
+	if (0 > _bus->send_byte (busp->handle, (1 << channel))) {
+		ROS_ERROR ("Failed to select channel %d of the I2C multiplexer at address 0x%02X on /dev/i2c-%d", channel, busp->mux_address, busp->device);
+		busp->mux_channel = -1;
+		return -1;
+	}
+	busp->mux_channel = channel;
+	return 0;
+}
 
-    nanosleep((const struct timespec[]){{0, 5000000L}}, NULL);   //sleep 5microsec,
 
-    if (0 > i2c_smbus_write_byte_data(_controller_io_handle, __MODE1, oldmode | 0x80))
-        ROS_ERROR("Unable to restore PWM controller to active mode");
+/**
+ * \private method to select the multiplexer channel and I2C slave address of a board for subsequent transactions
+ *
+ *@param busp the bus of the board
+ *@param board an int value (0..61) of the hardware board
+ *@returns 0 on success or -1 on error
+ */
+static int _set_board_address (i2c_bus* busp, int board)
+{
+	if (0 > _set_mux_channel (busp, _board_channel[board]))
+		return -1;
+	return _set_slave_address (busp, _board_address[board]);
 }
 
 
-
 /**
- * \private method to set a common value for all PWM channels on the active board
+ * \private method to find the bus of a board
  *
- *The pulse defined by start/stop will be active on all channels until any subsequent call changes it.
- *@param start an int value (0..4096) indicating when the pulse will go high sending power to each channel.
- *@param end an int value (0..4096) indicating when the pulse will go low stoping power to each channel.
- *Example _set_pwm_interval_all (0, 108)   // set all servos with a pulse width of 105
+ *@param board an int value (0..61) of the hardware board
+ *@returns the bus or NULL when the board is not assigned to a bus
  */
-static void _set_pwm_interval_all (int start, int end)
+static i2c_bus* _board_busp (int board)
 {
-    // the public API is ONE based and hardware is ZERO based
-    if ((_active_board<1) || (_active_board>62)) {
-        ROS_ERROR("Internal error - invalid active board number %d :: PWM board numbers must be between 1 and 62", _active_board);
-        return;
-    }
-    int board = _active_board - 1;
-
-    if (0 > i2c_smbus_write_byte_data (_controller_io_handle, __ALL_CHANNELS_ON_L, start & 0xFF))
-        ROS_ERROR ("Error setting PWM start low byte for all servos on board %d", _active_board);
-    if (0 >  i2c_smbus_write_byte_data (_controller_io_handle, __ALL_CHANNELS_ON_H, start  >> 8))
-        ROS_ERROR ("Error setting PWM start high byte for all servos on board %d", _active_board);
-    if (0 > i2c_smbus_write_byte_data (_controller_io_handle, __ALL_CHANNELS_OFF_L, end & 0xFF))
-        ROS_ERROR ("Error setting PWM end low byte for all servos on board %d", _active_board);
-    if (0 > i2c_smbus_write_byte_data (_controller_io_handle, __ALL_CHANNELS_OFF_H, end >> 8))
-        ROS_ERROR ("Error setting PWM end high byte for all servos on board %d", _active_board);
+	if ((board < 0) || (board >= MAX_BOARDS) || (_board_bus[board] < 0))
+		return NULL;
+	return &(_buses[_board_bus[board]]);
 }
 
 
-
 /**
- * \private method to set the active board
+ * \private method to count the boards which have been activated
  *
- *@param board an int value (1..62) indicating which board to activate for subsequent service and topic subscription activity where 1 coresponds to the default board address of 0x40 and value increment up
- *Example _set_active_board (68)   // set the pulse frequency to 68Hz
+ *@param busp the bus to count or NULL for all buses
+ *@returns the number of boards
  */
-static void _set_active_board (int board)
+static int _active_board_count (const i2c_bus* busp)
 {
-	char mode1res;
+	int i, count = 0;
 
-	if ((board<1) || (board>62)) {
-        ROS_ERROR("Internal error :: invalid board number %d :: board numbers must be between 1 and 62", board);
-        return;
-    }
-    if (_active_board != board) {
-        _active_board = board;   // save to global
-        
-        // the public API is ONE based and hardware is ZERO based
-        board--;
-        
-        if (0 > ioctl (_controller_io_handle, I2C_SLAVE, (_BASE_ADDR+(board)))) {
-            ROS_FATAL ("Failed to acquire bus access and/or talk to I2C slave at address 0x%02X", (_BASE_ADDR+board));
-            return; /* exit(1) */   /* additional ERROR HANDLING information is available with 'errno' */
-        }
+	if (busp)
+		return busp->active_count;
+	for (i=0; i<_bus_count; i++)
+		count += _buses[i].active_count;
+	return count;
+}
 
-        if (_pwm_boards[board]<0) {
-            _pwm_boards[board] = 1;
 
-            /* this is guess but I believe the following needs to be done on each board only once */
+/**
+ * \private method to mark a board as activated and add it to the active boards of its bus
+ *
+ *The list of each bus stays grouped by multiplexer channel so loops over the active boards select each channel only once.
+ *@param busp the bus of the board
+ *@param board an int value (0..61) of the hardware board
+ */
+static void _board_activate (i2c_bus* busp, int board)
+{
+	int i;
 
-            if (0 > i2c_smbus_write_byte_data (_controller_io_handle, __MODE2, __OUTDRV))
-                ROS_ERROR ("Failed to enable PWM outputs for totem-pole structure");
+	if (_pwm_boards[board] > 0)
+		return;
+	_pwm_boards[board] = 1;
 
-            if (0 > i2c_smbus_write_byte_data (_controller_io_handle, __MODE1, __ALLCALL))
-                ROS_ERROR ("Failed to enable ALLCALL for PWM channels");
+	for (i=busp->active_count; (i > 0) && (_board_channel[busp->active_boards[i-1]] > _board_channel[board]); i--)
+		busp->active_boards[i] = busp->active_boards[i-1];
+	busp->active_boards[i] = board;
+	busp->active_count++;
+}
 
-            nanosleep ((const struct timespec[]){{0, 5000000L}}, NULL);   //sleep 5microsec, wait for osci
 
+/**
+ * \private method to determine if the same value is to be written to all boards of a bus with a single broadcast transaction
+ *
+ *A broadcast reaches every board on the bus and is only worthwhile with more than one board.
+ *Behind a multiplexer a broadcast only reaches the boards of the selected channel, so boards on a bus with a multiplexer are written individually.
+ *@param busp the bus
+ *@returns non-zero when broadcast writes are to be used
+ */
+static int _use_broadcast (const i2c_bus* busp)
+{
+	return (_broadcast_address && !busp->mux_address && (_active_board_count(busp) > 1));
+}
 
-            mode1res = i2c_smbus_read_byte_data (_controller_io_handle, __MODE1);
-            mode1res = mode1res & ~__SLEEP; //                 # wake up (reset sleep)
 
-            if (0 > i2c_smbus_write_byte_data (_controller_io_handle, __MODE1, mode1res))
-                ROS_ERROR ("Failed to recover from low power mode");
 
-            nanosleep((const struct timespec[]){{0, 5000000L}}, NULL);   //sleep 5microsec, wait for osci
+/**
+ * \private method to invalidate the shadow of the last written channel values
+ *
+ *The next value staged for each channel is written even when it matches the shadow.
+ *@param busp the bus of the boards to invalidate or NULL for all buses
+ *@param board an int value (1..62) indicating which board to invalidate or 0 for all boards
+ */
+static void _frame_invalidate (const i2c_bus* busp, int board)
+{
+	int i;
 
-            // the first time we activate a board, we mark it and set all of its servo channels to 0
-            _set_pwm_interval_all (0, 0);
-        }
-    }
+	for (i=0; i<MAX_BOARDS; i++) {
+		if (busp && (_board_bus[i] != busp->index))
+			continue;
+		if ((board == 0) || (board == (i+1)))	// API is ONE based
+			_pwm_frames[i].cached = 0;
+	}
 }
 
 
-
 /**
- * \private method to set a value for a PWM channel on the active board
+ * \private method to begin an update of the shadow of a frame
  *
- *The pulse defined by start/stop will be active on the specified servo channel until any subsequent call changes it.
- *@param servo an int value (1..16) indicating which channel to change power
- *@param start an int value (0..4096) indicating when the pulse will go high sending power to each channel.
- *@param end an int value (0..4096) indicating when the pulse will go low stoping power to each channel.
- *Example _set_pwm_interval (3, 0, 350)    // set servo #3 (fourth position on the hardware board) with a pulse of 350
+ *The shadow is only written by the thread which owns the bus of the board; _shadow_read() may run on any thread.
+ *@param framep the frame
  */
-static void _set_pwm_interval (int servo, int start, int end)
+static void _shadow_begin (pwm_frame* framep)
 {
-	ROS_DEBUG("_set_pwm_interval enter");
+	__atomic_store_n (&(framep->seq), framep->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+}
 
-    if ((servo<1) || (servo>(MAX_SERVOS))) {
-        ROS_ERROR("Invalid servo number %d :: servo numbers must be between 1 and %d", servo, MAX_BOARDS);
-        return;
-    }
 
-	int board = ((int)((servo-1)/16))+1;	// servo 1..16 is board #1, servo 17..32 is board #2, etc.
-	_set_active_board(board);
+/**
+ * \private method to end an update of the shadow of a frame started with _shadow_begin()
+ *
+ *@param framep the frame
+ */
+static void _shadow_end (pwm_frame* framep)
+{
+	__atomic_store_n (&(framep->seq), framep->seq + 1, __ATOMIC_RELEASE);
+}
 
-	servo = ((servo-1) % 16) + 1;			// servo numbers are 1..16
 
+/**
+ * \private method to copy a consistent shadow of a frame while the thread of its bus may be writing it
+ *
+ *@param framep the frame
+ *@param shadow receives the 64 registers of the shadow
+ *@param known receives the bit mask of the channels with a value in the shadow
+ *@returns the sequence number of the copy; it only changes when the shadow is updated
+ */
+static unsigned int _shadow_read (const pwm_frame* framep, unsigned char* shadow, unsigned int* known)
+{
+	unsigned int seq;
 
-    // the public API is ONE based and hardware is ZERO based
-    board = _active_board - 1;				// the hardware enumerates boards as 0..61
-    int channel = servo - 1;				// the hardware enumerates servos as 0..15
-	ROS_DEBUG("_set_pwm_interval board=%d servo=%d", board, servo);
-    
-    if (0 > i2c_smbus_write_byte_data (_controller_io_handle, __CHANNEL_ON_L+4*channel, start & 0xFF))
-        ROS_ERROR ("Error setting PWM start low byte on servo %d on board %d", servo, _active_board);
-    if (0 >  i2c_smbus_write_byte_data (_controller_io_handle, __CHANNEL_ON_H+4*channel, start  >> 8))
-        ROS_ERROR ("Error setting PWM start high byte on servo %d on board %d", servo, _active_board);
-    if (0 > i2c_smbus_write_byte_data (_controller_io_handle, __CHANNEL_OFF_L+4*channel, end & 0xFF))
-        ROS_ERROR ("Error setting PWM end low byte on servo %d on board %d", servo, _active_board);
-    if (0 > i2c_smbus_write_byte_data (_controller_io_handle, __CHANNEL_OFF_H+4*channel, end >> 8))
-        ROS_ERROR ("Error setting PWM end high byte on servo %d on board %d", servo, _active_board);
+	for (;;) {
+		seq = __atomic_load_n (&(framep->seq), __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			sched_yield ();
+			continue;
+		}
+		memcpy (shadow, framep->shadow, sizeof(framep->shadow));
+		*known = framep->known;
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+		if (seq == __atomic_load_n (&(framep->seq), __ATOMIC_RELAXED))
+			return seq;
+	}
 }
 
 
 
 /**
- * \private method to set a value for a PWM channel, based on a range of ±1.0, on the active board
+ * \private method to list the active boards of a bus grouped by multiplexer channel
  *
- *The pulse defined by start/stop will be active on the specified servo channel until any subsequent call changes it.
- *@param servo an int value (1..16) indicating which channel to change power
- *@param value an int value (±1.0) indicating when the size of the pulse for the channel.
- *Example _set_pwm_interval (3, 0, 350)    // set servo #3 (fourth position on the hardware board) with a pulse of 350
+ *Writing the boards in this order selects each channel of the multiplexer only once.
+ *@param busp the bus
+ *@param boards receives the boards (0..61)
+ *@returns the number of boards
  */
-static void _set_pwm_interval_proportional (int servo, float value)
+static int _active_bus_boards (const i2c_bus* busp, int* boards)
 {
-	// need a little wiggle room to allow for accuracy of a floating point value
-	if ((value < -1.0001) || (value > 1.0001)) {
-		ROS_ERROR("Invalid proportion value %f :: proportion values must be between -1.0 and 1.0", value);
-		return;
-	}
-
-	servo_config* configp = &(_servo_configs[servo-1]);
-	
-	if ((configp->center < 0) ||(configp->range < 0)) {
-		ROS_ERROR("Missing servo configuration for servo[%d]", servo);
-		return;
-	}
-
-	int pos = (configp->direction * (((float)(configp->range) / 2) * value)) + configp->center;
-        
-	if ((pos < 0) || (pos > 4096)) {
-		ROS_ERROR("Invalid computed position servo[%d] = (direction(%d) * ((range(%d) / 2) * value(%6.4f))) + %d = %d", servo, configp->direction, configp->range, value, configp->center, pos);
-		return;
-	}
-	_set_pwm_interval (servo, 0, pos);
-	ROS_DEBUG("servo[%d] = (direction(%d) * ((range(%d) / 2) * value(%6.4f))) + %d = %d", servo, configp->direction, configp->range, value, configp->center, pos);
+	memcpy (boards, busp->active_boards, busp->active_count * sizeof(int));
+	return busp->active_count;
 }
 
 
-
 /**
- * \private method to configure a servo on the active board
+ * \private method to write the prescale of a board or of the boards at the broadcast address
  *
- *@param servo an int value (1..16)
- *@param center an int value gt 1
- *@param range int value gt 1
- *@param direction an int  either -1 or 1
- *Example _config_server (1, 300, 100, -1)   // configure the first servo with a center of 300 and range of 100 and reversed direction
+ *@param busp the bus
+ *@param board an int value (0..61) of the hardware board or -1 for the broadcast address
+ *@param oldmode the current MODE1 value or -1 to read it from the board
+ *@param prescale the prescale value
  */
-static void _config_servo (int servo, int center, int range, int direction)
+static void _write_prescale (i2c_bus* busp, int board, int oldmode, int prescale)
 {
-	if ((servo < 1) || (servo > (MAX_SERVOS))) {
-		ROS_ERROR("Invalid servo number %d :: servo numbers must be between 1 and %d", servo, MAX_SERVOS);
-		return;
-	}
+    char newmode;
 
-	if ((center < 0) || (center > 4096))
-		ROS_ERROR("Invalid center value %d :: center values must be between 0 and 4096", center);
+    if (0 > ((board < 0) ? _set_slave_address (busp, _broadcast_address) : _set_board_address (busp, board)))
+        return;
+    if (oldmode < 0)
+        oldmode = _bus->read_byte (busp->handle, __MODE1);
+    newmode = (oldmode & 0x7F) | 0x10; // sleep
 
-	if ((center < 0) || (center > 4096))
-		ROS_ERROR("Invalid range value %d :: range values must be between 0 and 4096", range);
+    if (0 > _bus->write_byte (busp->handle, __MODE1, newmode)) // go to sleep
+        ROS_ERROR("Unable to set PWM controller to sleep mode");
 
-	if (((center - (range/2)) < 0) || (((range/2) + center) > 4096))
-		ROS_ERROR("Invalid range center combination %d ± %d :: range/2 ± center must be between 0 and 4096", center, (range/2));
+    if (0 >  _bus->write_byte (busp->handle, __PRESCALE, prescale))
+        ROS_ERROR("Unable to set PWM controller prescale");
 
-	_servo_configs[servo-1].center = center;
-	_servo_configs[servo-1].range = range;
-	_servo_configs[servo-1].direction = direction;
-	// _servo_configs[servo-1].mode_pos = POSITION_UNDEFINED;
+    if (0 > _bus->write_byte (busp->handle, __MODE1, oldmode))
+        ROS_ERROR("Unable to set PWM controller to active mode");
 
-	if (servo > _last_servo)	// used for internal optimizations
-		_last_servo = servo;
+    nanosleep((const struct timespec[]){{0, 5000000L}}, NULL);   //sleep 5microsec,
 
-	ROS_INFO("Servo #%d configured: center=%d, range=%d, direction=%d", servo, center, range, direction);
+    if (0 > _bus->write_byte (busp->handle, __MODE1, oldmode | 0x80))
+        ROS_ERROR("Unable to restore PWM controller to active mode");
 }
 
 
-static int _config_servo_position (int servo, int position)
+/**
+ * \private method to compute the PRESCALE register value of a pulse frequency
+ *
+ *@param freq an int value (1..15000) of the pulse frequency
+ *@returns the prescale value
+ */
+static int _pwm_prescale (int freq)
 {
-	if ((servo < 1) || (servo > (MAX_SERVOS))) {
-		ROS_ERROR("Invalid servo number %d :: servo numbers must be between 1 and %d", servo, MAX_SERVOS);
-		return -1;
-	}
-	if ((position < POSITION_UNDEFINED) || (position > POSITION_RIGHTREAR)) {
-		ROS_ERROR("Invalid drive mode position %d :: positions are 0 = non-drive, 1 = left front, 2 = right front, 3 = left rear, and 4 = right rear", position);
-		return -1;
-	}
-	_servo_configs[servo-1].mode_pos = position;
-	ROS_INFO("Servo #%d configured: position=%d", servo, position);
-	return 0;
+    float prescaleval = 25000000.0; // 25MHz
+    prescaleval /= 4096.0;
+    prescaleval /= (float)freq;
+    prescaleval -= 1.0;
+    //ROS_INFO("Estimated pre-scale: %6.4f", prescaleval);
+    return floor(prescaleval + 0.5);
 }
 
 
-static int _config_drive_mode (std::string mode, float rpm, float radius, float track, float scale)
+/**
+ * \private method to set a pulse frequency
+ *
+ *The pulse defined by start/stop will be active on all channels until any subsequent call changes it.
+ *With broadcast writes and more than one board, every board of the bus is set; otherwise only the active board when it is on the bus.
+ *@param busp the bus
+ *@param frequency an int value (1..15000) indicating the pulse frequency where 50 is typical for RC servos
+ *Example _set_frequency (busp, 68)  // set the pulse frequency to 68Hz
+ */
+static void _set_pwm_frequency (i2c_bus* busp, int freq)
 {
-	int mode_val = MODE_UNDEFINED;
+    int prescale;
+    int i;
 
-	// assumes the parameter was provided in the proper case
-	if 		(0 == strcmp (mode.c_str(), _CONST("ackerman")))
-		mode_val = MODE_ACKERMAN;
-	else if (0 == strcmp (mode.c_str(), _CONST("differential")))
-		mode_val = MODE_DIFFERENTIAL;
-	else if (0 == strcmp (mode.c_str(), _CONST("mecanum")))
-		mode_val = MODE_MECANUM;
-	else {
-		mode_val = MODE_INVALID;
-		ROS_ERROR("Invalid drive mode %s :: drive mode must be one of ackerman, differential, or mecanum", mode.c_str());
-		return -1;
-	}
+    _pwm_frequency = freq;   // save to global
+
+	ROS_DEBUG("_set_pwm_frequency prescale");
+    prescale = _pwm_prescale (freq);
+
+
+	ROS_INFO("Setting PWM frequency to %d Hz on /dev/i2c-%d", freq, busp->device);
+
+    nanosleep ((const struct timespec[]){{1, 000000L}}, NULL);
+
+    if (_use_broadcast (busp)) {
+        // every board shares the frequency; a broadcast can not be read so the MODE1 value programmed into each board is used
+        _write_prescale (busp, -1, _mode1, prescale);
+        _frame_invalidate (busp, 0);  // the boards have been through a sleep and restart cycle
+        return;
+    }
+
+    if (_broadcast_address && (_active_board_count (NULL) > 1)) {
+        // the boards of the other buses are being set too; the boards of this bus are not reached by a broadcast
+        int boards[MAX_BOARDS];
+        int count = _active_bus_boards (busp, boards);
+        for (i=0; i<count; i++) {
+            _write_prescale (busp, boards[i], -1, prescale);
+            _frame_invalidate (busp, boards[i]+1);
+        }
+        return;
+    }
+
+    if ((_active_board < 1) || (_board_bus[_active_board-1] != busp->index))
+        return;
+    _write_prescale (busp, _active_board-1, -1, prescale);
+    _frame_invalidate (busp, _active_board);  // the board has been through a sleep and restart cycle
+}
+
+
+
+/**
+ * \private method to record a common value written to all PWM channels of a board in its frame
+ *
+ *@param board an int value (0..61) of the hardware board
+ *@param data the ON_L, ON_H, OFF_L, OFF_H values written
+ *@param ok non-zero if the write was successful
+ */
+static void _frame_set_all (int board, const unsigned char* data, int ok)
+{
+    pwm_frame* framep = &(_pwm_frames[board]);
+
+    if (!ok) {
+        framep->cached = 0;     // the state of the hardware is unknown
+        return;
+    }
+
+    // keep the frame image of the board consistent with the hardware; staged channels keep their pending value
+    _shadow_begin (framep);
+    for (int channel=0; channel<16; channel++) {
+        memcpy (&(framep->shadow[4*channel]), data, 4);
+        if (!(framep->dirty & (1 << channel)))
+            memcpy (&(framep->regs[4*channel]), data, 4);
+    }
+    framep->known = 0xFFFF;
+    _shadow_end (framep);
+    framep->cached = 0xFFFF;
+}
+
+
+/**
+ * \private method to write consecutive registers of the selected board with the write strategy of the transport
+ *
+ *The boards have auto increment enabled, so a block write of the whole span is used when the adapter supports it.
+ *Otherwise the span is split into SMBus word writes of two registers or byte writes of one register.
+ *@param busp the bus; the board or broadcast address is already selected
+ *@param reg the first register
+ *@param length the number of registers (1..64)
+ *@param data the register values
+ *@returns 0 on success or -1 on error
+ */
+static int _write_registers (i2c_bus* busp, int reg, int length, const unsigned char* data)
+{
+	int i;
+
+	switch (_transport) {
+	case TRANSPORT_BYTE:
+		for (i=0; i<length; i++) {
+			if (0 > _bus->write_byte (busp->handle, reg+i, data[i]))
+				return -1;
+		}
+		return 0;
+	case TRANSPORT_WORD:
+		for (i=0; (i+1)<length; i+=2) {
+			if (0 > _bus->write_word (busp->handle, reg+i, data[i] | (data[i+1] << 8)))
+				return -1;
+		}
+		if ((i < length) && (0 > _bus->write_byte (busp->handle, reg+i, data[i])))
+			return -1;
+		return 0;
+	case TRANSPORT_RDWR:
+		// a span longer than an SMBus block is sent as a single I2C_RDWR message
+		if (length > I2C_SMBUS_BLOCK_MAX) {
+			unsigned char buffer[(4*MAX_RDWR_CHANNELS)+1];
+			i2c_write_msg msg = { busp->active_address, length+1, buffer };
+			buffer[0] = reg;
+			memcpy (&(buffer[1]), data, length);
+			return (0 > _bus->write_multi (busp->handle, &msg, 1)) ? -1 : 0;
+		}
+		break;
+	}
+	return (0 > _bus->write_block (busp->handle, reg, length, data)) ? -1 : 0;
+}
+
+
+/**
+ * \private method to determine if the adapter of every open bus supports a transport
+ *
+ *@param transport one of the transports
+ *@returns non-zero when every bus supports the transport
+ */
+static int _transport_supported (int transport)
+{
+	// the I2C_FUNCS bits each write strategy needs; every SMBus adapter handles byte writes
+	static const unsigned long needs[] = { I2C_FUNC_SMBUS_WRITE_I2C_BLOCK, I2C_FUNC_I2C, I2C_FUNC_SMBUS_WRITE_WORD_DATA, 0 };
+
+	for (int i=0; i<_bus_count; i++) {
+		if ((_bus->functionality (_buses[i].handle) & needs[transport]) != needs[transport])
+			return 0;
+	}
+	return 1;
+}
+
+
+/**
+ * \private method to compute the most channels of one block write of the transport
+ */
+static void _transport_burst (void)
+{
+	int limit = (_transport == TRANSPORT_RDWR) ? MAX_RDWR_CHANNELS : MAX_BURST_CHANNELS;
+
+	_burst_channels = ((_burst_max >= 4) && ((_burst_max / 4) < limit)) ? (_burst_max / 4) : limit;
+}
+
+
+/**
+ * \private method to compute the register bytes sent by one write of the transport
+ *
+ *@returns the number of bytes
+ */
+static int _transport_burst_bytes (void)
+{
+	if (_transport == TRANSPORT_WORD)
+		return 2;
+	if (_transport == TRANSPORT_BYTE)
+		return 1;
+	return 4 * _burst_channels;
+}
+
+
+/**
+ * \private method to select a transport and the size of its block writes
+ *
+ *@param transport one of the transports
+ */
+static void _transport_set (int transport)
+{
+	_transport = transport;
+	_transport_burst ();
+
+	ROS_INFO ("Frames are written with the %s transport in writes of up to %d bytes", _transport_names[transport], _transport_burst_bytes ());
+}
+
+
+/**
+ * \private method to set a common value for all PWM channels on a board
+ *
+ *The pulse defined by start/stop will be active on all channels until any subsequent call changes it.
+ *@param board an int value (1..62) indicating which board
+ *@param start an int value (0..4096) indicating when the pulse will go high sending power to each channel.
+ *@param end an int value (0..4096) indicating when the pulse will go low stoping power to each channel.
+ *Example _set_pwm_interval_all (1, 0, 108)   // set all servos of the first board with a pulse width of 105
+ */
+static void _set_pwm_interval_all (int board, int start, int end)
+{
+    // the public API is ONE based and hardware is ZERO based
+    if ((board<1) || (board>62)) {
+        ROS_ERROR("Internal error - invalid board number %d :: PWM board numbers must be between 1 and 62", board);
+        return;
+    }
+    board--;
+    i2c_bus* busp = _board_busp (board);
+    if (!busp)
+        return;
+    unsigned char data[4] = { (unsigned char)(start & 0xFF), (unsigned char)(start >> 8), (unsigned char)(end & 0xFF), (unsigned char)(end >> 8) };
+    int ok = 1;
+
+    if (0 > _set_board_address (busp, board))
+        return;
+
+    // the board has auto increment enabled so all four registers are written in one transaction
+    _stats_count (STAT_WRITES, 1);
+    _stats_count (STAT_WRITE_BYTES, 4);
+    if (0 > _write_registers (busp, __ALL_CHANNELS_ON_L, 4, data)) {
+        ROS_ERROR ("Error setting PWM start and end for all servos on board %d", board+1);
+        _stats_count (STAT_WRITE_ERRORS, 1);
+        ok = 0;
+    }
+    _frame_set_all (board, data, ok);
+}
+
+
+/**
+ * \private method to set a common value for all PWM channels on all boards of a bus with a single broadcast transaction
+ *
+ *@param busp the bus
+ *@param start an int value (0..4096) indicating when the pulse will go high sending power to each channel.
+ *@param end an int value (0..4096) indicating when the pulse will go low stoping power to each channel.
+ *Example _set_pwm_interval_broadcast (busp, 0, 0)   // power off all servos on all boards of the bus
+ */
+static void _set_pwm_interval_broadcast (i2c_bus* busp, int start, int end)
+{
+    unsigned char data[4] = { (unsigned char)(start & 0xFF), (unsigned char)(start >> 8), (unsigned char)(end & 0xFF), (unsigned char)(end >> 8) };
+    int ok = 1;
+    int i;
+
+    if (0 > _set_slave_address (busp, _broadcast_address))
+        return;
+
+    _stats_count (STAT_WRITES, 1);
+    _stats_count (STAT_WRITE_BYTES, 4);
+    if (0 > _write_registers (busp, __ALL_CHANNELS_ON_L, 4, data)) {
+        ROS_ERROR ("Error broadcasting PWM start and end for all servos to address 0x%02X on /dev/i2c-%d", _broadcast_address, busp->device);
+        _stats_count (STAT_WRITE_ERRORS, 1);
+        ok = 0;
+    }
+    for (i=0; i<busp->active_count; i++)
+        _frame_set_all (busp->active_boards[i], data, ok);
+}
+
+
+
+/**
+ * \private method to program the MODE registers of the selected board of a bus and wake it from low power mode
+ *
+ *@param busp the bus with its address set to the board
+ *@returns 0 on success or -1 if a write failed
+ */
+static int _board_init (i2c_bus* busp)
+{
+    char mode1res;
+    int rc = 0;
+
+    if (0 > _bus->write_byte (busp->handle, __MODE2, __OUTDRV)) {
+        ROS_ERROR ("Failed to enable PWM outputs for totem-pole structure");
+        rc = -1;
+    }
+
+    if ((_mode1 & __SUB1) && (0 > _bus->write_byte (busp->handle, __SUBADR1, _broadcast_address << 1))) {
+        ROS_ERROR ("Failed to set the broadcast sub address 0x%02X", _broadcast_address);
+        rc = -1;
+    }
+
+    if (0 > _bus->write_byte (busp->handle, __MODE1, _mode1)) {
+        ROS_ERROR ("Failed to enable ALLCALL and auto increment for PWM channels");
+        rc = -1;
+    }
+
+    nanosleep ((const struct timespec[]){{0, 5000000L}}, NULL);   //sleep 5microsec, wait for osci
+
+
+    mode1res = _bus->read_byte (busp->handle, __MODE1);
+    mode1res = mode1res & ~__SLEEP; //                 # wake up (reset sleep)
+
+    if (0 > _bus->write_byte (busp->handle, __MODE1, mode1res)) {
+        ROS_ERROR ("Failed to recover from low power mode");
+        rc = -1;
+    }
+
+    nanosleep((const struct timespec[]){{0, 5000000L}}, NULL);   //sleep 5microsec, wait for osci
+    return rc;
+}
+
+
+/**
+ * \private method to select a board on its bus and initialize it the first time it is used
+ *
+ *Unlike _set_active_board() the active board of the services is not changed so the I/O thread of any bus may call it.
+ *@param board an int value (1..62) indicating which board
+ *@returns the bus of the board or NULL on error
+ */
+static i2c_bus* _select_board (int board)
+{
+	if ((board<1) || (board>62)) {
+        ROS_ERROR("Internal error :: invalid board number %d :: board numbers must be between 1 and 62", board);
+        return NULL;
+    }
+
+    // the public API is ONE based and hardware is ZERO based
+    board--;
+    i2c_bus* busp = _board_busp (board);
+    if (!busp) {
+        ROS_ERROR("Invalid board number %d :: the board is not assigned to an I2C bus", board+1);
+        return NULL;
+    }
+
+    if (0 > _set_board_address (busp, board))
+        return NULL;
+
+    if (_pwm_boards[board]<0) {
+        _board_activate (busp, board);
+
+        /* this is guess but I believe the following needs to be done on each board only once */
+        _board_init (busp);
+        _write_prescale (busp, board, -1, _pwm_prescale (_pwm_frequency));	// a board first used after set_pwm_frequency() still has the power on prescale
+
+        // the first time we activate a board, we mark it and set all of its servo channels to 0
+        _set_pwm_interval_all (board+1, 0, 0);
+    }
+    return busp;
+}
+
+
+/**
+ * \private method to bring up the boards which will be used in one pass over each bus
+ *
+ *Each board is first probed with a read of MODE1; a board which does not respond is left to be initialized when it is first used.
+ *The boards which respond are then programmed together: the MODE registers and prescale of every board while it sleeps,
+ *a wake of every board, a single wait for the oscillators and finally a restart with every channel off.
+ *The boards of a bus are visited in the order of their multiplexer channels.
+ *@param needed an array of MAX_BOARDS flags of the boards (0..61) to bring up
+ *@param freq an int value (1..15000) of the pulse frequency
+ *@returns the number of boards brought up
+ */
+static int _boards_start (const int* needed, int freq)
+{
+    int ready[MAX_BOARDS];
+    int count = 0;
+    int prescale = _pwm_prescale (freq);
+    int i, j;
+
+    _pwm_frequency = freq;   // save to global
+
+    for (i=0; i<_bus_count; i++) {
+        i2c_bus* busp = &(_buses[i]);
+        int first = count;
+        for (int channel=-1; channel<8; channel++) {
+            for (j=0; j<MAX_BOARDS; j++) {
+                if (!needed[j] || (_pwm_boards[j] > 0) || (_board_bus[j] != busp->index) || (_board_channel[j] != channel))
+                    continue;
+                if ((0 > _set_board_address (busp, j)) || (0 > _bus->read_byte (busp->handle, __MODE1))) {
+                    ROS_WARN("Board %d at 0x%02X on /dev/i2c-%d does not respond :: it will be initialized when it is first used", j+1, _board_address[j], busp->device);
+                    continue;
+                }
+                ready[count++] = j;
+            }
+        }
+        ROS_INFO("Setting PWM frequency to %d Hz on %d boards of /dev/i2c-%d", freq, count - first, busp->device);
+    }
+
+    // the prescale can only be written while the oscillator sleeps
+    for (i=0; i<count; i++) {
+        i2c_bus* busp = _board_busp (ready[i]);
+        if (0 > _set_board_address (busp, ready[i]))
+            continue;
+        if (0 > _bus->write_byte (busp->handle, __MODE2, __OUTDRV))
+            ROS_ERROR ("Failed to enable PWM outputs for totem-pole structure");
+        if ((_mode1 & __SUB1) && (0 > _bus->write_byte (busp->handle, __SUBADR1, _broadcast_address << 1)))
+            ROS_ERROR ("Failed to set the broadcast sub address 0x%02X", _broadcast_address);
+        if (0 > _bus->write_byte (busp->handle, __MODE1, _mode1 | __SLEEP))
+            ROS_ERROR ("Unable to set PWM controller to sleep mode");
+        if (0 > _bus->write_byte (busp->handle, __PRESCALE, prescale))
+            ROS_ERROR ("Unable to set PWM controller prescale");
+    }
+    for (i=0; i<count; i++) {
+        i2c_bus* busp = _board_busp (ready[i]);
+        if ((0 > _set_board_address (busp, ready[i])) || (0 > _bus->write_byte (busp->handle, __MODE1, _mode1)))
+            ROS_ERROR ("Failed to enable ALLCALL and auto increment for PWM channels");
+    }
+
+    if (count)
+        nanosleep ((const struct timespec[]){{0, 5000000L}}, NULL);   // one wait for the oscillators of all boards
+
+    for (i=0; i<count; i++) {
+        i2c_bus* busp = _board_busp (ready[i]);
+        if ((0 > _set_board_address (busp, ready[i])) || (0 > _bus->write_byte (busp->handle, __MODE1, _mode1 | __RESTART)))
+            ROS_ERROR ("Unable to restore PWM controller to active mode");
+        _board_activate (busp, ready[i]);
+        _set_pwm_interval_all (ready[i]+1, 0, 0);	// API is ONE based
+    }
+    return count;
+}
+
+
+/**
+ * \private method to set the active board
+ *
+ *@param board an int value (1..62) indicating which board to activate for subsequent service and topic subscription activity where 1 coresponds to the default board address of 0x40 and value increment up
+ *Example _set_active_board (68)   // set the pulse frequency to 68Hz
+ */
+static void _set_active_board (int board)
+{
+	if ((board<1) || (board>62)) {
+        ROS_ERROR("Internal error :: invalid board number %d :: board numbers must be between 1 and 62", board);
+        return;
+    }
+    _active_board = board;   // save to global
+    _select_board (board);
+}
+
+
+
+/**
+ * \private method to stage a value for a PWM channel in the current frame of its bus
+ *
+ *Nothing is written to the hardware until _frame_flush() is called.
+ *A value which matches the last value written to the channel is not written again.
+ *@param servo an int value (1..992) indicating which servo to change power
+ *@param start an int value (0..4096) indicating when the pulse will go high sending power to the channel.
+ *@param end an int value (0..4096) indicating when the pulse will go low stoping power to the channel.
+ */
+static void _frame_stage (int servo, int start, int end)
+{
+    if ((servo<1) || (servo>(MAX_SERVOS))) {
+        ROS_ERROR("Invalid servo number %d :: servo numbers must be between 1 and %d", servo, MAX_SERVOS);
+        return;
+    }
+
+	// the public API is ONE based and hardware is ZERO based
+	int board = (servo-1) / 16;				// the hardware enumerates boards as 0..61
+	int channel = (servo-1) % 16;			// the hardware enumerates servos as 0..15
+	unsigned int bit = (1 << channel);
+	pwm_frame* framep = &(_pwm_frames[board]);
+	i2c_bus* busp = _board_busp (board);
+
+	if (!busp) {
+		ROS_ERROR("Invalid servo number %d :: board %d is not assigned to an I2C bus", servo, board+1);
+		return;
+	}
+
+	unsigned char* regs = &(framep->regs[4*channel]);
+	regs[0] = start & 0xFF;
+	regs[1] = start >> 8;
+	regs[2] = end & 0xFF;
+	regs[3] = end >> 8;
+
+	if ((framep->cached & bit) && (0 == memcmp (regs, &(framep->shadow[4*channel]), 4))) {
+		framep->dirty &= ~bit;				// the hardware already has this value
+		return;
+	}
+
+	if (!framep->queued) {
+		framep->queued = 1;
+		busp->frame_boards[busp->frame_board_count++] = board;	// first channel staged for this board in the current frame
+	}
+	framep->dirty |= bit;
+}
+
+
+/**
+ * \private method to stage channels of a board from a register image in the current frame of its bus
+ *
+ *The same as _frame_stage() for every channel in the mask with the values already in register order.
+ *@param board an int value (0..61) of the hardware board
+ *@param regs the ON_L, ON_H, OFF_L, OFF_H image of the 16 channels
+ *@param channels bit mask of the channels to stage
+ */
+static void _frame_stage_image (int board, const unsigned char* regs, unsigned int channels)
+{
+	pwm_frame* framep = &(_pwm_frames[board]);
+	i2c_bus* busp = _board_busp (board);
+
+	if (!busp)
+		return;
+
+	while (channels) {
+		int channel = __builtin_ctz (channels);
+		unsigned int bit = (1 << channel);
+		channels &= (channels - 1);
+
+		memcpy (&(framep->regs[4*channel]), &(regs[4*channel]), 4);
+		if ((framep->cached & bit) && (0 == memcmp (&(regs[4*channel]), &(framep->shadow[4*channel]), 4))) {
+			framep->dirty &= ~bit;
+			continue;
+		}
+		if (!framep->queued) {
+			framep->queued = 1;
+			busp->frame_boards[busp->frame_board_count++] = board;
+		}
+		framep->dirty |= bit;
+	}
+}
+
+
+/**
+ * \private method to divide the staged channels of a frame into block writes
+ *
+ *The channels, from the first to the last staged channel, are written from the frame image as block writes.
+ *A block starts at a staged channel and holds at most _burst_channels channels; registers at either end
+ *of a block which match the shadow are left out.
+ *@param framep the frame to write
+ *@param dirty bit mask of the staged channels
+ *@param blocks receives the blocks; a frame has at most 16
+ *@returns the number of blocks
+ */
+static int _frame_blocks (pwm_frame* framep, unsigned int dirty, frame_block* blocks)
+{
+	int count_blocks = 0;
+	int last = 15;
+	while (!(dirty & (1 << last)))
+		last--;
+
+	int channel = 0;
+	while (channel <= last) {
+		if (!(dirty & (1 << channel))) {
+			channel++;
+			continue;
+		}
+		int count = (((last - channel) + 1) > _burst_channels) ? _burst_channels : ((last - channel) + 1);
+
+		// registers at either end of the block which already hold their value are not written, eg the unchanged ON count of a channel
+		int lo = 4 * channel;
+		int hi = (4 * (channel + count)) - 1;
+		while ((lo < hi) && (framep->cached & (1 << (lo / 4))) && (framep->regs[lo] == framep->shadow[lo]))
+			lo++;
+		while ((hi > lo) && (framep->cached & (1 << (hi / 4))) && (framep->regs[hi] == framep->shadow[hi]))
+			hi--;
+
+		frame_block* bp = &(blocks[count_blocks++]);
+		bp->channel = channel;
+		bp->count = count;
+		bp->lo = lo;
+		bp->hi = hi;
+		channel += count;
+	}
+	return count_blocks;
+}
+
+
+/**
+ * \private method to update the shadow of a frame after a block write
+ *
+ *@param framep the frame which was written
+ *@param bp the block
+ *@param ok non-zero if the write was successful
+ */
+static void _frame_block_done (pwm_frame* framep, const frame_block* bp, int ok)
+{
+	unsigned int mask = ((1 << bp->count) - 1) << bp->channel;
+
+	if (ok) {
+		_shadow_begin (framep);
+		memcpy (&(framep->shadow[4*bp->channel]), &(framep->regs[4*bp->channel]), 4*bp->count);
+		framep->known |= mask;
+		_shadow_end (framep);
+		framep->cached |= mask;
+	}
+	else
+		framep->cached &= ~mask;	// the next value staged for these channels is written again
+}
+
+
+/**
+ * \private method to write the staged channels of a frame to the currently selected I2C address of a bus
+ *
+ *@param busp the bus
+ *@param framep the frame to write
+ *@param dirty bit mask of the staged channels
+ *@param board an int value (1..62) of the board used for error reporting or 0 for a broadcast
+ */
+static void _frame_write (i2c_bus* busp, pwm_frame* framep, unsigned int dirty, int board)
+{
+	frame_block blocks[16];
+	int count = _frame_blocks (framep, dirty, blocks);
+
+	for (int i=0; i<count; i++) {
+		frame_block* bp = &(blocks[i]);
+		int length = (bp->hi - bp->lo) + 1;
+		_WRITE_DEBUG("_frame_write board=%d channel=%d count=%d registers=%d", board, bp->channel, bp->count, length);
+
+		long long start = _stats_now ();
+		_stats_count (STAT_WRITES, 1);
+		_stats_count (STAT_WRITE_BYTES, length);
+
+		int ok = (0 <= _write_registers (busp, __CHANNEL_ON_L+bp->lo, length, &(framep->regs[bp->lo])));
+		if (!ok) {
+			ROS_ERROR ("Error setting PWM start and end on servos %d..%d on board %d", bp->channel+1, bp->channel+bp->count, board);
+			_stats_count (STAT_WRITE_ERRORS, 1);
+		}
+		_frame_block_done (framep, bp, ok);
+		_stats_time (HIST_WRITE, start);
+	}
+}
+
+
+/**
+ * \private method to send the messages of the combined transfer of a bus and update the shadows of their blocks
+ */
+static void _frame_transfer_send (i2c_bus* busp)
+{
+	frame_transfer* tp = &(busp->transfer);
+	int i;
+
+	if (!tp->count)
+		return;
+
+	long long start = _stats_now ();
+	_stats_count (STAT_TRANSFERS, 1);
+	_stats_count (STAT_WRITES, tp->count);
+
+	int ok = (0 <= _bus->write_multi (busp->handle, tp->msgs, tp->count));
+	if (!ok) {
+		// the transfer stops at the first message which fails; every block is written again with the next value staged for it
+		ROS_ERROR ("Error writing a combined transfer of %d block writes to addresses 0x%02X..0x%02X on /dev/i2c-%d", tp->count, tp->msgs[0].address, tp->msgs[tp->count-1].address, busp->device);
+		_stats_count (STAT_WRITE_ERRORS, tp->count);
+	}
+	for (i=0; i<tp->count; i++)
+		_frame_block_done (tp->frames[i], &(tp->blocks[i]), ok);
+	_stats_time (HIST_WRITE, start);
+	tp->count = 0;
+}
+
+
+/**
+ * \private method to add the staged channels of a frame to the combined transfer of a bus
+ *
+ *The transfer is sent whenever it is full.
+ *@param busp the bus
+ *@param framep the frame to write
+ *@param dirty bit mask of the staged channels
+ *@param board an int value (0..61) of the hardware board
+ */
+static void _frame_transfer_add (i2c_bus* busp, pwm_frame* framep, unsigned int dirty, int board)
+{
+	frame_transfer* tp = &(busp->transfer);
+	frame_block blocks[16];
+	int count = _frame_blocks (framep, dirty, blocks);
+
+	for (int i=0; i<count; i++) {
+		if (tp->count == I2C_WRITE_MSG_MAX)
+			_frame_transfer_send (busp);
+
+		frame_block* bp = &(blocks[i]);
+		int length = (bp->hi - bp->lo) + 1;
+		unsigned char* data = tp->data[tp->count];
+		data[0] = __CHANNEL_ON_L + bp->lo;	// the register is the first byte of each message
+		memcpy (&(data[1]), &(framep->regs[bp->lo]), length);
+		_stats_count (STAT_WRITE_BYTES, length);
+
+		i2c_write_msg* mp = &(tp->msgs[tp->count]);
+		mp->address = _board_address[board];
+		mp->length = length + 1;
+		mp->data = data;
+		tp->frames[tp->count] = framep;
+		tp->blocks[tp->count] = *bp;
+		tp->count++;
+	}
+}
+
+
+/**
+ * \private method to write a group pose - identical values for the same channels of every board of a bus - as one broadcast
+ *
+ *Only used with a SUBADR1 broadcast address, which only the boards activated by this node respond to.
+ *@param busp the bus
+ *@returns non-zero if the frame was written as a broadcast
+ */
+static int _frame_flush_broadcast (i2c_bus* busp)
+{
+	int i;
+
+	if (!(_mode1 & __SUB1) || busp->mux_address || (busp->frame_board_count < 2) || (busp->frame_board_count != _active_board_count(busp)))
+		return 0;
+
+	pwm_frame* firstp = &(_pwm_frames[busp->frame_boards[0]]);
+	unsigned int dirty = firstp->dirty;
+	if (!dirty)
+		return 0;
+
+	int first = __builtin_ctz (dirty);
+	int last = 31 - __builtin_clz (dirty);
+	int length = 4 * ((last - first) + 1);
+
+	for (i=1; i<busp->frame_board_count; i++) {
+		pwm_frame* framep = &(_pwm_frames[busp->frame_boards[i]]);
+		if ((_pwm_boards[busp->frame_boards[i]] < 0) || (framep->dirty != dirty) || (0 != memcmp (&(framep->regs[4*first]), &(firstp->regs[4*first]), length)))
+			return 0;
+	}
+	if (_pwm_boards[busp->frame_boards[0]] < 0)
+		return 0;
+
+	if (0 > _set_slave_address (busp, _broadcast_address))
+		return 0;
+
+	// the shadows of the boards may differ so the whole span is written rather than trimmed to the registers which changed
+	unsigned int span = ((1u << (last - first + 1)) - 1) << first;
+	firstp->cached &= ~span;
+	_frame_write (busp, firstp, dirty, 0);
+
+	for (i=0; i<busp->frame_board_count; i++) {
+		pwm_frame* framep = &(_pwm_frames[busp->frame_boards[i]]);
+		if (framep != firstp) {
+			unsigned int written = firstp->cached & span;	// the channels of the blocks which were written
+			_shadow_begin (framep);
+			for (int channel=first; channel<=last; channel++) {
+				if (written & (1 << channel))
+					memcpy (&(framep->shadow[4*channel]), &(framep->regs[4*channel]), 4);
+			}
+			framep->known |= written;
+			_shadow_end (framep);
+			framep->cached = (framep->cached & ~span) | written;
+		}
+		framep->dirty = 0;
+		framep->queued = 0;
+	}
+	firstp->dirty = 0;
+	busp->frame_board_count = 0;
+	return 1;
+}
+
+
+/**
+ * \private method to record the time from the oldest message of a frame until the frame has been written
+ *
+ *The trace hook is told the newest message of the frame; every earlier message of the bus has been written with it.
+ */
+static void _frame_stamp_done (i2c_bus* busp)
+{
+	if (busp->frame_stamp) {
+		_stats_time (HIST_LATENCY, busp->frame_stamp);
+		busp->frame_stamp = 0;
+	}
+	if (busp->frame_newest) {
+		_trace (I2CPWM_TRACE_WRITTEN, busp->frame_newest, (1u << busp->index));
+		busp->frame_newest = 0;
+	}
+}
+
+
+/**
+ * \private method to compute the position of a board in the write order of a frame
+ *
+ *Boards directly on the bus come first, followed by the boards of each multiplexer channel starting with the
+ *channel which is already selected, so every channel is selected at most once per frame.
+ *@param busp the bus
+ *@param board an int value (0..61) of the hardware board
+ *@returns the sort key
+ */
+static int _frame_order (const i2c_bus* busp, int board)
+{
+	int channel = _board_channel[board];
+
+	if (channel >= 0)
+		channel = ((channel - ((busp->mux_channel < 0) ? 0 : busp->mux_channel) + 8) % 8) + 1;
+	else
+		channel = 0;
+	return (channel * MAX_BOARDS) + board;
+}
+
+
+/**
+ * \private method to write all staged PWM channels of a bus to the hardware
+ *
+ *The boards of the frame are written in ascending order, grouped by multiplexer channel, so each board is made
+ *active and each channel is selected only once per frame.
+ *With the rdwr transport the block writes of the boards of each channel are sent as one combined I2C_RDWR transfer instead.
+ *Boards where every staged value matched the shadow are skipped entirely.
+ *@param busp the bus
+ */
+static void _frame_flush (i2c_bus* busp)
+{
+	int i, j;
+
+	if (busp->frame_board_count)
+		_stats_count (STAT_FRAMES, 1);
+
+	// insertion sort - a frame rarely touches more than a handful of boards
+	for (i=1; i<busp->frame_board_count; i++) {
+		int board = busp->frame_boards[i];
+		int order = _frame_order (busp, board);
+		for (j=i; (j>0) && (_frame_order (busp, busp->frame_boards[j-1]) > order); j--)
+			busp->frame_boards[j] = busp->frame_boards[j-1];
+		busp->frame_boards[j] = board;
+	}
+
+	if (_broadcast_address && _frame_flush_broadcast (busp)) {
+		_frame_stamp_done (busp);
+		return;
+	}
+
+	for (i=0; i<busp->frame_board_count; i++) {
+		int board = busp->frame_boards[i];
+		pwm_frame* framep = &(_pwm_frames[board]);
+
+		framep->queued = 0;
+		if (!framep->dirty)
+			continue;
+
+		// the staged channels stay dirty until the board is selected so its one time initialization keeps their values
+		unsigned int dirty = framep->dirty;
+		if (_transport == TRANSPORT_RDWR) {
+			int channel = _board_channel[board];
+			if ((channel >= 0) && (channel != busp->mux_channel)) {
+				// a channel selection takes effect at a STOP so the boards of the previous channel are sent first
+				_frame_transfer_send (busp);
+				if (0 > _set_mux_channel (busp, channel)) {
+					framep->dirty = 0;
+					framep->cached &= ~dirty;	// the next value staged for these channels is written again
+					continue;
+				}
+			}
+
+			// a combined transfer addresses each message; a board is only selected for its one time initialization
+			if (_pwm_boards[board] < 0)
+				_select_board (board+1);	// API is ONE based
+			framep->dirty = 0;
+			_frame_transfer_add (busp, framep, dirty, board);
+			continue;
+		}
+
+		i2c_bus* selectedp = _select_board (board+1);	// API is ONE based
+		framep->dirty = 0;
+		if (selectedp)
+			_frame_write (busp, framep, dirty, board+1);
+	}
+	_frame_transfer_send (busp);
+	busp->frame_board_count = 0;
+	_frame_stamp_done (busp);
+}
+
+
+
+/**
+ * \private method to set a value for a PWM channel
+ *
+ *The pulse defined by start/stop will be active on the specified servo channel until any subsequent call changes it.
+ *@param servo an int value (1..992) indicating which servo to change power
+ *@param start an int value (0..4096) indicating when the pulse will go high sending power to each channel.
+ *@param end an int value (0..4096) indicating when the pulse will go low stoping power to each channel.
+ *Example _set_pwm_interval (3, 0, 350)    // set servo #3 (fourth position on the hardware board) with a pulse of 350
+ */
+static void _set_pwm_interval (int servo, int start, int end)
+{
+	_WRITE_DEBUG("_set_pwm_interval enter");
+
+	i2c_bus* busp = _board_busp ((servo-1) / 16);
+	if (!busp)
+		return;
+	_frame_stage (servo, start, end);
+	_frame_flush (busp);
+}
+
+
+/**
+ * \private method to find the registry slot of a servo
+ *
+ *@param servo an int value (1..992) indicating which servo
+ *@returns the slot of the servo or -1 when it has not been configured
+ */
+static int _servo_slot (int servo)
+{
+	return (int)__atomic_load_n (&(_servos.slot[servo-1]), __ATOMIC_ACQUIRE) - 1;
+}
+
+
+/**
+ * \private method to allocate a configuration snapshot
+ *
+ *The arrays of the snapshot are part of the same allocation and are sized to the capacity.
+ *@param capacity the slots the snapshot has room for
+ *@returns the snapshot with no slots and an undefined drive mode or NULL if out of memory
+ */
+static config_snapshot* _config_alloc (int capacity)
+{
+	size_t per_slot = sizeof(long long) + (3 * sizeof(short)) + (2 * sizeof(signed char)) + (POSITION_INVALID * sizeof(int));
+	config_snapshot* configp = (config_snapshot*) calloc (1, sizeof(config_snapshot) + (capacity * per_slot));
+	int i;
+
+	if (!configp)
+		return NULL;
+
+	// the widest fields come first so every array is aligned
+	char* next = (char*)(configp + 1);
+	configp->scale = (long long*)next;				next += capacity * sizeof(long long);
+	for (i=0; i<POSITION_INVALID; i++) {
+		configp->drive_servos[i] = (int*)next;		next += capacity * sizeof(int);
+	}
+	configp->center = (short*)next;					next += capacity * sizeof(short);
+	configp->range = (short*)next;					next += capacity * sizeof(short);
+	configp->offset = (short*)next;					next += capacity * sizeof(short);
+	configp->direction = (signed char*)next;		next += capacity;
+	configp->mode_pos = (signed char*)next;
+	configp->capacity = capacity;
+
+	configp->drive.mode = MODE_UNDEFINED;
+	configp->drive.rpm = -1.0;
+	configp->drive.radius = -1.0;
+	configp->drive.track = -1.0;
+	configp->drive.scale = -1.0;
+	configp->drive.max_rate = -1.0;
+	configp->drive.inv_max_rate = 0.0;
+	configp->drive.acceleration = 0.0;
+	return configp;
+}
+
+
+/**
+ * \private method to begin reading the configuration snapshot
+ *
+ *The snapshot stays valid until _config_exit(); readers never wait for a writer or for each other.
+ *@param epoch returns the epoch to pass to _config_exit()
+ *@returns the snapshot
+ */
+static const config_snapshot* _config_enter (int* epoch)
+{
+	*epoch = __atomic_load_n (&_config_epoch, __ATOMIC_SEQ_CST);
+	__atomic_fetch_add (&(_config_readers[*epoch]), 1, __ATOMIC_SEQ_CST);
+	return __atomic_load_n (&_config, __ATOMIC_SEQ_CST);
+}
+
+
+/**
+ * \private method to end reading the configuration snapshot
+ *
+ *@param epoch the epoch returned by _config_enter()
+ */
+static void _config_exit (int epoch)
+{
+	__atomic_fetch_sub (&(_config_readers[epoch]), 1, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * \private method to copy the configuration snapshot for a change
+ *
+ *The copy is private to the caller until it is passed to _config_publish().
+ *Only the ROS spin thread may call this method.
+ *@param extra the slots the change may add
+ *@returns the copy or NULL if out of memory
+ */
+static config_snapshot* _config_edit (int extra)
+{
+	const config_snapshot* oldp = _config;
+	int count = oldp ? oldp->count : 0;
+	int capacity = count + ((extra > 0) ? extra : 0);
+	int i;
+
+	// the capacity grows in steps so adding servos one at a time does not copy on every call
+	if (oldp && (capacity <= oldp->capacity))
+		capacity = oldp->capacity;
+	else
+		capacity = (capacity + 15) & ~15;
+	if (capacity > MAX_SERVOS)
+		capacity = MAX_SERVOS;
+
+	config_snapshot* configp = _config_alloc (capacity);
+	if (!configp) {
+		ROS_ERROR("Unable to allocate the configuration of %d servos", capacity);
+		return NULL;
+	}
+	if (oldp) {
+		configp->drive = oldp->drive;
+		configp->count = count;
+		for (i=0; i<POSITION_INVALID; i++) {
+			configp->drive_count[i] = oldp->drive_count[i];
+			memcpy (configp->drive_servos[i], oldp->drive_servos[i], oldp->drive_count[i] * sizeof(int));
+		}
+		memcpy (configp->scale, oldp->scale, count * sizeof(long long));
+		memcpy (configp->center, oldp->center, count * sizeof(short));
+		memcpy (configp->range, oldp->range, count * sizeof(short));
+		memcpy (configp->offset, oldp->offset, count * sizeof(short));
+		memcpy (configp->direction, oldp->direction, count);
+		memcpy (configp->mode_pos, oldp->mode_pos, count);
+	}
+	return configp;
+}
+
+
+/**
+ * \private method to replace the configuration snapshot with a changed copy
+ *
+ *The previous snapshot is freed once every reader which may hold it has finished: the epoch is flipped twice and each
+ *time the readers of the previous epoch are waited for. Readers only hold a snapshot for one callback or one tick.
+ *Only the ROS spin thread may call this method.
+ *@param configp the copy returned by _config_edit()
+ */
+static void _config_publish (config_snapshot* configp)
+{
+	config_snapshot* oldp = __atomic_exchange_n (&_config, configp, __ATOMIC_SEQ_CST);
+	int phase;
+
+	for (phase=0; phase<2; phase++) {
+		int epoch = __atomic_load_n (&_config_epoch, __ATOMIC_SEQ_CST);
+		__atomic_store_n (&_config_epoch, epoch ^ 1, __ATOMIC_SEQ_CST);
+		while (__atomic_load_n (&(_config_readers[epoch]), __ATOMIC_ACQUIRE))
+			sched_yield ();
+	}
+	free (oldp);
+}
+
+
+/**
+ * \private method to find or add the registry slot of a servo
+ *
+ *A new slot has no center or range and uses the phase stagger default. Readers of older snapshots, which do not have
+ *the slot yet, treat the servo as not configured.
+ *Only the ROS spin thread may call this method.
+ *@param configp the copy returned by _config_edit()
+ *@param servo an int value (1..992) indicating which servo
+ *@returns the slot of the servo or -1 when the copy has no room for another slot
+ */
+static int _servo_slot_add (config_snapshot* configp, int servo)
+{
+	int slot = _servo_slot (servo);
+
+	if (slot < 0) {
+		slot = _servos.count;
+		if (slot >= configp->capacity)
+			return -1;
+		_servos.servo[slot] = servo;
+		__atomic_store_n (&(_servos.slot[servo-1]), slot + 1, __ATOMIC_RELEASE);
+		_servos.count++;
+	}
+	else if (slot >= configp->capacity)
+		return -1;
+
+	// a slot added to the registry for a copy which was never published is filled by the next copy
+	while (configp->count <= slot) {
+		int i = configp->count++;
+		configp->center[i] = -1;
+		configp->range[i] = -1;
+		configp->offset[i] = -1;
+		configp->direction[i] = 1;
+		configp->mode_pos[i] = -1;
+		configp->scale[i] = 0;
+	}
+	return slot;
+}
+
+
+/**
+ * \private method to compute the start and end of a pulse of a servo
+ *
+ *By default every pulse starts at 0. With phase stagger, or a configured offset, the pulse starts at the offset and ends
+ *at the offset plus the width modulo 4096 so the channels of a board do not all go high at the same time.
+ *A width of 0 (power off) or 4096 is not moved.
+ *@param configp the configuration snapshot
+ *@param servo an int value (1..992) indicating which servo
+ *@param width an int value (0..4096) of the pulse width
+ *@param start returns the start (ON) count of the pulse
+ *@param end returns the end (OFF) count of the pulse
+ */
+static void _pwm_pulse (const config_snapshot* configp, int servo, int width, int* start, int* end)
+{
+	int slot = _servo_slot (servo);
+	int offset = ((slot < 0) || (slot >= configp->count)) ? -1 : configp->offset[slot];
+
+	if (offset < 0)
+		offset = (_phase_stagger ? (((servo-1) % 16) * (4096 / 16)) : 0);
+
+	if ((offset == 0) || (width <= 0) || (width >= 4096)) {
+		*start = 0;
+		*end = width;
+		return;
+	}
+	*start = offset;
+	*end = (offset + width) & 0xFFF;
+}
+
+
+
+/**
+ * \private method to compute the output scheduler period
+ *
+ *@returns the period in nanoseconds; by default one PWM period, eg 20ms at 50Hz
+ */
+static long _io_period (void)
+{
+	int rate = (_io_config.rate > 0) ? _io_config.rate : _pwm_frequency;
+
+	if (rate < 1)
+		rate = 50;
+	return 1000000000L / rate;
+}
+
+
+/**
+ * \private method to compute how far along its path a motion is
+ *
+ *@param mp the motion
+ *@param u the elapsed fraction (0..1) of the duration of the motion
+ *@returns the fraction (0..1) of the distance from the start to the end of the motion
+ */
+static float _motion_progress (const servo_motion* mp, float u)
+{
+	if (mp->profile == PROFILE_SCURVE)
+		return (1.0 - cos (_PI * u)) / 2;		// the cosine curve of _smoothing()
+
+	float r = mp->ramp;
+	if ((mp->profile == PROFILE_LINEAR) || (r <= 0.0))
+		return u;
+
+	// the velocity rises for the fraction r of the duration, cruises at vmax and falls again for the last fraction r
+	float vmax = 1.0 / (1.0 - r);
+	if (u < r)
+		return (vmax * u * u) / (2 * r);
+	if (u <= (1.0 - r))
+		return vmax * (u - (r / 2));
+	return 1.0 - ((vmax * (1.0 - u) * (1.0 - u)) / (2 * r));
+}
+
+
+/**
+ * \private method to end the motion profile of a servo which is being given a new value
+ *
+ *Only the I/O thread of the bus of the servo may call this method.
+ */
+static void _motion_cancel (i2c_bus* busp, int servo)
+{
+	int i;
+
+	if ((servo < 1) || (servo > MAX_SERVOS) || !_motions[servo-1].active)
+		return;
+
+	_motions[servo-1].active = 0;
+	for (i=0; i<busp->motion_count; i++) {
+		if (busp->motion_servos[i] == servo) {
+			busp->motion_servos[i] = busp->motion_servos[--busp->motion_count];
+			break;
+		}
+	}
+}
+
+
+/**
+ * \private method to start a motion profile of a servo
+ *
+ *The motion starts from the pulse width staged for the servo, which is its position part way through a motion which is
+ *replaced by this one. The duration is fixed by the request or is the shortest move within its velocity and acceleration limits.
+ *A request with neither a duration nor a velocity goes straight to the end.
+ *Only the I/O thread of the bus of the servo may call this method.
+ *@param busp the bus of the servo
+ *@param servo an int value (1..992)
+ *@param width an int value (0..4096) of the pulse width at the end of the motion
+ *@param rp the duration, limits and profile of the motion
+ */
+static void _motion_start (i2c_bus* busp, int servo, int width, const motion_request* rp)
+{
+	servo_motion* mp = &(_motions[servo-1]);
+	const unsigned char* regs = &(_pwm_frames[(servo-1) / 16].regs[4 * ((servo-1) % 16)]);
+	int on = regs[0] | ((regs[1] & 0x0F) << 8);
+	int off = regs[2] | ((regs[3] & 0x0F) << 8);
+	int from = (off - on) & 0xFFF;
+	int start, end;
+
+	// a powered off drive servo is standing still, which is the center of its range
+	if ((from == 0) && rp->rest)
+		from = rp->rest;
+
+	float distance = fabs ((float)(width - from));
+	float duration = rp->duration;
+	float ramp = 0.0;
+
+	if (duration > 0.0) {
+		if (rp->profile == PROFILE_TRAPEZOIDAL) {
+			// the ramp which reaches the distance in the duration with the acceleration; a quarter of the duration without a limit
+			if (rp->acceleration > 0.0) {
+				float t2 = (duration * duration) - ((4 * distance) / rp->acceleration);
+				ramp = (t2 > 0.0) ? ((duration - sqrt (t2)) / (2 * duration)) : 0.5;
+			}
+			else
+				ramp = 0.25;
+		}
+	}
+	else if (!(rp->velocity > 0.0))
+		duration = 0.0;		// without a duration or a velocity there is no move to time, eg a drive servo with a range of 0
+	else if (rp->profile == PROFILE_SCURVE) {
+		// the peak velocity of the cosine curve is pi/2 times the average and the peak acceleration pi^2/2 times distance/duration^2
+		duration = (_PI * distance) / (2 * rp->velocity);
+		if ((rp->acceleration > 0.0) && ((_PI * sqrt (distance / (2 * rp->acceleration))) > duration))
+			duration = _PI * sqrt (distance / (2 * rp->acceleration));
+	}
+	else if ((rp->profile == PROFILE_TRAPEZOIDAL) && (rp->acceleration > 0.0)) {
+		float ta = rp->velocity / rp->acceleration;
+		if (distance < (rp->velocity * ta)) {
+			ta = sqrt (distance / rp->acceleration);	// the move is too short to reach the velocity
+			duration = 2 * ta;
+		}
+		else
+			duration = (distance / rp->velocity) + ta;
+		ramp = ta / duration;
+	}
+	else
+		duration = distance / rp->velocity;
+
+	// an unset or powered off servo has no position to move from so it goes straight to the end
+	if ((from == 0) || (distance < 1.0) || !(duration > 0.0)) {
+		int epoch;
+		const config_snapshot* configp = _config_enter (&epoch);
+		_motion_cancel (busp, servo);
+		_pwm_pulse (configp, servo, width, &start, &end);
+		_config_exit (epoch);
+		_frame_stage (servo, start, end);
+		return;
+	}
+
+	if (!mp->active)
+		busp->motion_servos[busp->motion_count++] = servo;
+	mp->t0 = busp->tick - _io_period ();	// the staged pulse is where the servo was on the previous tick
+	mp->from = from;
+	mp->to = width;
+	mp->duration = duration;
+	mp->ramp = ramp;
+	mp->profile = rp->profile;
+	mp->active = 1;
+}
+
+
+/**
+ * \private method to stage the pulse of each servo of a bus with a motion profile in progress
+ *
+ *The pulse of each servo is interpolated for the current tick of the output scheduler; a pulse which has not
+ *changed since the previous tick matches the shadow and is not written again.
+ *Only the I/O thread of the bus may call this method.
+ *@param busp the bus
+ */
+static void _motion_tick (i2c_bus* busp)
+{
+	int i, count = 0;
+	int start, end, epoch;
+	const config_snapshot* configp = _config_enter (&epoch);
+
+	for (i=0; i<busp->motion_count; i++) {
+		int servo = busp->motion_servos[i];
+		servo_motion* mp = &(_motions[servo-1]);
+
+		float u = (float)((busp->tick - mp->t0) / 1e9) / mp->duration;
+		if (u >= 1.0) {
+			u = 1.0;
+			mp->active = 0;
+		}
+		else
+			busp->motion_servos[count++] = servo;	// still in progress
+
+		int width = (int)lrintf (mp->from + ((mp->to - mp->from) * _motion_progress (mp, u)));
+		_pwm_pulse (configp, servo, width, &start, &end);
+		_frame_stage (servo, start, end);
+	}
+	_config_exit (epoch);
+	busp->motion_count = count;
+}
+
+
+/**
+ * \private method to post the newest value of a servo to the mailbox
+ *
+ *Any value of the servo which has not yet been collected by the I/O thread is replaced.
+ *@param servo an int value (1..992) indicating which servo to change power
+ *@param start an int value (0..4096) indicating when the pulse will go high sending power to the channel.
+ *@param end an int value (0..4096) indicating when the pulse will go low stoping power to the channel.
+ */
+static void _mailbox_post (int servo, int start, int end)
+{
+	int board = (servo-1) / 16;
+
+	__atomic_store_n (&(_servo_mailbox[servo-1]), (MAILBOX_PENDING | (start << 16) | end), __ATOMIC_RELEASE);
+	__atomic_fetch_or (&(_mailbox_boards[board / 32]), (1u << (board % 32)), __ATOMIC_RELEASE);
+}
+
+
+/**
+ * \private method to stage the newest value of every servo of a bus posted to the mailbox
+ *
+ *Only the I/O thread of the bus may call this method. Slots are emptied as they are collected.
+ *@param busp the bus
+ */
+static void _mailbox_collect (i2c_bus* busp)
+{
+	int word, channel;
+
+	for (word=0; word<MAILBOX_WORDS; word++) {
+		// only the boards of this bus are taken; the other bits belong to the I/O threads of the other buses
+		unsigned int boards = __atomic_fetch_and (&(_mailbox_boards[word]), ~(busp->board_mask[word]), __ATOMIC_ACQ_REL) & busp->board_mask[word];
+
+		while (boards) {
+			int board = (word * 32) + __builtin_ctz (boards);
+			boards &= (boards - 1);
+
+			for (channel=0; channel<16; channel++) {
+				int servo = (board * 16) + channel + 1;
+				unsigned int value = __atomic_exchange_n (&(_servo_mailbox[servo-1]), 0, __ATOMIC_ACQ_REL);
+				if (value & MAILBOX_PENDING) {
+					_motion_cancel (busp, servo);
+					_frame_stage (servo, (value >> 16) & 0x1FFF, value & 0x1FFF);
+				}
+			}
+		}
+	}
+}
+
+
+/**
+ * \private method to stage every servo of a bus in a committed pose
+ *
+ *The whole pose is staged by one command so it is written by a single flush, or a single tick of the output scheduler,
+ *and only the channels which differ from the shadow are written. The buffer is released once every bus has staged it.
+ *Only the I/O thread of the bus may call this method.
+ *@param busp the bus
+ *@param pp the committed pose buffer
+ */
+static void _pose_apply (i2c_bus* busp, pose_buffer* pp)
+{
+	int word, channel;
+
+	for (word=0; word<MAILBOX_WORDS; word++) {
+		unsigned int boards = pp->boards[word] & busp->board_mask[word];
+
+		while (boards) {
+			int board = (word * 32) + __builtin_ctz (boards);
+			boards &= (boards - 1);
+
+			for (channel=0; channel<16; channel++) {
+				int servo = (board * 16) + channel + 1;
+				unsigned int value = pp->values[servo-1];
+				if (value & MAILBOX_PENDING) {
+					_motion_cancel (busp, servo);
+					_frame_stage (servo, (value >> 16) & 0x1FFF, value & 0x1FFF);
+				}
+			}
+		}
+	}
+	__atomic_fetch_and (&(pp->buses), ~(1u << busp->index), __ATOMIC_RELEASE);
+}
+
+
+/**
+ * \private method to stage the boards of a bus from a pose of the pose library
+ *
+ *The register images of the pose are copied into the frames as they are; no servo values are converted.
+ *Only the I/O thread of the bus may call this method.
+ *@param busp the bus
+ *@param pp the stored pose
+ */
+static void _stored_pose_apply (i2c_bus* busp, stored_pose* pp)
+{
+	int word;
+
+	for (word=0; word<MAILBOX_WORDS; word++) {
+		unsigned int boards = pp->boards[word] & busp->board_mask[word];
+
+		while (boards) {
+			int board = (word * 32) + __builtin_ctz (boards);
+			boards &= (boards - 1);
+
+			if (busp->motion_count) {
+				for (unsigned int channels = pp->channels[board]; channels; channels &= (channels - 1))
+					_motion_cancel (busp, (board * 16) + __builtin_ctz (channels) + 1);
+			}
+			_frame_stage_image (board, pp->regs[board], pp->channels[board]);
+		}
+	}
+	__atomic_fetch_and (&(pp->buses), ~(1u << busp->index), __ATOMIC_RELEASE);
+}
+
+
+
+/**
+ * \private method to stop all servos on all active boards of a bus
+ *
+ *The servos are set to a power off state - eg 'coast' rather than 'brake'.
+ *@param busp the bus
+ */
+static void _stop_all (i2c_bus* busp)
+{
+	int i, j;
+
+	// the stop overrides any value which has not been written yet
+	for (i=0; i<MAILBOX_WORDS; i++)
+		__atomic_fetch_and (&(_mailbox_boards[i]), ~(busp->board_mask[i]), __ATOMIC_ACQ_REL);
+	for (i=0; i<MAILBOX_WORDS; i++) {
+		for (unsigned int boards = busp->board_mask[i]; boards; boards &= (boards - 1)) {
+			int board = (i * 32) + __builtin_ctz (boards);
+			for (j=0; j<16; j++)
+				__atomic_store_n (&(_servo_mailbox[(board*16)+j]), 0, __ATOMIC_RELEASE);
+		}
+	}
+	for (i=0; i<busp->frame_board_count; i++) {
+		_pwm_frames[busp->frame_boards[i]].dirty = 0;
+		_pwm_frames[busp->frame_boards[i]].queued = 0;
+	}
+	busp->frame_board_count = 0;
+	while (busp->motion_count)
+		_motion_cancel (busp, busp->motion_servos[0]);
+
+	_frame_invalidate (busp, 0);	// each board is marked as known again once its stop has been written
+
+	if (_use_broadcast (busp)) {
+		_set_pwm_interval_broadcast (busp, 0, 0);	// a single transaction regardless of the number of boards
+		return;
+	}
+
+	int boards[MAX_BOARDS];
+	int count = _active_bus_boards (busp, boards);
+	for (i=0; i<count; i++)
+		_set_pwm_interval_all (boards[i]+1, 0, 0);	// API is ONE based
+}
+
+
+
+/**
+ * \private method to write the last known channel values of a board after it has been reset
+ *
+ *The MODE registers and prescale are programmed again and every channel is written from its shadow.
+ *@param busp the bus with its address set to the board
+ *@param board an int value (0..61) of the hardware board
+ *@returns 0 on success or -1 if a write failed
+ */
+static int _board_restore (i2c_bus* busp, int board)
+{
+    pwm_frame* framep = &(_pwm_frames[board]);
+    int channel;
+
+    if (0 > _board_init (busp))
+        return -1;
+    _write_prescale (busp, board, -1, _pwm_prescale (_pwm_frequency));
+
+    // the reset turned every channel off so none of them match the shadow
+    framep->cached = 0;
+    for (channel=0; channel<16; channel++) {
+        const unsigned char* sp = &(framep->shadow[4*channel]);
+        _frame_stage ((board * 16) + channel + 1, sp[0] | (sp[1] << 8), sp[2] | (sp[3] << 8));
+    }
+    _frame_flush (busp);
+    return (framep->cached == 0xFFFF) ? 0 : -1;
+}
+
+
+/**
+ * \private method to record a failed check of a board and back off before checking it again
+ */
+static void _verify_failed (i2c_bus* busp, int board)
+{
+    board_health* hp = &(_board_health[board]);
+
+    _stats_count (STAT_VERIFY_ERRORS, 1);
+    hp->failures++;
+    hp->skip = (hp->failures < 7) ? ((1 << hp->failures) - 1) : VERIFY_BACKOFF_MAX;	// 1, 3, 7 .. checks
+    if (hp->failures == VERIFY_RETRIES)
+        ROS_ERROR("Board %d at 0x%02X on /dev/i2c-%d is not responding :: it will be checked again every %d checks", board+1, _board_address[board], busp->device, VERIFY_BACKOFF_MAX);
+}
+
+
+/**
+ * \private method to check the next board of a bus for a reset and for channels which do not match the shadow
+ *
+ *A PCA9685 which browns out returns to its power on state: MODE1 has SLEEP set and auto increment cleared, and every
+ *channel is off. The board is then initialized again and its shadow written back. One channel, only when its shadow
+ *is known, is also read back on each check; a mismatch is written again.
+ *Only the I/O thread of the bus may call this method; each check is at most six transactions.
+ *@param busp the bus
+ */
+static void _verify_board (i2c_bus* busp)
+{
+    int boards[MAX_BOARDS];
+    int count = _active_bus_boards (busp, boards);
+    int i;
+
+    if (!count)
+        return;
+
+    int board = boards[busp->verify_board++ % count];
+    board_health* hp = &(_board_health[board]);
+    pwm_frame* framep = &(_pwm_frames[board]);
+
+    if (hp->skip > 0) {
+        hp->skip--;
+        return;
+    }
+
+    _stats_count (STAT_VERIFY_READS, 1);
+    if (0 > _set_board_address (busp, board)) {
+        _verify_failed (busp, board);
+        return;
+    }
+    int mode1 = _bus->read_byte (busp->handle, __MODE1);
+    if (mode1 < 0) {
+        _verify_failed (busp, board);
+        return;
+    }
+
+    if ((mode1 & __SLEEP) || ((mode1 & __AUTO_INCREMENT) != (_mode1 & __AUTO_INCREMENT))) {
+        ROS_WARN("Board %d at 0x%02X on /dev/i2c-%d has been reset (MODE1 0x%02X) :: restoring its channels", board+1, _board_address[board], busp->device, mode1);
+        _stats_count (STAT_BOARD_RESETS, 1);
+        if (0 > _board_restore (busp, board))
+            _verify_failed (busp, board);
+        else
+            hp->failures = 0;
+        return;
+    }
+
+    int channel = hp->channel;
+    unsigned int bit = (1 << channel);
+    hp->channel = (channel + 1) % 16;
+
+    if (framep->cached & bit) {
+        unsigned char value[4];
+        for (i=0; i<4; i++) {
+            int v = _bus->read_byte (busp->handle, __CHANNEL_ON_L + (4*channel) + i);
+            if (v < 0) {
+                _verify_failed (busp, board);
+                return;
+            }
+            value[i] = v;
+        }
+        if (0 != memcmp (value, &(framep->shadow[4*channel]), 4)) {
+            const unsigned char* sp = &(framep->shadow[4*channel]);
+            ROS_WARN("Servo %d does not have its last written value :: writing it again", (board * 16) + channel + 1);
+            _stats_count (STAT_VERIFY_MISMATCHES, 1);
+            framep->cached &= ~bit;
+            _frame_stage ((board * 16) + channel + 1, sp[0] | (sp[1] << 8), sp[2] | (sp[3] << 8));
+            _frame_flush (busp);
+        }
+    }
+    hp->failures = 0;
+}
+
+
+/**
+ * \private method to run the verifier when a bus has nothing else to write
+ *
+ *Commands waiting in the ring, or staged values not yet written, always go first; a check is skipped rather than delayed.
+ *Only the I/O thread of the bus may call this method.
+ *@param busp the bus
+ */
+static void _verify_idle (i2c_bus* busp)
+{
+    io_worker* wp = &(busp->worker);
+    long long now = _stats_now ();
+
+    if (now < busp->verify_next)
+        return;
+    if ((__atomic_load_n (&(wp->head), __ATOMIC_ACQUIRE) != wp->tail) || busp->frame_board_count || busp->motion_count)
+        return;
+    busp->verify_next = now + (1000000000LL / _verify_rate);
+    _verify_board (busp);
+}
+
+
+
+/**
+ * \private method to apply the fail-safe of each topic whose publisher has stopped within its deadline
+ *
+ *A topic is watched from its first message. Each bus applies the fail-safe once for the newest message of a topic
+ *which missed its deadline and again only when a later message misses it. With broadcast writes the coast fail-safe
+ *is one transaction for all boards of the bus, so the reaction time is at most one tick and one transaction.
+ *Only the I/O thread of the bus may call this method.
+ *@param busp the bus
+ */
+static void _deadline_check (i2c_bus* busp)
+{
+	long long now = _stats_now ();
+	int topic;
+
+	for (topic=0; topic<DEADLINE_TOPICS; topic++) {
+		const topic_deadline* dp = &(_deadlines[topic]);
+		long long stamp = __atomic_load_n (&(dp->stamp), __ATOMIC_ACQUIRE);
+
+		if (!dp->timeout || !stamp || (stamp == busp->deadline_missed[topic]) || ((now - stamp) < dp->timeout))
+			continue;
+		busp->deadline_missed[topic] = stamp;
+
+		if (!busp->index) {
+			_stats_count (STAT_DEADLINES, 1);
+			ROS_WARN("Deadline of %lld msec of the %s topic missed :: applying the %s fail-safe", dp->timeout / 1000000, dp->topic, _failsafe_names[dp->failsafe]);
+		}
+
+		switch (dp->failsafe) {
+		case FAILSAFE_COAST:
+			_stop_all (busp);
+			break;
+		case FAILSAFE_HOLD:
+			while (busp->motion_count)
+				_motion_cancel (busp, busp->motion_servos[0]);
+			break;
+		case FAILSAFE_POSE:
+			_stored_pose_apply (busp, &(_stored_poses[dp->pose-1]));
+			break;
+		}
+	}
+}
+
+
+/**
+ * \private method to record the receive time of a message of a topic which may have a deadline
+ *
+ *Only the ROS spin thread may call this method.
+ *@param topic one of the deadline_topics
+ */
+static void _deadline_touch (int topic)
+{
+	if (_deadlines[topic].timeout)
+		__atomic_store_n (&(_deadlines[topic].stamp), _message_stamp, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * \private method to perform a queued I/O command on a bus
+ *
+ *This is the only place the I2C bus is used once the I/O thread of the bus is running.
+ *@param busp the bus
+ *@param cmd the command to perform
+ */
+static void _io_execute (i2c_bus* busp, const io_command* cmd)
+{
+	switch (cmd->command) {
+	case IO_CHANNEL:
+		_motion_cancel (busp, cmd->servo);
+		_frame_stage (cmd->servo, cmd->start, cmd->end);
+		break;
+	case IO_MOTION:
+		_motion_start (busp, cmd->servo, cmd->start, &(cmd->motion));
+		break;
+	case IO_POSE:
+		_pose_apply (busp, &(_poses[cmd->servo]));
+		break;
+	case IO_RECALL:
+		_stored_pose_apply (busp, &(_stored_poses[cmd->servo]));
+		break;
+	case IO_FLUSH:
+		if (!busp->frame_stamp)
+			busp->frame_stamp = cmd->stamp;
+		if (_trace_hook)
+			busp->frame_newest = cmd->stamp;
+		if (!_io_config.scheduled || !busp->worker.running)	// without its I/O thread a bus has no ticks to flush on
+			_frame_flush (busp);
+		break;
+	case IO_STOP:
+		_stop_all (busp);
+		break;
+	case IO_FREQUENCY:
+		_set_pwm_frequency (busp, cmd->start);
+		break;
+	default:
+		break;
+	}
+}
+
+
+/**
+ * \private method to pass a command to one bus
+ *
+ *When the I/O thread of the bus is running, the command is added to its command ring; otherwise it is performed immediately.
+ *@param motion the motion of IO_MOTION or NULL
+ */
+static void _io_queue_bus (i2c_bus* busp, int command, int servo, int start, int end, const motion_request* motion)
+{
+	io_worker* wp = &(busp->worker);
+	io_command* cmd;
+	io_command immediate;
+
+	if (!wp->running) {
+		immediate.command = command;
+		immediate.servo = servo;
+		immediate.start = start;
+		immediate.end = end;
+		immediate.stamp = _message_stamp;
+		if (motion)
+			immediate.motion = *motion;
+		_io_execute (busp, &immediate);
+		return;
+	}
+
+	if (_io_config.conflate) {
+		// only the I/O thread empties the ring, so a value posted while it is empty is older than every later command;
+		// a value posted while a command is waiting follows the command through the ring
+		if ((command == IO_CHANNEL) && (__atomic_load_n (&(wp->tail), __ATOMIC_ACQUIRE) == wp->head)) {
+			_mailbox_post (servo, start, end);
+			return;
+		}
+		if (command == IO_FLUSH) {
+			long long none = 0;
+			__atomic_compare_exchange_n (&(busp->mailbox_stamp), &none, _message_stamp, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+			if (_trace_hook)
+				__atomic_store_n (&(busp->mailbox_newest), _message_stamp, __ATOMIC_RELEASE);	// after the values, so a collected stamp never precedes them
+			sem_post (&(wp->wakeup));	// the I/O thread collects the mailbox each time it wakes
+			return;
+		}
+	}
+
+	unsigned int head = wp->head;
+
+	// the ring is only full when the bus is far behind; wait for the I/O thread rather than lose a command
+	while ((head - __atomic_load_n (&(wp->tail), __ATOMIC_ACQUIRE)) >= IO_RING_SIZE) {
+		sem_post (&(wp->wakeup));	// a large message may fill the ring before its flush is queued
+		nanosleep ((const struct timespec[]){{0, 100000L}}, NULL);
+	}
+
+	cmd = &(wp->ring[head & (IO_RING_SIZE-1)]);
+	cmd->command = command;
+	cmd->servo = servo;
+	cmd->start = start;
+	cmd->end = end;
+	cmd->stamp = _message_stamp;
+	if (motion)
+		cmd->motion = *motion;
+	__atomic_store_n (&(wp->head), head+1, __ATOMIC_RELEASE);
+
+	if ((command != IO_CHANNEL) && !((command == IO_FLUSH) && _io_config.scheduled))	// channels are always followed by a flush; the output scheduler does not need to be woken
+		sem_post (&(wp->wakeup));
+}
+
+
+/**
+ * \private method to pass a command to the I2C buses
+ *
+ *A channel goes to the bus of its board and a flush to every bus with channels since the last flush, so a message
+ *which spans buses is written by the I/O threads of those buses at the same time. Other commands go to every bus.
+ *Only the ROS spin thread may call this method.
+ *When commands are conflated, channel values go to the mailbox and a flush only wakes the I/O threads;
+ *a channel value goes to the command ring while another command is waiting there, so the posting order is kept.
+ *@param command one of the io_commands
+ *@param servo an int value (1..992) for IO_CHANNEL
+ *@param start an int value for IO_CHANNEL (0..4096) and IO_FREQUENCY (the frequency)
+ *@param end an int value (0..4096) for IO_CHANNEL
+ */
+static void _io_queue (int command, int servo, int start, int end)
+{
+	int i;
+
+	if (command == IO_CHANNEL) {
+		i2c_bus* busp = ((servo >= 1) && (servo <= MAX_SERVOS)) ? _board_busp ((servo-1) / 16) : NULL;
+		if (!busp) {
+			ROS_ERROR("Invalid servo number %d :: the board of the servo is not assigned to an I2C bus", servo);
+			return;
+		}
+		_flush_buses |= (1u << busp->index);
+		_io_queue_bus (busp, command, servo, start, end, NULL);
+		return;
+	}
+
+	for (i=0; i<_bus_count; i++) {
+		if ((command == IO_FLUSH) && !(_flush_buses & (1u << i)))
+			continue;
+		_io_queue_bus (&(_buses[i]), command, servo, start, end, NULL);
+	}
+	if (command == IO_FLUSH) {
+		_trace (I2CPWM_TRACE_QUEUED, _message_stamp, _flush_buses);
+		_flush_buses = 0;
+	}
+}
+
+
+/**
+ * \private method to pass a motion of a servo to the I/O thread of its bus
+ *
+ *Motions always go to the command ring, also when commands are conflated; the motion replaces any motion or value of the
+ *servo sent before it and is replaced by any sent after it.
+ *Only the ROS spin thread may call this method.
+ *@param servo an int value (1..992)
+ *@param width an int value (0..4096) of the pulse width at the end of the motion
+ *@param motion the duration, limits and profile of the motion
+ */
+static void _io_queue_motion (int servo, int width, const motion_request* motion)
+{
+	i2c_bus* busp = ((servo >= 1) && (servo <= MAX_SERVOS)) ? _board_busp ((servo-1) / 16) : NULL;
+
+	if (!busp) {
+		ROS_ERROR("Invalid servo number %d :: the board of the servo is not assigned to an I2C bus", servo);
+		return;
+	}
+	_flush_buses |= (1u << busp->index);
+	_io_queue_bus (busp, IO_MOTION, servo, width, 0, motion);
+}
+
+
+/**
+ * \private method to add the value of a servo to the back buffer of the staged pose
+ *
+ *The first servo of a new pose waits until the I/O threads have staged the pose committed before the previous one.
+ *Only the ROS spin thread may call this method.
+ *@param servo an int value (1..992)
+ *@param start an int value (0..4096)
+ *@param end an int value (0..4096)
+ */
+static void _pose_stage (int servo, int start, int end)
+{
+	pose_buffer* pp = &(_poses[_pose_back]);
+	int board = (servo-1) / 16;
+
+	if (!_board_busp (board)) {
+		ROS_ERROR("Invalid servo number %d :: the board of the servo is not assigned to an I2C bus", servo);
+		return;
+	}
+
+	if (!_pose_servos) {
+		while (__atomic_load_n (&(pp->buses), __ATOMIC_ACQUIRE))
+			nanosleep ((const struct timespec[]){{0, 100000L}}, NULL);
+		memset (pp->values, 0, sizeof(pp->values));
+		memset (pp->boards, 0, sizeof(pp->boards));
+	}
+	if (!(pp->values[servo-1] & MAILBOX_PENDING))
+		_pose_servos++;
+	pp->values[servo-1] = (MAILBOX_PENDING | (start << 16) | end);
+	pp->boards[board / 32] |= (1u << (board % 32));
+}
+
+
+/**
+ * \private method to pass the staged pose to the I/O threads of its buses and start a new pose in the other buffer
+ *
+ *With conflated commands, values sent before the commit are staged before the pose and values sent after it over the pose.
+ *Only the ROS spin thread may call this method.
+ *@returns the number of servos in the committed pose
+ */
+static int _pose_commit (void)
+{
+	pose_buffer* pp = &(_poses[_pose_back]);
+	unsigned int buses = 0;
+	int i, count = _pose_servos;
+
+	if (!count)
+		return 0;
+
+	for (i=0; i<MAILBOX_WORDS; i++) {
+		for (unsigned int boards = pp->boards[i]; boards; boards &= (boards - 1)) {
+			int board = (i * 32) + __builtin_ctz (boards);
+			if (_board_bus[board] >= 0)
+				buses |= (1u << _board_bus[board]);
+		}
+	}
+	__atomic_store_n (&(pp->buses), buses, __ATOMIC_RELEASE);
+
+	for (i=0; i<_bus_count; i++) {
+		if (buses & (1u << i))
+			_io_queue_bus (&(_buses[i]), IO_POSE, _pose_back, 0, 0, NULL);
+	}
+	_flush_buses |= buses;
+	_io_queue (IO_FLUSH, 0, 0, 0);
+
+	_pose_back ^= 1;
+	_pose_servos = 0;
+	return count;
+}
+
+
+/**
+ * \private method to perform all commands currently in the command ring of a bus
+ *
+ *When commands are conflated, the mailbox is collected before each command other than a channel value, as every value
+ *in it was posted before the command; a stop, pose, recall or motion is never overwritten by an older value.
+ *Only the I/O thread of the bus may call this method.
+ *@returns non-zero when IO_EXIT has been received
+ */
+static int _io_drain (i2c_bus* busp)
+{
+	io_worker* wp = &(busp->worker);
+	int exit = 0;
+	unsigned int tail = wp->tail;
+	unsigned int head = __atomic_load_n (&(wp->head), __ATOMIC_ACQUIRE);
+
+	while (tail != head) {
+		const io_command* cmd = &(wp->ring[tail & (IO_RING_SIZE-1)]);
+		if (cmd->command == IO_EXIT)
+			exit = 1;
+		else {
+			if (_io_config.conflate && (cmd->command != IO_CHANNEL))
+				_mailbox_collect (busp);	// the values in the mailbox were posted before the command
+			_io_execute (busp, cmd);
+		}
+		tail++;
+		__atomic_store_n (&(wp->tail), tail, __ATOMIC_RELEASE);
+	}
+	return exit;
+}
+
+
+
+
+/**
+ * \private method to touch each page of the stack the calling thread may use, so the pages are mapped before the first message
+ */
+static void __attribute__((noinline)) _prefault_stack (void)
+{
+	volatile unsigned char stack[PREFAULT_STACK] __attribute__((unused));
+	long page = sysconf (_SC_PAGESIZE);
+	long i;
+
+	for (i=0; i<PREFAULT_STACK; i+=page)
+		stack[i] = 0;
+}
+
+
+/**
+ * \private method to lock the memory of the process and prefault the stack of the calling thread
+ *
+ *Every page mapped so far, eg the command rings and frames of the buses, and every later mapping, eg the stacks of the
+ *I/O threads, stays in memory. The heap is neither trimmed nor grown with mmap so memory freed later is reused without faults.
+ *@returns 0 on success or -1 if the memory could not be locked
+ */
+static int _realtime_start (void)
+{
+	_realtime = true;
+	mallopt (M_TRIM_THRESHOLD, -1);
+	mallopt (M_MMAP_MAX, 0);
+	_prefault_stack ();
+
+	if (0 != mlockall (MCL_CURRENT | MCL_FUTURE)) {
+		ROS_WARN ("Unable to lock the memory of the process :: %s; the process may need CAP_IPC_LOCK or a larger RLIMIT_MEMLOCK", strerror (errno));
+		return -1;
+	}
+	ROS_INFO ("Memory of the process locked with mlockall()");
+	return 0;
+}
+
+
+/**
+ * \private method run by the I/O thread of a bus to drain its command ring
+ *
+ *Without the output scheduler, the staged frame is written when each message has been queued.
+ *With the output scheduler, staged values are written once per tick. Ticks use absolute deadlines on
+ *the monotonic clock so timing errors do not accumulate; when a tick is more than a full period late
+ *the missed ticks are skipped rather than written back to back.
+ *@param arg the bus
+ *@returns NULL
+ */
+static void* _io_thread (void* arg)
+{
+	i2c_bus* busp = (i2c_bus*)arg;
+	io_worker* wp = &(busp->worker);
+	int exit = 0;
+	struct timespec next, now;
+
+	if (_realtime)
+		_prefault_stack ();
+	if (_io_config.cpu >= 0) {
+		int cpu = (_io_config.cpu + busp->index) % CPU_SETSIZE;
+		cpu_set_t cpus;
+		CPU_ZERO (&cpus);
+		CPU_SET (cpu, &cpus);
+		if (0 != pthread_setaffinity_np (pthread_self(), sizeof(cpus), &cpus))
+			ROS_WARN ("Unable to bind the I/O thread of /dev/i2c-%d to CPU %d", busp->device, cpu);
+	}
+	if (_io_config.priority > 0) {
+		struct sched_param param;
+		param.sched_priority = _io_config.priority;
+		if (0 != pthread_setschedparam (pthread_self(), SCHED_FIFO, &param))
+			ROS_WARN ("Unable to set SCHED_FIFO priority %d for the I/O thread :: the process may need CAP_SYS_NICE", _io_config.priority);
+	}
+
+	clock_gettime (CLOCK_MONOTONIC, &next);
+
+	while (!exit) {
+		if (_io_config.scheduled) {
+			long period = _io_period ();
+
+			next.tv_nsec += period;
+			while (next.tv_nsec >= 1000000000L) {
+				next.tv_nsec -= 1000000000L;
+				next.tv_sec++;
+			}
+			while (EINTR == clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL))
+				;
+
+			clock_gettime (CLOCK_MONOTONIC, &now);
+			long late = ((now.tv_sec - next.tv_sec) * 1000000000L) + (now.tv_nsec - next.tv_nsec);
+			wp->ticks++;
+			if (late > wp->late_max)
+				wp->late_max = late;
+			if (late > period) {
+				wp->overruns++;
+				next = now;		// start over from now rather than catching up
+			}
+			busp->tick = ((long long)next.tv_sec * 1000000000LL) + next.tv_nsec;	// motions advance by whole ticks
+		}
+
+		__atomic_store_n (&(wp->busy), 1, __ATOMIC_RELEASE);
+		exit = _io_drain (busp);
+
+		if (_io_config.conflate) {
+			long long stamp = __atomic_exchange_n (&(busp->mailbox_stamp), 0, __ATOMIC_RELAXED);
+			if (stamp && !busp->frame_stamp)
+				busp->frame_stamp = stamp;
+			long long newest = __atomic_exchange_n (&(busp->mailbox_newest), 0, __ATOMIC_ACQUIRE);
+			if (newest)
+				busp->frame_newest = newest;
+			_mailbox_collect (busp);
+		}
+		if (_deadline_count)
+			_deadline_check (busp);
+		if (busp->motion_count)
+			_motion_tick (busp);
+		if (_io_config.conflate || _io_config.scheduled)
+			_frame_flush (busp);
+		if (_verify_rate > 0)
+			_verify_idle (busp);
+		__atomic_store_n (&(wp->busy), 0, __ATOMIC_RELEASE);
+
+		if (!exit && !_io_config.scheduled) {
+			if (_verify_rate > 0) {
+				// wake for the next check when no commands arrive; sem_timedwait only uses the realtime clock
+				struct timespec deadline;
+				clock_gettime (CLOCK_REALTIME, &deadline);
+				deadline.tv_nsec += 1000000000L / _verify_rate;
+				while (deadline.tv_nsec >= 1000000000L) {
+					deadline.tv_nsec -= 1000000000L;
+					deadline.tv_sec++;
+				}
+				sem_timedwait (&(wp->wakeup), &deadline);
+			}
+			else
+				sem_wait (&(wp->wakeup));
+		}
+	}
+	return NULL;
+}
+
+
+/**
+ * \private method to start the I/O thread of each bus
+ *
+ *From this point on each I/O thread owns the I2C handle of its bus and ROS callbacks only validate and queue commands.
+ *Without the output scheduler a bus whose thread cannot be started is written from the ROS callbacks instead.
+ *@returns 0 on success or -1 if the output scheduler is enabled and a thread could not be started
+ */
+static int _io_start (void)
+{
+	int i;
+
+	for (i=0; i<_bus_count; i++) {
+		i2c_bus* busp = &(_buses[i]);
+		io_worker* wp = &(busp->worker);
+
+		wp->head = 0;
+		wp->tail = 0;
+		wp->ticks = 0;
+		wp->overruns = 0;
+		wp->late_max = 0;
+		wp->busy = 0;
+		sem_init (&(wp->wakeup), 0, 0);
+		memset (busp->deadline_missed, 0, sizeof(busp->deadline_missed));
+		busp->frame_newest = 0;
+		busp->mailbox_newest = 0;
+
+		// the realtime mode locks every stack so the I/O threads are given a small one
+		pthread_attr_t attr;
+		pthread_attr_init (&attr);
+		if (_realtime)
+			pthread_attr_setstacksize (&attr, IO_STACK_SIZE);
+
+		wp->running = 1;
+		int failed = pthread_create (&(wp->thread), &attr, _io_thread, busp);
+		pthread_attr_destroy (&attr);
+		if (0 != failed) {
+			wp->running = 0;
+			sem_destroy (&(wp->wakeup));
+			if (_io_config.scheduled) {
+				// motions, drive ramps and deadlines only advance on the ticks of the I/O threads
+				ROS_ERROR ("Unable to start the I/O thread of /dev/i2c-%d :: the output scheduler needs an I/O thread for each bus", busp->device);
+				return -1;
+			}
+			ROS_ERROR ("Unable to start the I/O thread of /dev/i2c-%d :: I2C writes will be made from the ROS callbacks", busp->device);
+			continue;
+		}
+		ROS_INFO ("I/O thread of /dev/i2c-%d started with priority=%d, cpu=%d", busp->device, _io_config.priority, (_io_config.cpu < 0) ? -1 : (_io_config.cpu + i));
+	}
+	if (_io_config.scheduled)
+		ROS_INFO ("Output scheduler started with a period of %ld usec", _io_period() / 1000);
+	return 0;
+}
+
+
+/**
+ * \private method to wait until the I/O thread of each bus has performed every command queued so far
+ *
+ *Only the ROS spin thread may call this method.
+ */
+static void _io_sync (void)
+{
+	int i;
+
+	for (i=0; i<_bus_count; i++) {
+		io_worker* wp = &(_buses[i].worker);
+		if (!wp->running)
+			continue;
+		sem_post (&(wp->wakeup));
+		while ((__atomic_load_n (&(wp->tail), __ATOMIC_ACQUIRE) != wp->head) || __atomic_load_n (&(wp->busy), __ATOMIC_ACQUIRE))
+			nanosleep ((const struct timespec[]){{0, 50000L}}, NULL);
+	}
+}
+
+
+/**
+ * \private method to stop the I/O thread of each bus
+ *
+ *All commands queued before the call are performed before the threads exit.
+ */
+static void _io_stop (void)
+{
+	int i;
+
+	for (i=0; i<_bus_count; i++) {
+		i2c_bus* busp = &(_buses[i]);
+		io_worker* wp = &(busp->worker);
+
+		if (!wp->running)
+			continue;
+
+		_io_queue_bus (busp, IO_EXIT, 0, 0, 0, NULL);
+		pthread_join (wp->thread, NULL);
+		sem_destroy (&(wp->wakeup));
+		wp->running = 0;
+
+		if (_io_config.scheduled)
+			ROS_INFO ("Output scheduler of /dev/i2c-%d: %u ticks, %u overruns, maximum lateness %ld usec", busp->device, wp->ticks, wp->overruns, wp->late_max / 1000);
+	}
+}
+
+
+
+/**
+ * \private method to convert a value, based on a range of ±1.0, to a PWM pulse for a servo
+ *
+ *@param configp the configuration snapshot
+ *@param servo an int value (1..992) indicating which servo configuration to use
+ *@param value an int value (±1.0) indicating when the size of the pulse for the channel.
+ *@returns the pulse end value (0..4096) or -1 if the value or servo configuration is invalid
+ */
+static int _proportional_to_pwm (const config_snapshot* configp, int servo, float value)
+{
+	// need a little wiggle room to allow for accuracy of a floating point value
+	if ((value < -1.0001) || (value > 1.0001)) {
+		ROS_ERROR("Invalid proportion value %f :: proportion values must be between -1.0 and 1.0", value);
+		return -1;
+	}
+
+	if ((servo < 1) || (servo > (MAX_SERVOS))) {
+		ROS_ERROR("Invalid servo number %d :: servo numbers must be between 1 and %d", servo, MAX_SERVOS);
+		return -1;
+	}
+
+	int slot = _servo_slot (servo);
+	
+	if ((slot < 0) || (slot >= configp->count) || (configp->center[slot] < 0) || (configp->range[slot] < 0)) {
+		ROS_ERROR("Missing servo configuration for servo[%d]", servo);
+		return -1;
+	}
+
+	// direction * (range/2 * value) + center using the 16.16 fixed point scale of the servo
+	// the value is taken with 24 fraction bits so the product with the 16.16 scale has 40; the center is added before the
+	// division so the sum is truncated toward zero the same way the float cast of the sum was
+	int pos = (int)(((configp->scale[slot] * (long long)(value * _VALUE_ONE)) + ((long long)configp->center[slot] << 40)) / (1LL << 40));
+        
+	if ((pos < 0) || (pos > 4096)) {
+		ROS_ERROR("Invalid computed position servo[%d] = (direction(%d) * ((range(%d) / 2) * value(%6.4f))) + %d = %d", servo, configp->direction[slot], configp->range[slot], value, configp->center[slot], pos);
+		return -1;
+	}
+	_WRITE_DEBUG("servo[%d] = (direction(%d) * ((range(%d) / 2) * value(%6.4f))) + %d = %d", servo, configp->direction[slot], configp->range[slot], value, configp->center[slot], pos);
+	return pos;
+}
+
+
+
+/**
+ * \private method to convert a batch of values, based on a range of ±1.0, to PWM pulses
+ *
+ *The values and servos are checked in one pass which looks up the configuration slot of each servo, and the pulses
+ *are then computed by a single multiply-add over the scales of the slots. The results are the same as
+ *_proportional_to_pwm() for each value.
+ *@param configp the configuration snapshot
+ *@param servos an array of servo numbers (1..992)
+ *@param values an array of proportional values (±1.0) of the servos
+ *@param count the number of entries in the arrays (1..16)
+ *@param positions returns the pulse end value (0..4096) of each servo or -1 if the value or servo configuration is invalid
+ */
+static void _proportional_to_pwm_array (const config_snapshot* configp, const int* servos, const float* values, int count, int* positions)
+{
+	int slots[16];
+	int i;
+
+	for (i=0; i<count; i++) {
+		int servo = servos[i];
+		int slot = -1;
+
+		if ((values[i] < -1.0001) || (values[i] > 1.0001))
+			ROS_ERROR("Invalid proportion value %f :: proportion values must be between -1.0 and 1.0", values[i]);
+		else if ((servo < 1) || (servo > (MAX_SERVOS)))
+			ROS_ERROR("Invalid servo number %d :: servo numbers must be between 1 and %d", servo, MAX_SERVOS);
+		else {
+			slot = _servo_slot (servo);
+			if ((slot < 0) || (slot >= configp->count) || (configp->center[slot] < 0) || (configp->range[slot] < 0)) {
+				ROS_ERROR("Missing servo configuration for servo[%d]", servo);
+				slot = -1;
+			}
+		}
+		slots[i] = slot;
+	}
+
+	// the same fixed point sum as _proportional_to_pwm()
+	for (i=0; i<count; i++) {
+		int slot = slots[i];
+		if (slot >= 0)
+			positions[i] = (int)(((configp->scale[slot] * (long long)(values[i] * _VALUE_ONE)) + ((long long)configp->center[slot] << 40)) / (1LL << 40));
+	}
+
+	for (i=0; i<count; i++) {
+		int slot = slots[i];
+
+		if (slot < 0)
+			positions[i] = -1;
+		else if ((positions[i] < 0) || (positions[i] > 4096)) {
+			ROS_ERROR("Invalid computed position servo[%d] = (direction(%d) * ((range(%d) / 2) * value(%6.4f))) + %d = %d", servos[i], configp->direction[slot], configp->range[slot], values[i], configp->center[slot], positions[i]);
+			positions[i] = -1;
+		}
+	}
+}
+
+
+
+/**
+ * \private method to set a value for a PWM channel, based on a range of ±1.0, on the active board
+ *
+ *The pulse is staged in the current frame and is written to the hardware by the next IO_FLUSH.
+ *@param configp the configuration snapshot
+ *@param servo an int value (1..16) indicating which channel to change power
+ *@param value an int value (±1.0) indicating when the size of the pulse for the channel.
+ *Example _set_pwm_interval (3, 0, 350)    // set servo #3 (fourth position on the hardware board) with a pulse of 350
+ */
+static void _set_pwm_interval_proportional (const config_snapshot* configp, int servo, float value)
+{
+	int pos = _proportional_to_pwm (configp, servo, value);
+	int start, end;
+
+	if (pos >= 0) {
+		_pwm_pulse (configp, servo, pos, &start, &end);
+		_io_queue (IO_CHANNEL, servo, start, end);
+	}
+}
+
+
+/**
+ * \private method to move a drive servo towards a value, based on a range of ±1.0, at a limited rate of change
+ *
+ *The pulse is interpolated by the motion engine on each tick of the output scheduler, so the speed of the wheel changes
+ *smoothly between Twist messages. A new value replaces the ramp in progress from the speed reached so far, and a
+ *powered off servo ramps up from standing still. Only the channels which change on a tick are written.
+ *@param configp the configuration snapshot
+ *@param servo an int value (1..992)
+ *@param value an int value (±1.0) of the speed
+ *@param rate the most change of the value per second
+ */
+static void _set_pwm_interval_ramped (const config_snapshot* configp, int servo, float value, float rate)
+{
+	int pos = _proportional_to_pwm (configp, servo, value);
+	int slot = _servo_slot (servo);
+	motion_request request;
+
+	if (pos < 0)
+		return;
+
+	// a proportional unit is half of the range of the servo
+	request.profile = PROFILE_LINEAR;
+	request.duration = 0.0;
+	request.velocity = rate * (configp->range[slot] / 2.0);
+	request.acceleration = 0.0;
+	request.rest = configp->center[slot];
+	_io_queue_motion (servo, pos, &request);
+}
+
+
+/**
+ * \private method to compile servo values into a pose of the pose library
+ *
+ *Each value is converted to its pulse, including any offset or phase stagger of the servo, and written into the
+ *register image of its board so a recall needs no conversion. A pose being recalled is replaced once every bus has staged it.
+ *The fail-safe pose of a deadline can not be replaced.
+ *Only the ROS spin thread may call this method.
+ *@param id an int value (1..32) of the pose
+ *@param name the name of the pose for messages
+ *@param servos an array of 'Servo' with a servo number (1..992) and an absolute (0..4096) or proportional (±1.0) value
+ *@param count the number of entries in the array
+ *@param absolute non-zero for absolute values
+ *@returns 0 on success or the first servo which could not be stored
+ */
+static int _pose_store (int id, const char* name, const i2cpwm_board::Servo* servos, int count, int absolute)
+{
+	int i;
+
+	if ((id < 1) || (id > MAX_POSES)) {
+		ROS_ERROR("Invalid pose id %d :: pose ids must be between 1 and %d", id, MAX_POSES);
+		return -1;
+	}
+
+	for (i=0; i<DEADLINE_TOPICS; i++) {
+		if (_deadlines[i].timeout && (_deadlines[i].failsafe == FAILSAFE_POSE) && (_deadlines[i].pose == id)) {
+			ROS_ERROR("Invalid pose id %d :: the pose is the fail-safe of the %s deadline and can not be replaced", id, _deadlines[i].topic);
+			return -1;
+		}
+	}
+
+	stored_pose* pp = &(_stored_poses[id-1]);
+	int epoch, error = 0;
+
+	while (__atomic_load_n (&(pp->buses), __ATOMIC_ACQUIRE))
+		nanosleep ((const struct timespec[]){{0, 100000L}}, NULL);
+
+	const config_snapshot* configp = _config_enter (&epoch);
+	memset (pp, 0, sizeof(*pp));
+	snprintf (pp->name, sizeof(pp->name), "%s", (name && name[0]) ? name : "");
+
+	for (i=0; i<count; i++) {
+		int servo = servos[i].servo;
+		int pos, start, end;
+
+		if ((servo<1) || (servo>(MAX_SERVOS)) || !_board_busp ((servo-1) / 16)) {
+			ROS_ERROR("Invalid servo number %d :: servo numbers must be between 1 and %d on a board assigned to an I2C bus", servo, MAX_SERVOS);
+			pos = -1;
+		}
+		else if (absolute) {
+			pos = (int)servos[i].value;
+			if ((pos < 0) || (pos > 4096)) {
+				ROS_ERROR("Invalid PWM value %d :: PWM values must be between 0 and 4096", pos);
+				pos = -1;
+			}
+		}
+		else
+			pos = _proportional_to_pwm (configp, servo, servos[i].value);
+
+		if (pos < 0) {
+			if (!error)
+				error = servo;
+			continue;
+		}
+
+		int board = (servo-1) / 16;
+		int channel = (servo-1) % 16;
+		unsigned char* regs = &(pp->regs[board][4*channel]);
+		_pwm_pulse (configp, servo, pos, &start, &end);
+		regs[0] = start & 0xFF;
+		regs[1] = start >> 8;
+		regs[2] = end & 0xFF;
+		regs[3] = end >> 8;
+		if (!(pp->channels[board] & (1 << channel)))
+			pp->servos++;
+		pp->channels[board] |= (1 << channel);
+		pp->boards[board / 32] |= (1u << (board % 32));
+	}
+	_config_exit (epoch);
+	ROS_INFO("Pose %d %s stored with %d servos", id, pp->name, pp->servos);
+	return error;
+}
+
+
+/**
+ * \private method to pass a pose of the pose library to the I/O threads of its buses
+ *
+ *With conflated commands, values sent before the recall are staged before the pose and values sent after it over the pose.
+ *Only the ROS spin thread may call this method; a pose recalled again waits until every bus has staged the previous recall.
+ *@param id an int value (1..32) of the pose
+ *@returns 0 on success or -1 if the pose is not stored
+ */
+static int _pose_recall (int id)
+{
+	if ((id < 1) || (id > MAX_POSES) || !_stored_poses[id-1].servos) {
+		ROS_ERROR("Invalid pose id %d :: the pose has not been stored", id);
+		return -1;
+	}
+
+	stored_pose* pp = &(_stored_poses[id-1]);
+	unsigned int buses = 0;
+	int i;
+
+	for (i=0; i<MAILBOX_WORDS; i++) {
+		for (unsigned int boards = pp->boards[i]; boards; boards &= (boards - 1)) {
+			int board = (i * 32) + __builtin_ctz (boards);
+			if (_board_bus[board] >= 0)
+				buses |= (1u << _board_bus[board]);
+		}
+	}
+	while (__atomic_load_n (&(pp->buses), __ATOMIC_ACQUIRE))
+		nanosleep ((const struct timespec[]){{0, 100000L}}, NULL);
+	__atomic_store_n (&(pp->buses), buses, __ATOMIC_RELEASE);
+
+	for (i=0; i<_bus_count; i++) {
+		if (buses & (1u << i))
+			_io_queue_bus (&(_buses[i]), IO_RECALL, id-1, 0, 0, NULL);
+	}
+	_flush_buses |= buses;
+	_io_queue (IO_FLUSH, 0, 0, 0);
+	return 0;
+}
+
+
+
+/**
+ * \private method to configure a servo on the active board
+ *
+ *The change is made to a copy of the configuration which is published by _config_publish().
+ *@param configp the copy returned by _config_edit()
+ *@param servo an int value (1..16)
+ *@param center an int value gt 1
+ *@param range int value gt 1
+ *@param direction an int  either -1 or 1
+ *Example _config_server (1, 300, 100, -1)   // configure the first servo with a center of 300 and range of 100 and reversed direction
+ */
+static void _config_servo (config_snapshot* configp, int servo, int center, int range, int direction)
+{
+	if ((servo < 1) || (servo > (MAX_SERVOS))) {
+		ROS_ERROR("Invalid servo number %d :: servo numbers must be between 1 and %d", servo, MAX_SERVOS);
+		return;
+	}
+
+	if ((center < 0) || (center > 4096))
+		ROS_ERROR("Invalid center value %d :: center values must be between 0 and 4096", center);
+
+	if ((center < 0) || (center > 4096))
+		ROS_ERROR("Invalid range value %d :: range values must be between 0 and 4096", range);
+
+	if (((center - (range/2)) < 0) || (((range/2) + center) > 4096))
+		ROS_ERROR("Invalid range center combination %d ± %d :: range/2 ± center must be between 0 and 4096", center, (range/2));
+
+	int slot = _servo_slot_add (configp, servo);
+	if (slot < 0)
+		return;
+	configp->center[slot] = center;
+	configp->range[slot] = range;
+	configp->direction[slot] = direction;
+	configp->scale[slot] = (long long)direction * range * (_FIXED_ONE / 2);
+
+	ROS_INFO("Servo #%d configured: center=%d, range=%d, direction=%d", servo, center, range, direction);
+}
+
+
+/**
+ * \private method to assign a servo to a drive position
+ *
+ *The change is made to a copy of the configuration which is published by _config_publish().
+ *@param configp the copy returned by _config_edit()
+ *@param servo an int value (1..992)
+ *@param position an int value (0..4) of the drive position; 0 removes the servo from the drive
+ *@returns 0 on success or -1 on error
+ */
+static int _config_servo_position (config_snapshot* configp, int servo, int position)
+{
+	int i;
+
+	if ((servo < 1) || (servo > (MAX_SERVOS))) {
+		ROS_ERROR("Invalid servo number %d :: servo numbers must be between 1 and %d", servo, MAX_SERVOS);
+		return -1;
+	}
+	if ((position < POSITION_UNDEFINED) || (position > POSITION_RIGHTREAR)) {
+		ROS_ERROR("Invalid drive mode position %d :: positions are 0 = non-drive, 1 = left front, 2 = right front, 3 = left rear, and 4 = right rear", position);
+		return -1;
+	}
+
+	// keep the list of servos of each drive position so a Twist does not need to search all servos
+	int slot = _servo_slot_add (configp, servo);
+	if (slot < 0)
+		return -1;
+	int old = configp->mode_pos[slot];
+	if ((old > POSITION_UNDEFINED) && (old < POSITION_INVALID)) {
+		for (i=0; i<configp->drive_count[old]; i++) {
+			if (configp->drive_servos[old][i] == servo) {
+				configp->drive_servos[old][i] = configp->drive_servos[old][--configp->drive_count[old]];
+				break;
+			}
+		}
+	}
+	if (position > POSITION_UNDEFINED)
+		configp->drive_servos[position][configp->drive_count[position]++] = servo;
+
+	configp->mode_pos[slot] = position;
+	ROS_INFO("Servo #%d configured: position=%d", servo, position);
+	return 0;
+}
+
+
+/**
+ \private method to compute the proportional speed of each drive position from a Twist
+
+ All four positions are computed together with the same arithmetic - one float lane per position - so the compiler
+ is able to use SIMD (NEON or SSE) instructions. The drive mode only selects the coefficients of the lanes.
+
+ @param drivep the drive mode
+ @param twist the Twist message
+ @param speed returns the proportional speed (±1.0) of position 1..4 in speed[0]..speed[3]
+ @returns the number of positions used by the active drive mode
+ */
+static int _drive_kinematics (const drive_mode* drivep, const geometry_msgs::Twist* twist, float* speed)
+{
+	/* the subscriber uses the maths from: http://robotsforroboticists.com/drive-kinematics/ */
+
+	// coefficients of the turn and lateral components for left-front, right-front, left-rear, right-rear
+	static const float turn[MODE_INVALID][4] __attribute__((aligned(16))) = {
+		{ 0,  0,  0,  0},	// undefined
+		{ 0,  0,  0,  0},	// ackerman - steering is handled by a separate servo
+		{ 1, -1,  1, -1},	// differential
+		{ 1, -1,  1, -1}	// mecanum
+	};
+	static const float lateral[MODE_INVALID][4] __attribute__((aligned(16))) = {
+		{ 0,  0,  0,  0},
+		{ 0,  0,  0,  0},
+		{ 0,  0,  0,  0},
+		{ 1, -1, -1,  1}
+	};
+	static const int positions[MODE_INVALID] = { 0, 1, 2, 4 };
+
+	float delta, range, ratio;
+	float temp_x, temp_y, temp_r;
+	float dir_x, dir_y, dir_r;
+	int k;
+
+	const float* tp = turn[drivep->mode];
+	const float* lp = lateral[drivep->mode];
+
+	dir_x = ((twist->linear.x  < 0) ? -1 : 1);
+	dir_y = ((twist->linear.y  < 0) ? -1 : 1);
+	dir_r = ((twist->angular.z < 0) ? -1 : 1);
+
+	temp_x = drivep->scale * _abs(twist->linear.x);
+	temp_y = drivep->scale * _abs(twist->linear.y);
+	temp_r = _abs(twist->angular.z);	// radians
+
+	// temp_x = _smoothing (temp_x);
+	// temp_y = _smoothing (temp_y);
+	// temp_r = _smoothing (temp_r) / 2;
+
+	// the differential rate is the robot rotational circumference / angular velocity
+	// since the differential rate is applied to both sides in opposite amounts it is halved
+	delta = (drivep->track / 2) * temp_r;
+	// delta is now in meters/sec
+
+	// determine if we will over-speed the motor and scal accordingly
+	ratio = temp_x + delta;
+	if ((ratio * drivep->inv_max_rate) > 1.0)
+		temp_x /= (ratio * drivep->inv_max_rate);
+
+	float turn_rate = dir_r * delta;
+	float lateral_rate = dir_y * temp_y;
+
+	// the sign of the angular velocity determines which side is faster / slower
+	for (k=0; k<4; k++)
+		speed[k] = (dir_x * (temp_x + (tp[k] * turn_rate))) + (lp[k] * lateral_rate);
+
+	/* if any of the results are greater that 1.0, we need to scale all the results down */
+	range = 0;
+	for (k=0; k<4; k++)
+		range = _max (range, _abs(speed[k]));
+
+	ratio = range * drivep->inv_max_rate;
+	float factor = drivep->inv_max_rate;
+	if (ratio > 1.0)
+		factor /= ratio;
+
+	for (k=0; k<4; k++)
+		speed[k] *= factor;
+
+	_WRITE_DEBUG("drive mode %d speed leftfront=%6.4f rightfront=%6.4f leftrear=%6.4f rightrear=%6.4f", drivep->mode, speed[0], speed[1], speed[2], speed[3]);
+	return positions[drivep->mode];
+}
+
+
+/**
+ * \private method to set the drive mode
+ *
+ *The change is made to a copy of the configuration which is published by _config_publish().
+ *@param configp the copy returned by _config_edit()
+ *@returns 0 on success or -1 for an invalid drive mode
+ */
+static int _config_drive_mode (config_snapshot* configp, std::string mode, float rpm, float radius, float track, float scale, float acceleration)
+{
+	int mode_val = MODE_UNDEFINED;
+
+	// assumes the parameter was provided in the proper case
+	if 		(0 == strcmp (mode.c_str(), _CONST("ackerman")))
+		mode_val = MODE_ACKERMAN;
+	else if (0 == strcmp (mode.c_str(), _CONST("differential")))
+		mode_val = MODE_DIFFERENTIAL;
+	else if (0 == strcmp (mode.c_str(), _CONST("mecanum")))
+		mode_val = MODE_MECANUM;
+	else {
+		mode_val = MODE_INVALID;
+		ROS_ERROR("Invalid drive mode %s :: drive mode must be one of ackerman, differential, or mecanum", mode.c_str());
+		return -1;
+	}
 
 	if (rpm <= 0.0) {
 		ROS_ERROR("Invalid RPM %6.4f :: the motor's output RPM must be greater than 0.0", rpm);
@@ -690,13 +3753,21 @@ static int _config_drive_mode (std::string mode, float rpm, float radius, float
 		return -1;
 	}
 
-	_active_drive.mode = mode_val;
-	_active_drive.rpm = rpm;
-	_active_drive.radius = radius;	// the service takes the radius in meters
-	_active_drive.track = track;		// the service takes the track in meters
-	_active_drive.scale = scale;
+	if (acceleration < 0.0) {
+		ROS_ERROR("Invalid acceleration %6.4f :: the acceleration must be 0.0 or greater meters per second squared", acceleration);
+		return -1;
+	}
+
+	configp->drive.mode = mode_val;
+	configp->drive.rpm = rpm;
+	configp->drive.radius = radius;	// the service takes the radius in meters
+	configp->drive.track = track;		// the service takes the track in meters
+	configp->drive.scale = scale;
+	configp->drive.max_rate = (radius * _PI * 2) * (rpm / 60.0);
+	configp->drive.inv_max_rate = 1.0 / configp->drive.max_rate;
+	configp->drive.acceleration = acceleration;
 
-	ROS_INFO("Drive mode configured: mode=%s, rpm=%6.4f, radius=%6.4f, track=%6.4f, scale=%6.4f", mode.c_str(), rpm, radius, track, scale);
+	ROS_INFO("Drive mode configured: mode=%s, rpm=%6.4f, radius=%6.4f, track=%6.4f, scale=%6.4f, acceleration=%6.4f", mode.c_str(), rpm, radius, track, scale, acceleration);
 	return 0;
 }
 
@@ -705,43 +3776,142 @@ static int _config_drive_mode (std::string mode, float rpm, float radius, float
 /**
  \private method to initialize private internal data structures at startup
 
-@param devicename a string value indicating the linux I2C device
-
-Example _init ("/dev/i2c-1");  // default I2C device on RPi2 and RPi3 = "/dev/i2c-1"
+The I2C buses are opened afterwards with _bus_open().
  */
-static void _init (const char* filename)
+static void _init (void)
 {
-    int res;
-    char mode1res;
     int i;
 
     /* initialize all of the global data objects */
     
-    for (i=0; i<MAX_BOARDS;i++)
+    for (i=0; i<MAX_BOARDS;i++) {
         _pwm_boards[i] = -1;
+        _board_bus[i] = -1;
+        _board_address[i] = 0;
+        _board_channel[i] = -1;
+    }
     _active_board = -1;
 
-	for (i=0; i<(MAX_SERVOS);i++) {
-		// these values have not useful meaning
-		_servo_configs[i].center = -1;
-		_servo_configs[i].range = -1;
-		_servo_configs[i].direction = 1;
-		_servo_configs[i].mode_pos = -1;
+	memset (_pwm_frames, 0, sizeof(_pwm_frames));
+	memset (_motions, 0, sizeof(_motions));
+	memset (_board_health, 0, sizeof(_board_health));
+	_bus_count = 0;
+	_flush_buses = 0;
+
+	// only the slot index is cleared; a slot is initialized when its servo is first configured
+	memset (_servos.slot, 0, sizeof(_servos.slot));
+	_servos.count = 0;
+
+	// no reader runs yet so the previous snapshot is freed without waiting
+	free (_config);
+	_config = _config_alloc (16);
+}
+
+
+/**
+ \private method to open an I2C bus and assign the next boards to it
+
+Boards are assigned to buses in the order the buses are opened, eg with two buses of 4 boards, boards 5..8 are the first 4 boards of the second bus.
+A device which is already open gets more boards instead of a second bus, eg the boards behind another channel of its multiplexer.
+@param filename a string value indicating the linux I2C device
+@param device an int value of the linux I2C device number used for messages
+@param boards an int value of the number of boards on the bus
+@param address an int value of the 7 bit I2C address of the first board on the bus; each further board uses the next address
+@param mux an int value of the 7 bit I2C address of a TCA9548A multiplexer the boards are behind or 0 when the boards are directly on the bus
+@param channel an int value (0..7) of the multiplexer channel of the boards
+@returns 0 on success or -1 if the I2C bus could not be opened
+
+Example _bus_open ("/dev/i2c-1", 1, 62, 0x40, 0, 0);  // default I2C device on RPi2 and RPi3 = "/dev/i2c-1"
+ */
+static int _bus_open (const char* filename, int device, int boards, int address, int mux, int channel)
+{
+	int i, j, first = 0;
+
+	while ((first < MAX_BOARDS) && (_board_bus[first] >= 0))
+		first++;		// the first board not yet assigned to a bus
+
+	if ((boards < 1) || ((first + boards) > MAX_BOARDS)) {
+		ROS_ERROR ("Invalid board count %d for I2C bus %s :: the buses have at most %d boards in total", boards, filename, MAX_BOARDS);
+		return -1;
 	}
-	_last_servo = -1;
+	if ((address < _BASE_ADDR) || ((address + boards - 1) > 0x7F)) {
+		ROS_ERROR ("Invalid board address 0x%02X for I2C bus %s :: the addresses of %d boards must be between 0x%02X and 0x7F", address, filename, boards, _BASE_ADDR);
+		return -1;
+	}
+	if (mux && ((mux < 0x70) || (mux > 0x77) || (channel < 0) || (channel > 7))) {
+		ROS_ERROR ("Invalid multiplexer 0x%02X channel %d for I2C bus %s :: a TCA9548A is at 0x70..0x77 and has channels 0..7", mux, channel, filename);
+		return -1;
+	}
+	if (!mux)
+		channel = -1;
 
-	_active_drive.mode = MODE_UNDEFINED;
-	_active_drive.rpm = -1.0;
-	_active_drive.radius = -1.0;
-	_active_drive.track = -1.0;
-	_active_drive.scale = -1.0;
-	
-	
-    if ((_controller_io_handle = open (filename, O_RDWR)) < 0) {
-        ROS_FATAL ("Failed to open I2C bus %s", filename);
-        return; /* exit(1) */   /* additional ERROR HANDLING information is available with 'errno' */
-    }
-	ROS_INFO ("I2C bus opened on %s", filename);
+	i2c_bus* busp = NULL;
+	for (i=0; i<_bus_count; i++) {
+		if (0 == strcmp (_buses[i].name, filename))
+			busp = &(_buses[i]);
+	}
+
+	if (busp) {
+		if (mux && busp->mux_address && (mux != busp->mux_address)) {
+			ROS_ERROR ("Invalid multiplexer 0x%02X for I2C bus %s :: the bus already has a multiplexer at 0x%02X", mux, filename, busp->mux_address);
+			return -1;
+		}
+		// a board directly on the bus is reached on every channel so its address must differ from the boards of every channel
+		for (i=0; i<MAX_BOARDS; i++) {
+			if ((_board_bus[i] != busp->index) || ((_board_channel[i] != channel) && (_board_channel[i] >= 0) && (channel >= 0)))
+				continue;
+			if ((_board_address[i] >= address) && (_board_address[i] < (address + boards))) {
+				ROS_ERROR ("Invalid board address 0x%02X for I2C bus %s :: board %d already uses the address", _board_address[i], filename, i+1);
+				return -1;
+			}
+		}
+	}
+	else {
+		if (_bus_count >= MAX_BUSES) {
+			ROS_ERROR ("Invalid I2C bus %s :: at most %d buses are supported", filename, MAX_BUSES);
+			return -1;
+		}
+		busp = &(_buses[_bus_count]);
+		memset (busp, 0, sizeof(*busp));
+		busp->index = _bus_count;
+		busp->device = device;
+		strncpy (busp->name, filename, sizeof(busp->name) - 1);
+		busp->active_address = -1;
+		busp->mux_channel = -1;
+
+		if ((busp->handle = _bus->open (filename)) < 0) {
+			ROS_FATAL ("Failed to open I2C bus %s", filename);
+			return -1; /* exit(1) */   /* additional ERROR HANDLING information is available with 'errno' */
+		}
+		_bus_count++;
+	}
+
+	if (mux) {
+		busp->mux_address = mux;
+		for (j=0; j<MAX_BOARDS; j++) {
+			if ((_board_bus[j] == busp->index) && (_board_address[j] == mux)) {
+				ROS_ERROR ("Invalid multiplexer 0x%02X for I2C bus %s :: board %d uses the address", mux, filename, j+1);
+				return -1;
+			}
+		}
+		if ((mux >= address) && (mux < (address + boards))) {
+			ROS_ERROR ("Invalid multiplexer 0x%02X for I2C bus %s :: the address is within the addresses of the boards", mux, filename);
+			return -1;
+		}
+	}
+
+	for (i=first; i<(first + boards); i++) {
+		_board_bus[i] = busp->index;
+		_board_address[i] = address + (i - first);
+		_board_channel[i] = channel;
+		busp->board_mask[i / 32] |= (1u << (i % 32));
+	}
+
+	if (mux)
+		ROS_INFO ("I2C bus %s using the %s backend has boards %d..%d at addresses 0x%02X..0x%02X on channel %d of the multiplexer at 0x%02X", filename, _bus->name, first+1, first+boards, address, address+boards-1, channel, mux);
+	else
+		ROS_INFO ("I2C bus %s using the %s backend has boards %d..%d at addresses 0x%02X..0x%02X", filename, _bus->name, first+1, first+boards, address, address+boards-1);
+	return 0;
 }
 
 
@@ -782,105 +3952,479 @@ static void _init (const char* filename)
    # the servos have been connected to the PWM board starting with the first connector and proceeding in order
    # any drive servos used for the left side servos are mounted opposite of those for the right side
 
-   # the follow message sets the PWM value of the first two servos to 250 and 350 respectively.
-   # depending on center value of each servo, these values may casue forward or backward rotation
+   # the follow message sets the PWM value of the first two servos to 250 and 350 respectively.
+   # depending on center value of each servo, these values may casue forward or backward rotation
+
+   rostopic pub -1 /servos_absolute i2cpwm_board/ServoArray "{servos:[{servo: 1, value: 250}, {servo: 2, value: 350}]}"
+
+   # the following messages are an example of finding a continuous servo's center
+   # in this example the center is found to be 333
+
+   rostopic pub -1 /servos_absolute i2cpwm_board/ServoArray "{servos:[{servo: 1, value: 300}]}"
+   rostopic pub -1 /servos_absolute i2cpwm_board/ServoArray "{servos:[{servo: 1, value: 350}]}"
+   rostopic pub -1 /servos_absolute i2cpwm_board/ServoArray "{servos:[{servo: 1, value: 320}]}"
+   rostopic pub -1 /servos_absolute i2cpwm_board/ServoArray "{servos:[{servo: 1, value: 330}]}"
+   rostopic pub -1 /servos_absolute i2cpwm_board/ServoArray "{servos:[{servo: 1, value: 335}]}"
+   rostopic pub -1 /servos_absolute i2cpwm_board/ServoArray "{servos:[{servo: 1, value: 333}]}"
+
+   # power off servo - eg 'coast' rather than 'brake'
+   rostopic pub -1 /servos_absolute i2cpwm_board/ServoArray "{servos:[{servo: 1, value: 0}]}"
+   \endcode
+
+ */
+void servos_absolute (const i2cpwm_board::ServoArray::ConstPtr& msg)
+{
+    /* this subscription works on the active_board */
+    _message_stamp = _stats_now ();
+    _stats_count (STAT_ABSOLUTE, 1);
+    _deadline_touch (DEADLINE_ABSOLUTE);
+    _trace (I2CPWM_TRACE_RECEIVED, _message_stamp, 0);
+
+    int epoch;
+    const config_snapshot* configp = _config_enter (&epoch);
+
+    for(std::vector<i2cpwm_board::Servo>::const_iterator sp = msg->servos.begin(); sp != msg->servos.end(); ++sp) {
+        int servo = sp->servo;
+        int value = sp->value;
+
+        if ((value < 0) || (value > 4096)) {
+            ROS_ERROR("Invalid PWM value %d :: PWM values must be between 0 and 4096", value);
+            continue;
+        }
+        if ((servo<1) || (servo>(MAX_SERVOS))) {
+            ROS_ERROR("Invalid servo number %d :: servo numbers must be between 1 and %d", servo, MAX_SERVOS);
+            continue;
+        }
+        int start, end;
+        _pwm_pulse (configp, servo, value, &start, &end);
+        _io_queue (IO_CHANNEL, servo, start, end);
+        _WRITE_DEBUG("servo[%d] = %d", servo, value);
+    }
+    _config_exit (epoch);
+    _trace (I2CPWM_TRACE_CONVERTED, _message_stamp, 0);
+    _io_queue (IO_FLUSH, 0, 0, 0);	// one block write per board for all servos of the message
+    _stats_time (HIST_ABSOLUTE, _message_stamp);
+}
+
+
+/**
+   \brief subscriber topic to move servos in the range of ±1.0
+
+   Subscriber for controlling servos using proportional values. 
+   This topic processes one or more servos and sets their physical pulse value based on
+   each servos physical range proportional to a range of ±1.0. 
+
+   When working with a continuous rotation servo,
+   the topic is used to adjust the speed of the servo.
+
+   When working with a fixed 180 degree rotation servo,
+   the topic is used to adjust the position of the servo.
+
+   This topic requires the use of the config_servos() service.
+   Once the configuration of the servos - center position, direction of rotation, and PWM range - has been set, 
+   these data are to convert the proportional value to a physical PWM value specific to each servo.
+
+   @param msg  a 'ServoArray' message (array of one or more 'Servo') where the servo:value is a relative position/speed
+
+   __i2cpwm_board::ServoArray Message__
+   \include "ServoArray.msg"
+   __i2cpwm_board::Servo Message__
+   \include "Servo.msg"
+
+   __Example__
+   \code{.sh}
+   # this example makes the following assumptions about the hardware
+   # the servos have been connected to the PWM board starting with the first connector and proceeding in order
+   # any drive servos used for the left side servos are mounted opposite of those for the right side
+
+   # this example uses 2 servos
+   # the first servo is the left and the second servo is the right
+
+   # configure two continuous rotation servos associated with the drive system - these servos were determined to have a ragee of ±50
+
+   rosservice call /config_servos "servos: [{servo: 1, center: 333, range: 100, direction: -1}, \
+                                            {servo: 2, center: 336, range: 108, direction: 1}]"
+
+   # drive both servos forward at 40% of maximum speed
+
+   rostopic pub -1 /servos_proportional i2cpwm_board/ServoArray "{servos:[{servo: 1, value: 0.40}, {servo: 2, value: 0.40}]}"
+
+   # additionally configure one 180 degree servo (±90) used for a robot arm - this servo was determine to have a ragee of ±188
+
+   rosservice call /config_servos "servos: [{servo: 9, center: 344, range: 376, direction: -1}]" 
+
+   # drive the arm servo to its 45 degree position and then to its -45 degree position
+
+   rostopic pub -1 /servos_proportional i2cpwm_board/ServoArray "{servos:[{servo: 9, value: 0.50}]}"
+   rostopic pub -1 /servos_proportional i2cpwm_board/ServoArray "{servos:[{servo: 9, value: -0.50}]}"
+   \endcode
+ */
+void servos_proportional (const i2cpwm_board::ServoArray::ConstPtr& msg)
+{
+    /* this subscription works on the active_board */
+    _message_stamp = _stats_now ();
+    _stats_count (STAT_PROPORTIONAL, 1);
+    _deadline_touch (DEADLINE_PROPORTIONAL);
+    _trace (I2CPWM_TRACE_RECEIVED, _message_stamp, 0);
+
+    int servos[16], positions[16];
+    float values[16];
+    int count = msg->servos.size();
+    int i, j;
+    int epoch;
+    const config_snapshot* configp = _config_enter (&epoch);
+
+    // the message is converted in batches to keep the working set on the stack
+    for (i=0; i<count; i+=16) {
+        int batch = ((count - i) > 16) ? 16 : (count - i);
+
+        for (j=0; j<batch; j++) {
+            servos[j] = msg->servos[i+j].servo;
+            values[j] = msg->servos[i+j].value;
+        }
+        _proportional_to_pwm_array (configp, servos, values, batch, positions);
+
+        for (j=0; j<batch; j++) {
+            int start, end;
+            if (positions[j] < 0)
+                continue;
+            _pwm_pulse (configp, servos[j], positions[j], &start, &end);
+            _io_queue (IO_CHANNEL, servos[j], start, end);
+        }
+    }
+    _config_exit (epoch);
+    _trace (I2CPWM_TRACE_CONVERTED, _message_stamp, 0);
+    _io_queue (IO_FLUSH, 0, 0, 0);	// one block write per board for all servos of the message
+    _stats_time (HIST_PROPORTIONAL, _message_stamp);
+}
+
+
+/**
+   \brief subscriber topic to set a run of consecutive servos from dense arrays of values
+
+   Subscriber for setting many servos with one compact message, eg a full body pose.
+   The servos are numbered from first_servo in the order of the values. The values are either
+   absolute pulse values, the same as the servos_absolute() topic, or proportional values of ±1.0,
+   the same as the servos_proportional() topic.
+
+   A ServoArray carries a servo number with each value and is deserialized one struct at a time.
+   The arrays of a ServoFrame are plain numbers which are deserialized with a single copy, and the message
+   is a third of the size for absolute values.
+
+   Proportional values require the use of the config_servos() service.
+
+   @param msg  a 'ServoFrame' message with the first servo and either its counts or its values
+
+   __i2cpwm_board::ServoFrame Message__
+   \include "ServoFrame.msg"
+
+   __Example__
+   \code{.sh}
+   # set servos 1 through 4 to absolute pulse values
+
+   rostopic pub -1 /servos_frame i2cpwm_board/ServoFrame "{first_servo: 1, counts: [333, 336, 340, 330]}"
+
+   # move servos 9 through 12 to their proportional positions
+
+   rostopic pub -1 /servos_frame i2cpwm_board/ServoFrame "{first_servo: 9, values: [0.50, -0.50, 0.25, 0.0]}"
+   \endcode
+ */
+void servos_frame (const i2cpwm_board::ServoFrame::ConstPtr& msg)
+{
+    _message_stamp = _stats_now ();
+    _stats_count (STAT_FRAME, 1);
+    _deadline_touch (DEADLINE_FRAME);
+    _trace (I2CPWM_TRACE_RECEIVED, _message_stamp, 0);
+
+    int first = msg->first_servo;
+    int count = msg->counts.size() + msg->values.size();
+    int i;
+
+    if (!msg->counts.empty() && !msg->values.empty()) {
+        ROS_ERROR("Invalid servo frame of servo %d :: a frame has either counts or values, not both", first);
+        return;
+    }
+    if ((first < 1) || ((first + count - 1) > MAX_SERVOS)) {
+        ROS_ERROR("Invalid servo number %d :: the %d servos of the frame must be between 1 and %d", first, count, MAX_SERVOS);
+        return;
+    }
+
+    const uint16_t* counts = msg->counts.data();
+    const float* values = msg->values.data();
+    bool absolute = !msg->counts.empty();
+    int servos[16], positions[16];
+    int j;
+    int epoch;
+    const config_snapshot* configp = _config_enter (&epoch);
+
+    // the values are converted in batches of 16 straight from the array of the message
+    for (i=0; i<count; i+=16) {
+        int batch = ((count - i) > 16) ? 16 : (count - i);
+
+        for (j=0; j<batch; j++)
+            servos[j] = first + i + j;
+        if (!absolute)
+            _proportional_to_pwm_array (configp, servos, &(values[i]), batch, positions);
+
+        for (j=0; j<batch; j++) {
+            int start, end;
+
+            if (absolute) {
+                positions[j] = counts[i+j];
+                if (positions[j] > 4096) {
+                    ROS_ERROR("Invalid PWM value %d :: PWM values must be between 0 and 4096", positions[j]);
+                    continue;
+                }
+            }
+            else if (positions[j] < 0)
+                continue;
+
+            _pwm_pulse (configp, servos[j], positions[j], &start, &end);
+            _io_queue (IO_CHANNEL, servos[j], start, end);
+        }
+    }
+    _config_exit (epoch);
+    _trace (I2CPWM_TRACE_CONVERTED, _message_stamp, 0);
+    _io_queue (IO_FLUSH, 0, 0, 0);	// one block write per board for all servos of the message
+    _stats_time (HIST_FRAME, _message_stamp);
+}
+
 
-   rostopic pub -1 /servos_absolute i2cpwm_board/ServoArray "{servos:[{servo: 1, value: 250}, {servo: 2, value: 350}]}"
+/**
+   \brief subscriber topic to add absolute values of servos to the staged pose
 
-   # the following messages are an example of finding a continuous servo's center
-   # in this example the center is found to be 333
+   Subscriber for building a pose of many servos, across any number of boards and buses, which is applied all at once by commit_pose().
+   Nothing is written to the boards until the pose is committed; a servo given more than once keeps its last value.
+   The values are the same as the servos_absolute() topic.
 
-   rostopic pub -1 /servos_absolute i2cpwm_board/ServoArray "{servos:[{servo: 1, value: 300}]}"
-   rostopic pub -1 /servos_absolute i2cpwm_board/ServoArray "{servos:[{servo: 1, value: 350}]}"
-   rostopic pub -1 /servos_absolute i2cpwm_board/ServoArray "{servos:[{servo: 1, value: 320}]}"
-   rostopic pub -1 /servos_absolute i2cpwm_board/ServoArray "{servos:[{servo: 1, value: 330}]}"
-   rostopic pub -1 /servos_absolute i2cpwm_board/ServoArray "{servos:[{servo: 1, value: 335}]}"
-   rostopic pub -1 /servos_absolute i2cpwm_board/ServoArray "{servos:[{servo: 1, value: 333}]}"
+   @param msg  a 'ServoArray' message (array of one or more 'Servo') where the servo:value is the pulse value (0..4096)
 
-   # power off servo - eg 'coast' rather than 'brake'
-   rostopic pub -1 /servos_absolute i2cpwm_board/ServoArray "{servos:[{servo: 1, value: 0}]}"
-   \endcode
+   __Example__
+   \code{.sh}
+   # stage a pose of servos on the first and second boards and then apply it
 
+   rostopic pub -1 /pose_absolute i2cpwm_board/ServoArray "{servos:[{servo: 1, value: 333}, {servo: 17, value: 340}]}"
+   rostopic pub -1 /pose_absolute i2cpwm_board/ServoArray "{servos:[{servo: 2, value: 310}, {servo: 18, value: 300}]}"
+   rosservice call /commit_pose
+   \endcode
  */
-void servos_absolute (const i2cpwm_board::ServoArray::ConstPtr& msg)
+void pose_absolute (const i2cpwm_board::ServoArray::ConstPtr& msg)
 {
-    /* this subscription works on the active_board */
-    
+    int epoch;
+    const config_snapshot* configp = _config_enter (&epoch);
+
     for(std::vector<i2cpwm_board::Servo>::const_iterator sp = msg->servos.begin(); sp != msg->servos.end(); ++sp) {
         int servo = sp->servo;
         int value = sp->value;
+        int start, end;
 
         if ((value < 0) || (value > 4096)) {
             ROS_ERROR("Invalid PWM value %d :: PWM values must be between 0 and 4096", value);
             continue;
         }
-        _set_pwm_interval (servo, 0, value);
-        ROS_DEBUG("servo[%d] = %d", servo, value);
+        if ((servo<1) || (servo>(MAX_SERVOS))) {
+            ROS_ERROR("Invalid servo number %d :: servo numbers must be between 1 and %d", servo, MAX_SERVOS);
+            continue;
+        }
+        _pwm_pulse (configp, servo, value, &start, &end);
+        _pose_stage (servo, start, end);
     }
+    _config_exit (epoch);
 }
 
 
 /**
-   \brief subscriber topic to move servos in the range of ±1.0
+   \brief subscriber topic to add proportional values of servos to the staged pose
 
-   Subscriber for controlling servos using proportional values. 
-   This topic processes one or more servos and sets their physical pulse value based on
-   each servos physical range proportional to a range of ±1.0. 
+   The same as pose_absolute() with the proportional values of ±1.0 of the servos_proportional() topic.
+   This topic requires the use of the config_servos() service.
 
-   When working with a continuous rotation servo,
-   the topic is used to adjust the speed of the servo.
+   @param msg  a 'ServoArray' message (array of one or more 'Servo') where the servo:value is a relative position/speed
 
-   When working with a fixed 180 degree rotation servo,
-   the topic is used to adjust the position of the servo.
+   __Example__
+   \code{.sh}
+   rostopic pub -1 /pose_proportional i2cpwm_board/ServoArray "{servos:[{servo: 9, value: 0.50}, {servo: 25, value: -0.50}]}"
+   rosservice call /commit_pose
+   \endcode
+ */
+void pose_proportional (const i2cpwm_board::ServoArray::ConstPtr& msg)
+{
+    int epoch;
+    const config_snapshot* configp = _config_enter (&epoch);
 
-   This topic requires the use of the config_servos() service.
-   Once the configuration of the servos - center position, direction of rotation, and PWM range - has been set, 
-   these data are to convert the proportional value to a physical PWM value specific to each servo.
+    for(std::vector<i2cpwm_board::Servo>::const_iterator sp = msg->servos.begin(); sp != msg->servos.end(); ++sp) {
+        int pos = _proportional_to_pwm (configp, sp->servo, sp->value);
+        int start, end;
 
-   @param msg  a 'ServoArray' message (array of one or more 'Servo') where the servo:value is a relative position/speed
+        if (pos < 0)
+            continue;
+        _pwm_pulse (configp, sp->servo, pos, &start, &end);
+        _pose_stage (sp->servo, start, end);
+    }
+    _config_exit (epoch);
+}
 
-   __i2cpwm_board::ServoArray Message__
-   \include "ServoArray.msg"
-   __i2cpwm_board::Servo Message__
-   \include "Servo.msg"
+
+/**
+   \brief subscriber topic to move servos smoothly to proportional values of ±1.0
+
+   Subscriber for moving servos with a motion profile rather than a single step.
+   The node interpolates each motion on every tick of its output scheduler, so a client only sends the target
+   and the duration - or the velocity and acceleration limits - of the motion. Only the channels which change on
+   a tick are written to the boards.
+
+   The motion of each servo starts from its current position. A new motion, or a value from any other topic,
+   replaces a motion which is still in progress. A servo which is powered off moves directly to its target.
+
+   This topic requires the use of the config_servos() service and the motion_profiles parameter.
+
+   @param msg  a 'ServoMotion' message with the servos and their proportional targets, the duration or limits, and the profile
+
+   __i2cpwm_board::ServoMotion Message__
+   \include "ServoMotion.msg"
 
    __Example__
    \code{.sh}
-   # this example makes the following assumptions about the hardware
-   # the servos have been connected to the PWM board starting with the first connector and proceeding in order
-   # any drive servos used for the left side servos are mounted opposite of those for the right side
+   # move the arm servo to its 45 degree position over 1.5 seconds, accelerating and decelerating along an s-curve
 
-   # this example uses 2 servos
-   # the first servo is the left and the second servo is the right
+   rostopic pub -1 /servos_motion i2cpwm_board/ServoMotion "{servos:[{servo: 9, value: 0.50}], duration: 1.5, profile: 's-curve'}"
 
-   # configure two continuous rotation servos associated with the drive system - these servos were determined to have a ragee of ±50
+   # move the arm servo back to its -45 degree position at no more than 0.5 per second accelerating at 1.0 per second squared
 
-   rosservice call /config_servos "servos: [{servo: 1, center: 333, range: 100, direction: -1}, \
-                                            {servo: 2, center: 336, range: 108, direction: 1}]"
+   rostopic pub -1 /servos_motion i2cpwm_board/ServoMotion "{servos:[{servo: 9, value: -0.50}], velocity: 0.5, acceleration: 1.0}"
+   \endcode
+ */
+void servos_motion (const i2cpwm_board::ServoMotion::ConstPtr& msg)
+{
+    _message_stamp = _stats_now ();
+    _stats_count (STAT_MOTION, 1);
+    _deadline_touch (DEADLINE_MOTION);
 
-   # drive both servos forward at 40% of maximum speed
+    if (!_motion_profiles) {
+        ROS_ERROR("Motion profiles are not enabled :: set the motion_profiles parameter to use the servos_motion topic");
+        return;
+    }
 
-   rostopic pub -1 /servos_proportional i2cpwm_board/ServoArray "{servos:[{servo: 1, value: 0.40}, {servo: 2, value: 0.40}]}"
+    motion_request request;
 
-   # additionally configure one 180 degree servo (±90) used for a robot arm - this servo was determine to have a ragee of ±188
+    if (msg->profile.empty() || (msg->profile == "trapezoidal"))
+        request.profile = PROFILE_TRAPEZOIDAL;
+    else if (msg->profile == "linear")
+        request.profile = PROFILE_LINEAR;
+    else if (msg->profile == "s-curve")
+        request.profile = PROFILE_SCURVE;
+    else {
+        ROS_ERROR("Invalid motion profile %s :: profiles are 'linear', 'trapezoidal' or 's-curve'", msg->profile.c_str());
+        return;
+    }
+    request.rest = 0;
 
-   rosservice call /config_servos "servos: [{servo: 9, center: 344, range: 376, direction: -1}]" 
+    if ((msg->duration < 0.0) || (msg->velocity < 0.0) || (msg->acceleration < 0.0)) {
+        ROS_ERROR("Invalid motion duration %f :: the duration, velocity and acceleration may not be negative", msg->duration);
+        return;
+    }
+    if ((msg->duration == 0.0) && (msg->velocity == 0.0)) {
+        ROS_ERROR("Invalid motion velocity %f :: a motion without a duration requires a velocity", msg->velocity);
+        return;
+    }
 
-   # drive the arm servo to its 45 degree position and then to its -45 degree position
+    int epoch;
+    const config_snapshot* configp = _config_enter (&epoch);
 
-   rostopic pub -1 /servos_proportional i2cpwm_board/ServoArray "{servos:[{servo: 9, value: 0.50}]}"
-   rostopic pub -1 /servos_proportional i2cpwm_board/ServoArray "{servos:[{servo: 9, value: -0.50}]}"
+    for (std::vector<i2cpwm_board::Servo>::const_iterator sp = msg->servos.begin(); sp != msg->servos.end(); ++sp) {
+        int servo = sp->servo;
+        int pos = _proportional_to_pwm (configp, servo, sp->value);
+
+        if (pos < 0)
+            continue;
+
+        // the limits are converted to pulse counts; a proportional unit is half of the range of the servo
+        float counts = configp->range[_servo_slot (servo)] / 2.0;
+        request.duration = msg->duration;
+        request.velocity = msg->velocity * counts;
+        request.acceleration = msg->acceleration * counts;
+        _io_queue_motion (servo, pos, &request);
+    }
+    _config_exit (epoch);
+    _io_queue (IO_FLUSH, 0, 0, 0);
+}
+
+
+/**
+   \brief subscriber topic to move servos to a pose of the pose library
+
+   The pose_recall topic moves every servo of a pose loaded from the 'poses' parameter or stored with the save_pose() service.
+   Poses are kept as the register images of their boards, so a recall converts no values and every board of the pose
+   is written by one flush of its bus, or one tick of the output scheduler. Only the channels which differ from the
+   values already written are sent to the boards.
+
+   With a duration, and the 'motion_profiles' parameter set, each servo of the pose moves from its current position
+   along a motion profile, the same as the servos_motion() topic.
+
+   @param msg  a 'PoseRecall' message with the pose id (1..32), an optional duration in seconds and profile name
+
+   __Example__
+   \code{.sh}
+   # move to pose 1 at once
+   rostopic pub -1 /pose_recall i2cpwm_board/PoseRecall "{id: 1}"
+   # blend to pose 2 over 1.5 seconds
+   rostopic pub -1 /pose_recall i2cpwm_board/PoseRecall "{id: 2, duration: 1.5, profile: s-curve}"
    \endcode
  */
-void servos_proportional (const i2cpwm_board::ServoArray::ConstPtr& msg)
+void pose_recall (const i2cpwm_board::PoseRecall::ConstPtr& msg)
 {
-    /* this subscription works on the active_board */
+    _message_stamp = _stats_now ();
+    _stats_count (STAT_RECALLS, 1);
 
-    for(std::vector<i2cpwm_board::Servo>::const_iterator sp = msg->servos.begin(); sp != msg->servos.end(); ++sp) {
-        int servo = sp->servo;
-        float value = sp->value;
-		_set_pwm_interval_proportional (servo, value);
+    if (msg->duration <= 0.0) {
+        _pose_recall (msg->id);
+        return;
+    }
+
+    if (!_motion_profiles) {
+        ROS_ERROR("Motion profiles are not enabled :: set the motion_profiles parameter to blend to a pose");
+        return;
+    }
+    if ((msg->id < 1) || (msg->id > MAX_POSES) || !_stored_poses[msg->id-1].servos) {
+        ROS_ERROR("Invalid pose id %d :: the pose has not been stored", msg->id);
+        return;
+    }
+
+    motion_request request;
+
+    if (msg->profile.empty() || (msg->profile == "trapezoidal"))
+        request.profile = PROFILE_TRAPEZOIDAL;
+    else if (msg->profile == "linear")
+        request.profile = PROFILE_LINEAR;
+    else if (msg->profile == "s-curve")
+        request.profile = PROFILE_SCURVE;
+    else {
+        ROS_ERROR("Invalid motion profile %s :: profiles are 'linear', 'trapezoidal' or 's-curve'", msg->profile.c_str());
+        return;
+    }
+    request.duration = msg->duration;
+    request.velocity = 0.0;
+    request.acceleration = 0.0;
+    request.rest = 0;
+
+    stored_pose* pp = &(_stored_poses[msg->id-1]);
+
+    for (int word = 0; word < MAILBOX_WORDS; word++) {
+        for (unsigned int boards = pp->boards[word]; boards; boards &= (boards - 1)) {
+            int board = (word * 32) + __builtin_ctz (boards);
+
+            for (unsigned int channels = pp->channels[board]; channels; channels &= (channels - 1)) {
+                int channel = __builtin_ctz (channels);
+                const unsigned char* regs = &(pp->regs[board][4*channel]);
+                int start = regs[0] | (regs[1] << 8);
+                int end = regs[2] | (regs[3] << 8);
+
+                // the motion engine works in pulse widths so the image is converted back to the width it was compiled from
+                _io_queue_motion ((board * 16) + channel + 1, start ? ((end - start) & 0xFFF) : end, &request);
+            }
+        }
     }
+    _io_queue (IO_FLUSH, 0, 0, 0);
 }
 
 
@@ -985,162 +4529,57 @@ void servos_drive (const geometry_msgs::Twist::ConstPtr& msg)
 {
 	/* this subscription works on the active_board */
 
-	int i;
-	float delta, range, ratio;
-	float temp_x, temp_y, temp_r;
-	float dir_x, dir_y, dir_r;
-	float speed[4];
+	int i, position, count;
+	float speed[4] __attribute__((aligned(16)));
+
+	_message_stamp = _stats_now ();
+	_stats_count (STAT_DRIVE, 1);
+	_deadline_touch (DEADLINE_DRIVE);
+	_trace (I2CPWM_TRACE_RECEIVED, _message_stamp, 0);
 	
 	/* msg is a pointer to a Twist message: msg->linear and msg->angular each of which have members .x .y .z */
-	/* the subscriber uses the maths from: http://robotsforroboticists.com/drive-kinematics/ */	
 
-	ROS_DEBUG("servos_drive Twist = [%5.2f %5.2f %5.2f] [%5.2f %5.2f %5.2f]", 
+	_WRITE_DEBUG("servos_drive Twist = [%5.2f %5.2f %5.2f] [%5.2f %5.2f %5.2f]", 
 			 msg->linear.x, msg->linear.y, msg->linear.z, msg->angular.x, msg->angular.y, msg->angular.z);
 
-	if (_active_drive.mode == MODE_UNDEFINED) {
+	int epoch;
+	const config_snapshot* configp = _config_enter (&epoch);
+	const drive_mode* drivep = &(configp->drive);
+
+	if (drivep->mode == MODE_UNDEFINED) {
 		ROS_ERROR("drive mode not set");
+		_config_exit (epoch);
 		return;
 	}
-	if ((_active_drive.mode < MODE_UNDEFINED) || (_active_drive.mode >= MODE_INVALID)) {
-		ROS_ERROR("unrecognized drive mode set %d", _active_drive.mode);
+	if ((drivep->mode < MODE_UNDEFINED) || (drivep->mode >= MODE_INVALID)) {
+		ROS_ERROR("unrecognized drive mode set %d", drivep->mode);
+		_config_exit (epoch);
+		return;
+	}
+	if (drivep->inv_max_rate <= 0.0) {
+		ROS_ERROR("Invalid active drive mode RPM %6.4f and radius %6.4f :: RPM and wheel radius must be greater than 0", drivep->rpm, drivep->radius);
+		_config_exit (epoch);
 		return;
 	}
 
-	dir_x = ((msg->linear.x  < 0) ? -1 : 1);
-	dir_y = ((msg->linear.y  < 0) ? -1 : 1);
-	dir_r = ((msg->angular.z < 0) ? -1 : 1);
-
-	temp_x = _active_drive.scale * _abs(msg->linear.x);
-	temp_y = _active_drive.scale * _abs(msg->linear.y);
-	temp_r = _abs(msg->angular.z);	// radians
-		
-	// temp_x = _smoothing (temp_x);
-	// temp_y = _smoothing (temp_y);
-	// temp_r = _smoothing (temp_r) / 2;
-
-	// the differential rate is the robot rotational circumference / angular velocity
-	// since the differential rate is applied to both sides in opposite amounts it is halved
-	delta = (_active_drive.track / 2) * temp_r;
-	// delta is now in meters/sec
-
-	// determine if we will over-speed the motor and scal accordingly
-	ratio = _convert_mps_to_proportional(temp_x + delta);
-	if (ratio > 1.0)
-		temp_x /= ratio;
-
-	
-	switch (_active_drive.mode) {
-
-	case MODE_ACKERMAN:
-		/*
-		  with ackerman drive, steering is handled by a separate servo
-		  we drive assigned servos exclusively by the linear.x
-		*/
-		speed[0] = temp_x * dir_x;
-		speed[0] = _convert_mps_to_proportional(speed[0]);
-		if (_abs(speed[0]) > 1.0)
-			speed[0] = 1.0 * dir_x;
-		
-		ROS_DEBUG("ackerman drive mode speed=%6.4f", speed[0]);
-		break;
-
-	case MODE_DIFFERENTIAL:
-		/*
-		  with differential drive, steering is handled by the relative speed of left and right servos
-		  we drive assigned servos by mixing linear.x and angular.z
-		  we compute the delta for left and right components
-		  we use the sign of the angular velocity to determine which is the faster / slower
-		*/
-
-		/* the delta is the angular velocity * half the drive track */
-		
-		if (dir_r > 0) {	// turning right
-			speed[0] = (temp_x + delta) * dir_x;
-			speed[1] = (temp_x - delta) * dir_x;
-		} else {		// turning left
-			speed[0] = (temp_x - delta) * dir_x;
-			speed[1] = (temp_x + delta) * dir_x;
-		}
-
-		ROS_DEBUG("computed differential drive mode speed left=%6.4f right=%6.4f", speed[0], speed[1]);
-
-		/* if any of the results are greater that 1.0, we need to scale all the results down */
-		range = _max (_abs(speed[0]), _abs(speed[1]));
-		
-		ratio = _convert_mps_to_proportional(range);
-		if (ratio > 1.0) {
-			speed[0] /= ratio;
-			speed[1] /= ratio;
-		}
-		ROS_DEBUG("adjusted differential drive mode speed left=%6.4f right=%6.4f", speed[0], speed[1]);
-
-		speed[0] = _convert_mps_to_proportional(speed[0]);
-		speed[1] = _convert_mps_to_proportional(speed[1]);
-
-		ROS_DEBUG("differential drive mode speed left=%6.4f right=%6.4f", speed[0], speed[1]);
-		break;
-
-	case MODE_MECANUM:
-		/*
-		  with mecanum drive, steering is handled by the relative speed of left and right servos
-		  with mecanum drive, lateral motion is handled by the rotation of front and rear servos
-		  we drive assigned servos by mixing linear.x and angular.z  and linear.y
-		*/
-
-		if (dir_r > 0) {	// turning right
-			speed[0] = speed[2] = (temp_x + delta) * dir_x;
-			speed[1] = speed[3] = (temp_x - delta) * dir_x;
-		} else {		// turning left
-			speed[0] = speed[2] = (temp_x - delta) * dir_x;
-			speed[1] = speed[3] = (temp_x + delta) * dir_x;
-		}
-
-		speed[0] += temp_y * dir_y;
-		speed[3] += temp_y * dir_y;
-		speed[1] -= temp_y * dir_y;
-		speed[2] -= temp_y * dir_y;
-		ROS_DEBUG("computed mecanum drive mode speed leftfront=%6.4f rightfront=%6.4f leftrear=%6.4f rightreer=%6.4f", speed[0], speed[1], speed[2], speed[3]);
-
-		range = _max (_max (_max (_abs(speed[0]), _abs(speed[1])), _abs(speed[2])), _abs(speed[3]));
-		ratio = _convert_mps_to_proportional(range);
-		if (ratio > 1.0) {
-			speed[0] /= ratio;
-			speed[1] /= ratio;
-			speed[2] /= ratio;
-			speed[3] /= ratio;
-		}
-		ROS_DEBUG("adjusted mecanum drive mode speed leftfront=%6.4f rightfront=%6.4f leftrear=%6.4f rightreer=%6.4f", speed[0], speed[1], speed[2], speed[3]);
-
-		speed[0] = _convert_mps_to_proportional(speed[0]);
-		speed[1] = _convert_mps_to_proportional(speed[1]);
-		speed[2] = _convert_mps_to_proportional(speed[2]);
-		speed[3] = _convert_mps_to_proportional(speed[3]);
-
-		ROS_DEBUG("mecanum drive mode speed leftfront=%6.4f rightfront=%6.4f leftrear=%6.4f rightreer=%6.4f", speed[0], speed[1], speed[2], speed[3]);
-		break;
+	count = _drive_kinematics (drivep, msg.get(), speed);
 
-	default:
-		break;
+	// with an acceleration the output scheduler ramps each wheel to its new speed rather than stepping to it
+	float rate = _io_config.scheduled ? (drivep->acceleration * drivep->inv_max_rate) : 0.0;
 
-	}
-	
-	/* find all drive servos and set their new speed */
-	for (i=0; i<(_last_servo); i++) {
-		// we use 'fall thru' on the switch statement to allow all necessary servos to be controlled
-		switch (_active_drive.mode) {
-		case MODE_MECANUM:
-			if (_servo_configs[i].mode_pos == POSITION_RIGHTREAR)
-				_set_pwm_interval_proportional (i+1, speed[3]);
-			if (_servo_configs[i].mode_pos == POSITION_LEFTREAR)
-				_set_pwm_interval_proportional (i+1, speed[2]);
-		case MODE_DIFFERENTIAL:
-			if (_servo_configs[i].mode_pos == POSITION_RIGHTFRONT)
-			_set_pwm_interval_proportional (i+1, speed[1]);
-		case MODE_ACKERMAN:
-			if (_servo_configs[i].mode_pos == POSITION_LEFTFRONT)
-				_set_pwm_interval_proportional (i+1, speed[0]);
+	/* set the new speed of the drive servos of each position used by the drive mode */
+	for (position=POSITION_LEFTFRONT; position<=count; position++) {
+		for (i=0; i<configp->drive_count[position]; i++) {
+			if (rate > 0.0)
+				_set_pwm_interval_ramped (configp, configp->drive_servos[position][i], speed[position-1], rate);
+			else
+				_set_pwm_interval_proportional (configp, configp->drive_servos[position][i], speed[position-1]);
 		}
 	}
+	_config_exit (epoch);
+	_trace (I2CPWM_TRACE_CONVERTED, _message_stamp, 0);
+	_io_queue (IO_FLUSH, 0, 0, 0);
+	_stats_time (HIST_DRIVE, _message_stamp);
 }
 
 
@@ -1189,7 +4628,7 @@ bool set_pwm_frequency (i2cpwm_board::IntValue::Request &req, i2cpwm_board::IntV
 		freq = 50;	// most analog RC servos are designed for 20ms pulses.
 		res.error = freq;
 	}
-	_set_pwm_frequency (freq);	// I think we must reset frequency when we change boards
+	_io_queue (IO_FREQUENCY, 0, freq, 0);	// I think we must reset frequency when we change boards
 	res.error = freq;
 	return true;
 }
@@ -1249,14 +4688,28 @@ bool config_servos (i2cpwm_board::ServosConfig::Request &req, i2cpwm_board::Serv
 		return true;
 	}
 
+	// every servo of the request changes in one snapshot so a subscriber never sees half of a recalibration
+	int added = 0;
+	for (i=0;i<req.servos.size();i++) {
+		int servo = req.servos[i].servo;
+		if ((servo >= 1) && (servo <= MAX_SERVOS) && (_servo_slot (servo) < 0))
+			added++;	// only servos without a slot need room in the copy
+	}
+	config_snapshot* configp = _config_edit (added);
+	if (!configp) {
+		res.error = -1;
+		return true;
+	}
+
 	for (i=0;i<req.servos.size();i++) {
 		int servo = req.servos[i].servo;
 		int center = req.servos[i].center;
 		int range = req.servos[i].range;
 		int direction = req.servos[i].direction;
 
-		_config_servo (servo, center, range, direction);
+		_config_servo (configp, servo, center, range, direction);
 	}
+	_config_publish (configp);
 	
 	return true;
 }
@@ -1280,6 +4733,11 @@ bool config_servos (i2cpwm_board::ServosConfig::Request &req, i2cpwm_board::Serv
 
    _A scale factor is available if necessary to compensate for linear vector values._
 
+   An optional acceleration, in m/s², limits how fast each wheel changes speed. With the output scheduler, each Twist
+   sets the target speed of the drive servos and the node ramps them to it on every tick rather than stepping, which
+   avoids current spikes and wheel slip. An acceleration of 0 steps to each new speed. An acceleration is rejected
+   with an error when the output scheduler is not running, eg enable it with the output_scheduler parameter.
+
    The mode string is one of the following drive systems:
     -# 'ackerman' - (automobile steering) requires minimum of one servo for drive and uses some other servo for stearing..
 	-# 'differential' - requires multiples of two servos, designated as left and right.
@@ -1341,62 +4799,308 @@ bool config_drive_mode (i2cpwm_board::DriveMode::Request &req, i2cpwm_board::Dri
 
 	int i;
 
-	if ((res.error = _config_drive_mode (req.mode, req.rpm, req.radius, req.track, req.scale)))
+	// the ramps only advance on the ticks of the output scheduler; without it every wheel would step to its speed
+	if ((req.acceleration > 0.0) && !_io_config.scheduled) {
+		ROS_ERROR("Invalid acceleration %6.4f :: an acceleration requires the output scheduler; set the output_scheduler parameter or drive_config/acceleration", req.acceleration);
+		res.error = -1;
+		return true;
+	}
+
+	int added = 0;
+	for (i=0;i<req.servos.size();i++) {
+		int servo = req.servos[i].servo;
+		if ((servo >= 1) && (servo <= MAX_SERVOS) && (_servo_slot (servo) < 0))
+			added++;	// only servos without a slot need room in the copy
+	}
+	config_snapshot* configp = _config_edit (added);
+	if (!configp) {
+		res.error = -1;
+		return true;
+	}
+
+	if ((res.error = _config_drive_mode (configp, req.mode, req.rpm, req.radius, req.track, req.scale, req.acceleration))) {
+		free (configp);
 		return true;
+	}
 
 	for (i=0;i<req.servos.size();i++) {
 		int servo = req.servos[i].servo;
 		int position = req.servos[i].position;
 
-		if (_config_servo_position (servo, position) != 0) {
+		if (_config_servo_position (configp, servo, position) != 0) {
 			res.error = servo; /* this needs to be more specific and indicate a bad server ID was provided */
 			continue;
 		}
 	}
+	_config_publish (configp);
+
+	return true;
+}
+
+
+
+/**
+   \brief service to stop all servos on all boards
+
+   A service to stop all of the servos on all of the PWM boards and set their power state to off / coast.
+
+   This is different from setting each servo to its center value. A centered servo is still under power and it's in a brake state.
+
+   @param req is empty
+   @param res is empty
+   @returns true
+
+   __Example__
+   \code{.sh}
+   # stop all servos on all boards and setting them to coast rather than brake
+
+   rosservice call /stop_servos
+   \endcode
+
+ */
+bool stop_servos (std_srvs::Empty::Request& req, std_srvs::Empty::Response& res)
+{
+	_io_queue (IO_STOP, 0, 0, 0);
+	return true;
+}
+
+
+/**
+   \brief service to apply the pose staged by the pose_absolute() and pose_proportional() topics
+
+   Every servo of the pose is staged by the I/O thread of its bus with a single command, so the pose is written by one flush
+   of each bus, or one tick of the output scheduler, and never partly applied. Only the channels which differ from the
+   values already written are sent to the boards. The next pose is staged in a second buffer while this one is applied.
+
+   @param req is empty
+   @param res is empty
+   @returns true
+
+   __Example__
+   \code{.sh}
+   rosservice call /commit_pose
+   \endcode
+ */
+bool commit_pose (std_srvs::Empty::Request& req, std_srvs::Empty::Response& res)
+{
+	_message_stamp = _stats_now ();
+	if (_pose_commit ())
+		_stats_count (STAT_POSES, 1);
+	return true;
+}
+
+
+/**
+   \brief service to store a pose in the pose library
+
+   The values are converted to the register images of their boards when the pose is stored, so the pose_recall() topic
+   only copies them. Proportional values use the configuration of each servo at the time the pose is stored.
+   A pose stored again with the same id replaces the previous pose.
+
+   @param req a 'SavePose' request with the pose id (1..32), an optional name, the value type and the servos of the pose
+   @param res returns 0 or the first servo which could not be stored
+   @returns true
+
+   __Example__
+   \code{.sh}
+   rosservice call /save_pose "{id: 3, name: wave, absolute: false, servos: [{servo: 1, value: 0.5}, {servo: 2, value: -0.5}]}"
+   \endcode
+ */
+bool save_pose (i2cpwm_board::SavePose::Request &req, i2cpwm_board::SavePose::Response &res)
+{
+	_message_stamp = _stats_now ();
+	res.error = _pose_store (req.id, req.name.c_str(), req.servos.data(), req.servos.size(), req.absolute);
+	return true;
+}
+
+
+
+
+
+/**
+ * \private method to compute a percentile of a histogram
+ *
+ *@param hp the histogram
+ *@param percent the percentile (0..100)
+ *@returns the upper bound in nanoseconds of the bucket holding the percentile or 0 if the histogram is empty
+ */
+static unsigned long long _stats_percentile (const stats_histogram* hp, int percent)
+{
+	unsigned long long total = 0, running = 0;
+	int i;
+
+	for (i=0; i<STATS_BUCKETS; i++)
+		total += hp->count[i];
+	if (!total)
+		return 0;
+
+	for (i=0; i<STATS_BUCKETS; i++) {
+		running += hp->count[i];
+		if ((running * 100) >= (total * percent))
+			break;
+	}
+	return (i < STATS_BUCKETS-1) ? (1ULL << i) : hp->max;
+}
+
+
+/**
+ * \private method to add a key value pair to a diagnostic status
+ */
+static void _diagnostics_add (diagnostic_msgs::DiagnosticStatus& status, const char* key, const char* format, unsigned long long value)
+{
+	char text[32];
+	diagnostic_msgs::KeyValue kv;
 
-	return true;
+	snprintf (text, sizeof(text), format, value);
+	kv.key = key;
+	kv.value = text;
+	status.values.push_back (kv);
 }
 
 
-
 /**
-   \brief service to stop all servos on all boards
+ * \private method to publish the bus and callback statistics
+ *
+ *The per-thread statistics are summed when they are published; the hot path only updates its own thread's counters.
+ *Histograms are reported as median, 99th percentile and maximum in microseconds.
+ */
+static void _publish_diagnostics (const ros::WallTimerEvent& event)
+{
+	static const char* counter_names[STAT_COUNTERS] = {
+		"i2c writes", "i2c write errors", "i2c bytes written", "i2c address switches", "frames",
+		"servos_absolute messages", "servos_proportional messages", "servos_drive messages", "i2c combined transfers",
+		"i2c mux channel switches", "servos_motion messages", "servos_frame messages",
+		"verify reads", "verify errors", "verify mismatches", "board resets", "pose commits", "pose recalls",
+		"deadline misses" };
+	static const char* histogram_names[STAT_HISTOGRAMS] = {
+		"i2c write", "i2c address switch", "servos_absolute callback", "servos_proportional callback", "servos_drive callback", "callback to bus", "servos_frame callback" };
+	static unsigned long long last_errors = 0;
+	static unsigned long long last_resets = 0;
+
+	unsigned long long counters[STAT_COUNTERS];
+	stats_histogram histograms[STAT_HISTOGRAMS];
+	int i, j, k;
+	char key[64];
+
+	memset (counters, 0, sizeof(counters));
+	memset (histograms, 0, sizeof(histograms));
+
+	for (i=0; i<STATS_THREADS; i++) {
+		for (j=0; j<STAT_COUNTERS; j++)
+			counters[j] += __atomic_load_n (&(_stats[i].counters[j]), __ATOMIC_RELAXED);
+		for (j=0; j<STAT_HISTOGRAMS; j++) {
+			for (k=0; k<STATS_BUCKETS; k++)
+				histograms[j].count[k] += __atomic_load_n (&(_stats[i].histograms[j].count[k]), __ATOMIC_RELAXED);
+			unsigned long long max = __atomic_load_n (&(_stats[i].histograms[j].max), __ATOMIC_RELAXED);
+			if (max > histograms[j].max)
+				histograms[j].max = max;
+		}
+	}
 
-   A service to stop all of the servos on all of the PWM boards and set their power state to off / coast.
+	diagnostic_msgs::DiagnosticArray msg;
+	diagnostic_msgs::DiagnosticStatus status;
 
-   This is different from setting each servo to its center value. A centered servo is still under power and it's in a brake state.
+	status.name = "i2cpwm_board: I2C bus";
+	status.hardware_id = "PCA9685";
+	if (counters[STAT_WRITE_ERRORS] > last_errors) {
+		status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+		status.message = "I2C write errors";
+	}
+	else if (counters[STAT_BOARD_RESETS] > last_resets) {
+		status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+		status.message = "PWM board reset";
+	}
+	else {
+		status.level = diagnostic_msgs::DiagnosticStatus::OK;
+		status.message = "OK";
+	}
+	last_errors = counters[STAT_WRITE_ERRORS];
+	last_resets = counters[STAT_BOARD_RESETS];
+
+	diagnostic_msgs::KeyValue transport;
+	transport.key = "i2c transport";
+	transport.value = _transport_names[_transport];
+	status.values.push_back (transport);
+	_diagnostics_add (status, "i2c burst bytes", "%llu", _transport_burst_bytes ());
+	for (j=0; j<STAT_COUNTERS; j++)
+		_diagnostics_add (status, counter_names[j], "%llu", counters[j]);
+
+	for (j=0; j<STAT_HISTOGRAMS; j++) {
+		snprintf (key, sizeof(key), "%s p50 (usec)", histogram_names[j]);
+		_diagnostics_add (status, key, "%llu", _stats_percentile (&(histograms[j]), 50) / 1000);
+		snprintf (key, sizeof(key), "%s p99 (usec)", histogram_names[j]);
+		_diagnostics_add (status, key, "%llu", _stats_percentile (&(histograms[j]), 99) / 1000);
+		snprintf (key, sizeof(key), "%s max (usec)", histogram_names[j]);
+		_diagnostics_add (status, key, "%llu", histograms[j].max / 1000);
+	}
 
-   @param req is empty
-   @param res is empty
-   @returns true
+	if (_io_config.scheduled) {
+		unsigned long long ticks = 0, overruns = 0, late_max = 0;
+		for (j=0; j<_bus_count; j++) {
+			const io_worker* wp = &(_buses[j].worker);
+			ticks += __atomic_load_n (&(wp->ticks), __ATOMIC_RELAXED);
+			overruns += __atomic_load_n (&(wp->overruns), __ATOMIC_RELAXED);
+			long late = __atomic_load_n (&(wp->late_max), __ATOMIC_RELAXED);
+			if ((unsigned long long)late > late_max)
+				late_max = late;
+		}
+		_diagnostics_add (status, "scheduler ticks", "%llu", ticks);
+		_diagnostics_add (status, "scheduler overruns", "%llu", overruns);
+		_diagnostics_add (status, "scheduler max lateness (usec)", "%llu", late_max / 1000);
+	}
 
-   __Example__
-   \code{.sh}
-   # stop all servos on all boards and setting them to coast rather than brake
+	msg.header.stamp = ros::Time::now();
+	msg.status.push_back (status);
+	_diagnostics_pub.publish (msg);
+}
 
-   rosservice call /stop_servos
-   \endcode
 
+/**
+ * \private method to publish the pulse values last written to the servos when any of them has changed
+ *
+ *The values are read from the shadow of each board, so the topic reports what the boards were sent rather than what
+ *was commanded. Nothing is read while the topic has no subscribers and a new subscriber gets the current values.
+ *Each value is the pulse width (0..4096) the same as the servos_absolute() topic.
  */
-bool stop_servos (std_srvs::Empty::Request& req, std_srvs::Empty::Response& res)
+static void _publish_state (const ros::WallTimerEvent& event)
 {
-	int save_active = _active_board;
-	int i;
+	int subscribers = _state_pub.getNumSubscribers ();
+	int changed = (subscribers > _state_subscribers);
+	int board, channel;
 
-	for (i=0; i<MAX_BOARDS; i++) {
-		if (_pwm_boards[i] > 0) {
-			_set_active_board (i+1);	// API is ONE based
-			_set_pwm_interval_all (0, 0);
+	_state_subscribers = subscribers;
+	if (!subscribers)
+		return;
+
+	for (board=0; board<MAX_BOARDS; board++) {
+		if (__atomic_load_n (&(_pwm_frames[board].seq), __ATOMIC_ACQUIRE) != _state_seq[board])
+			changed = 1;
+	}
+	if (!changed)
+		return;
+
+	_state_msg.servos.clear ();
+	for (board=0; board<MAX_BOARDS; board++) {
+		unsigned char shadow[4*16];
+		unsigned int known;
+
+		_state_seq[board] = _shadow_read (&(_pwm_frames[board]), shadow, &known);
+		for (; known; known &= (known - 1)) {
+			channel = __builtin_ctz (known);
+			int start = shadow[4*channel] | (shadow[(4*channel)+1] << 8);
+			int end = shadow[(4*channel)+2] | (shadow[(4*channel)+3] << 8);
+			i2cpwm_board::Servo servo;
+
+			servo.servo = (board * 16) + channel + 1;
+			servo.value = start ? ((end - start) & 0xFFF) : end;
+			_state_msg.servos.push_back (servo);
 		}
 	}
-	_set_active_board (save_active);	// restore last active board
-	return true;
+	_state_pub.publish (_state_msg);
 }
 
 
 
-
-
 static std::string _get_string_param (XmlRpc::XmlRpcValue obj, std::string param_name)
 {
 	XmlRpc::XmlRpcValue &item = obj[param_name];
@@ -1430,21 +5134,149 @@ static double _get_float_param (XmlRpc::XmlRpcValue obj, std::string param_name)
 }
 
 	
-static int _load_params (void)
+static double _get_number_param (XmlRpc::XmlRpcValue obj, std::string param_name)
+{
+	XmlRpc::XmlRpcValue &item = obj[param_name];
+	if (item.getType() == XmlRpc::XmlRpcValue::TypeInt)
+		return (int)item;
+	if (item.getType() == XmlRpc::XmlRpcValue::TypeDouble)
+		return item;
+
+	ROS_WARN("invalid paramter type for %s - expected TypeInt or TypeDouble", param_name.c_str());
+	return 0;
+}
+
+	
+static int _load_params (ros::NodeHandle& nhp)	// not currently private namespace
 {		
-	ros::NodeHandle nhp;					// not currently private namespace
 
 	// default I2C device on RPi2 and RPi3 = "/dev/i2c-1" Orange Pi Lite = "/dev/i2c-0"
 	nhp.param ("i2c_device_number", _controller_io_device, 1);
-	std::stringstream device;
-	device << "/dev/i2c-" << _controller_io_device;
-	_init (device.str().c_str());
 
-	_set_active_board (1);
+	// the sim and faulty backends model the boards in memory for testing without hardware
+	std::string backend;
+	nhp.param ("i2c_backend", backend, std::string ("linux"));
+	if (NULL == (_bus = i2c_backend_find (backend.c_str()))) {
+		ROS_WARN ("Invalid i2c_backend '%s' :: backends are 'linux', 'sim' and 'faulty' :: using 'linux'", backend.c_str());
+		_bus = &i2c_backend_linux;
+	}
+	_init ();
+
+	/*
+	  // note: boards are numbered sequentially across the buses in the order they are listed
+
+	  i2c_buses:
+	  	- {device: 1, boards: 4}
+		- {device: 0, boards: 2, address: 0x41}
+		- {device: 0, boards: 2, mux: 0x71, channel: 3}		// behind channel 3 of a TCA9548A; the same device is one bus
+
+	*/
+	// attempt to load the I2C buses; without them all boards are on the single bus of i2c_device_number
+	if (nhp.hasParam ("i2c_buses")) {
+		XmlRpc::XmlRpcValue buses;
+		nhp.getParam ("i2c_buses", buses);
+
+		if (buses.getType() == XmlRpc::XmlRpcValue::TypeArray) {
+			for (int32_t i = 0; i < buses.size(); i++) {
+				XmlRpc::XmlRpcValue bus = buses[i];
+				if (bus.getType() != XmlRpc::XmlRpcValue::TypeStruct) {
+					ROS_WARN("Invalid type %d for member of 'i2c_buses' - expected TypeStruct(%d)", bus.getType(), XmlRpc::XmlRpcValue::TypeStruct);
+					continue;
+				}
+				int number = _get_int_param (bus, "device");
+				int boards = _get_int_param (bus, "boards");
+				int address = bus.hasMember ("address") ? _get_int_param (bus, "address") : _BASE_ADDR;
+				int mux = bus.hasMember ("mux") ? _get_int_param (bus, "mux") : 0;
+				int channel = bus.hasMember ("channel") ? _get_int_param (bus, "channel") : 0;
+
+				std::stringstream device;
+				device << "/dev/i2c-" << number;
+				if (0 > _bus_open (device.str().c_str(), number, boards, address, mux, channel))
+					return -1;
+			}
+		}
+		else
+			ROS_WARN("Parameter i2c_buses is type %d - expected TypeArray(%d)", buses.getType(), XmlRpc::XmlRpcValue::TypeArray);
+	}
+	if (!_bus_count) {
+		std::stringstream device;
+		device << "/dev/i2c-" << _controller_io_device;
+		if (0 > _bus_open (device.str().c_str(), _controller_io_device, MAX_BOARDS, _BASE_ADDR, 0, 0))
+			return -1;
+	}
+
+	// the rdwr transport sends the block writes of all boards of a frame with one syscall; auto picks the fastest the adapters support
+	std::string transport;
+	nhp.param ("i2c_burst_max", _burst_max, 0);
+	if ((_burst_max != 0) && ((_burst_max < 4) || (_burst_max > (4*MAX_RDWR_CHANNELS)))) {
+		ROS_WARN ("Invalid i2c_burst_max %d :: bursts must be between 4 and %d bytes :: using the limit of the transport", _burst_max, 4*MAX_RDWR_CHANNELS);
+		_burst_max = 0;
+	}
+	nhp.param ("i2c_transport", transport, std::string ("auto"));
+	if (0 > i2cpwm_controller_transport (transport.c_str()))
+		ROS_WARN ("Invalid i2c_transport '%s' :: transports are 'auto', 'rdwr', 'smbus', 'word' and 'byte' :: using 'smbus'", transport.c_str());
+
+	// the ALLCALL address reaches every PCA9685 on the bus; any other address is programmed into SUBADR1 of each board this node uses
+	nhp.param ("broadcast_address", _broadcast_address, _ALLCALL_ADDR);
+	_mode1 = __ALLCALL | __AUTO_INCREMENT;
+	if (_broadcast_address && (_broadcast_address != _ALLCALL_ADDR))
+		_mode1 |= __SUB1;
 
 	int pwm;
 	nhp.param ("pwm_frequency", pwm, 50);
-	_set_pwm_frequency (pwm);
+
+	// the first board and the boards of configured servos are brought up together once the servo configuration is known
+	int needed[MAX_BOARDS];
+	memset (needed, 0, sizeof(needed));
+	needed[0] = 1;
+
+	// spread the pulses of each board across the PWM period to reduce the peak current draw
+	nhp.param ("phase_stagger", _phase_stagger, false);
+
+	nhp.param ("diagnostics_rate", _diagnostics_rate, 1.0);
+	nhp.param ("state_rate", _state_rate, 0.0);
+
+	// optional thread which owns the I2C bus so callbacks do not wait for I2C transactions
+	nhp.param ("io_thread", _io_config.enabled, false);
+	nhp.param ("io_thread_priority", _io_config.priority, 0);	// 1..99 for SCHED_FIFO
+	nhp.param ("io_thread_cpu", _io_config.cpu, -1);
+	if ((_bus_count > 1) && !_io_config.enabled) {
+		ROS_INFO ("Multiple I2C buses are written in parallel by an I/O thread for each bus :: the I/O thread has been enabled");
+		_io_config.enabled = true;
+	}
+
+	// optional latest-value-wins handling of servo values; this requires the I/O thread
+	nhp.param ("conflate_commands", _io_config.conflate, false);
+	if (_io_config.conflate && !_io_config.enabled) {
+		ROS_INFO ("Parameter conflate_commands requires the I/O thread :: the I/O thread has been enabled");
+		_io_config.enabled = true;
+	}
+
+	// optional fixed rate output; the default rate of 0 follows the PWM frequency, eg one write per 20ms at 50Hz
+	nhp.param ("output_scheduler", _io_config.scheduled, false);
+	nhp.param ("output_rate", _io_config.rate, 0);
+	if (_io_config.scheduled && !_io_config.enabled) {
+		ROS_INFO ("Parameter output_scheduler requires the I/O thread :: the I/O thread has been enabled");
+		_io_config.enabled = true;
+	}
+
+	// optional background check of the boards for resets, eg a brown out, in idle bus time; this requires the I/O thread
+	nhp.param ("verify_rate", _verify_rate, 0);
+	if ((_verify_rate > 0) && !_io_config.enabled) {
+		ROS_INFO ("Parameter verify_rate requires the I/O thread :: the I/O thread has been enabled");
+		_io_config.enabled = true;
+	}
+
+	// optional locked memory, prefaulted stacks and pooled messages; applied once the controller has been initialized
+	nhp.param ("realtime", _realtime, false);
+
+	// optional in-node motion profiles; each motion advances on the ticks of the output scheduler
+	nhp.param ("motion_profiles", _motion_profiles, false);
+	if (_motion_profiles && !_io_config.scheduled) {
+		ROS_INFO ("Parameter motion_profiles requires the output scheduler :: the output scheduler and I/O thread have been enabled");
+		_io_config.scheduled = true;
+		_io_config.enabled = true;
+	}
 
 	
 	/*
@@ -1460,7 +5292,8 @@ static int _load_params (void)
 		XmlRpc::XmlRpcValue servos;
 		nhp.getParam ("servo_config", servos);
 
-		if(servos.getType() == XmlRpc::XmlRpcValue::TypeArray) {
+		config_snapshot* configp;
+		if((servos.getType() == XmlRpc::XmlRpcValue::TypeArray) && (configp = _config_edit (servos.size()))) {
 			ROS_DEBUG("Retrieving members from 'servo_config' in namespace(%s)", nhp.getNamespace().c_str());
 				
 			for(int32_t i = 0; i < servos.size(); i++) {
@@ -1478,10 +5311,18 @@ static int _load_params (void)
 					
 					if (id && center && direction && range) {
 						if ((id >= 1) && (id <= MAX_SERVOS)) {
-							int board = ((int)(id / 16)) + 1;
-							_set_active_board (board);
-							_set_pwm_frequency (pwm);
-							_config_servo (id, center, range, direction);
+							needed[(id-1) / 16] = 1;
+							_config_servo (configp, id, center, range, direction);
+
+							// the optional pulse start offset overrides the phase stagger default
+							if (servo.hasMember ("offset")) {
+								int offset = _get_int_param (servo, "offset");
+								int slot = _servo_slot (id);
+								if ((offset >= 0) && (offset < 4096) && (slot >= 0))
+									configp->offset[slot] = offset;
+								else
+									ROS_WARN("Parameter offset=%d for servo=%d is out of bounds :: offsets must be between 0 and 4095", offset, id);
+							}
 						}
 						else
 							ROS_WARN("Parameter servo=%d is out of bounds", id);
@@ -1492,16 +5333,130 @@ static int _load_params (void)
 				else
 					ROS_WARN("Invalid type %d for member of 'servo_config' - expected TypeStruct(%d)", servo.getType(), XmlRpc::XmlRpcValue::TypeStruct);
 			}
+			_config_publish (configp);
 		}
-		else
+		else if (servos.getType() != XmlRpc::XmlRpcValue::TypeArray)
 			ROS_WARN("Invalid type %d for 'servo_config' - expected TypeArray(%d)", servos.getType(), XmlRpc::XmlRpcValue::TypeArray);
 	}
 	else
 		ROS_DEBUG("Parameter Server namespace[%s] does not contain 'servo_config", nhp.getNamespace().c_str());
 
-	return 0;
+
+	/*
+	  // note: proportional poses use the servo_config above so they are loaded after it
+
+	  poses:
+	  	- {id: 1, name: park, absolute: false, servos: [{servo: 1, value: 0.0}, {servo: 2, value: -0.5}]}
+		- {id: 2, name: open, absolute: true, servos: [{servo: 17, value: 410}]}
+
+	*/
+	// attempt to load the pose library
+	if(nhp.hasParam ("poses")) {
+		XmlRpc::XmlRpcValue poses;
+		nhp.getParam ("poses", poses);
+
+		if(poses.getType() == XmlRpc::XmlRpcValue::TypeArray) {
+			ROS_DEBUG("Retrieving members from 'poses' in namespace(%s)", nhp.getNamespace().c_str());
+
+			for(int32_t i = 0; i < poses.size(); i++) {
+				XmlRpc::XmlRpcValue pose;
+				pose = poses[i];	// get the data from the iterator
+				if((pose.getType() == XmlRpc::XmlRpcValue::TypeStruct) && pose.hasMember ("servos") && (pose["servos"].getType() == XmlRpc::XmlRpcValue::TypeArray)) {
+					int id = _get_int_param (pose, "id");
+					std::string name = pose.hasMember ("name") ? _get_string_param (pose, "name") : std::string("");
+					bool absolute = pose.hasMember ("absolute") ? (bool)pose["absolute"] : false;
+					XmlRpc::XmlRpcValue& members = pose["servos"];
+					std::vector<i2cpwm_board::Servo> servos;
+
+					for(int32_t j = 0; j < members.size(); j++) {
+						i2cpwm_board::Servo servo;
+						if(members[j].getType() != XmlRpc::XmlRpcValue::TypeStruct) {
+							ROS_WARN("Invalid type %d for servo of pose=%d - expected TypeStruct(%d)", members[j].getType(), id, XmlRpc::XmlRpcValue::TypeStruct);
+							continue;
+						}
+						servo.servo = _get_int_param (members[j], "servo");
+						servo.value = _get_number_param (members[j], "value");
+						servos.push_back (servo);
+						if ((servo.servo >= 1) && (servo.servo <= MAX_SERVOS))
+							needed[(servo.servo-1) / 16] = 1;
+					}
+					if (servos.empty() || _pose_store (id, name.c_str(), servos.data(), servos.size(), absolute))
+						ROS_WARN("Invalid parameters for pose=%d'", id);
+				}
+				else
+					ROS_WARN("Invalid type %d for member of 'poses' - expected TypeStruct(%d) with a 'servos' array", pose.getType(), XmlRpc::XmlRpcValue::TypeStruct);
+			}
+		}
+		else
+			ROS_WARN("Invalid type %d for 'poses' - expected TypeArray(%d)", poses.getType(), XmlRpc::XmlRpcValue::TypeArray);
+	}
+	else
+		ROS_DEBUG("Parameter Server namespace[%s] does not contain 'poses", nhp.getNamespace().c_str());
 
 
+	/*
+	  // note: a pose fail-safe uses the pose library above so deadlines are loaded after it
+
+	  deadlines:
+	  	- {topic: servos_drive, timeout: 250, failsafe: coast}
+		- {topic: servos_proportional, timeout: 500, failsafe: pose, pose: 1}
+
+	*/
+	// attempt to load the topic deadlines
+	if(nhp.hasParam ("deadlines")) {
+		XmlRpc::XmlRpcValue deadlines;
+		nhp.getParam ("deadlines", deadlines);
+
+		if(deadlines.getType() == XmlRpc::XmlRpcValue::TypeArray) {
+			ROS_DEBUG("Retrieving members from 'deadlines' in namespace(%s)", nhp.getNamespace().c_str());
+
+			for(int32_t i = 0; i < deadlines.size(); i++) {
+				XmlRpc::XmlRpcValue deadline;
+				deadline = deadlines[i];	// get the data from the iterator
+				if(deadline.getType() != XmlRpc::XmlRpcValue::TypeStruct) {
+					ROS_WARN("Invalid type %d for member of 'deadlines' - expected TypeStruct(%d)", deadline.getType(), XmlRpc::XmlRpcValue::TypeStruct);
+					continue;
+				}
+
+				std::string topic = _get_string_param (deadline, "topic");
+				std::string failsafe = deadline.hasMember ("failsafe") ? _get_string_param (deadline, "failsafe") : std::string("coast");
+				int timeout = _get_int_param (deadline, "timeout");
+				int pose = deadline.hasMember ("pose") ? _get_int_param (deadline, "pose") : 0;
+				int t, action;
+
+				for (t=0; t<DEADLINE_TOPICS; t++) {
+					if (topic == _deadlines[t].topic)
+						break;
+				}
+				for (action=FAILSAFE_COAST; action<=FAILSAFE_POSE; action++) {
+					if (failsafe == _failsafe_names[action])
+						break;
+				}
+
+				if (t == DEADLINE_TOPICS)
+					ROS_WARN("Parameter topic=%s of 'deadlines' is not a servo topic", topic.c_str());
+				else if (timeout <= 0)
+					ROS_WARN("Parameter timeout=%d for topic=%s is out of bounds :: the timeout must be greater than 0 msec", timeout, topic.c_str());
+				else if (action > FAILSAFE_POSE)
+					ROS_WARN("Parameter failsafe=%s for topic=%s is not 'coast', 'hold' or 'pose'", failsafe.c_str(), topic.c_str());
+				else if ((action == FAILSAFE_POSE) && ((pose < 1) || (pose > MAX_POSES) || !_stored_poses[pose-1].servos))
+					ROS_WARN("Parameter pose=%d for topic=%s is not a pose of the pose library", pose, topic.c_str());
+				else {
+					if (!_deadlines[t].timeout)
+						_deadline_count++;
+					_deadlines[t].timeout = timeout * 1000000LL;
+					_deadlines[t].failsafe = action;
+					_deadlines[t].pose = pose;
+					ROS_INFO("Deadline of %s configured: timeout=%d msec, failsafe=%s", topic.c_str(), timeout, failsafe.c_str());
+				}
+			}
+		}
+		else
+			ROS_WARN("Invalid type %d for 'deadlines' - expected TypeArray(%d)", deadlines.getType(), XmlRpc::XmlRpcValue::TypeArray);
+	}
+	else
+		ROS_DEBUG("Parameter Server namespace[%s] does not contain 'deadlines", nhp.getNamespace().c_str());
+
 	/*
 	  drive_config:
 	  	mode: mecanum
@@ -1509,6 +5464,7 @@ static int _load_params (void)
 		rpm: 60.0
 		scale: 0.3
 		track: 0.2
+		acceleration: 0.5
 		servos:
 			- {servo: 1, position: 1}
 			- {servo: 2, position: 2}
@@ -1526,7 +5482,7 @@ static int _load_params (void)
 
 			// get the drive mode settings
 			std::string mode;
-			float radius, rpm, scale, track;
+			float radius, rpm, scale, track, acceleration;
 			int id, position;
 
 			mode = _get_string_param (drive, "mode");
@@ -1534,10 +5490,14 @@ static int _load_params (void)
 			radius = _get_float_param (drive, "radius");
 			track = _get_float_param (drive, "track");
 			scale = _get_float_param (drive, "scale");
-
-			_config_drive_mode (mode, rpm, radius, track, scale);
+			acceleration = drive.hasMember ("acceleration") ? _get_float_param (drive, "acceleration") : 0.0;
 
 			XmlRpc::XmlRpcValue &servos = drive["servos"];
+			config_snapshot* configp = _config_edit ((servos.getType() == XmlRpc::XmlRpcValue::TypeArray) ? servos.size() : 0);
+			if (!configp)
+				return -1;
+			_config_drive_mode (configp, mode, rpm, radius, track, scale, acceleration);
+
 			if(servos.getType() == XmlRpc::XmlRpcValue::TypeArray) {
 				ROS_DEBUG("Retrieving members from 'drive_config/servos' in namespace(%s)", nhp.getNamespace().c_str());
 				
@@ -1553,7 +5513,7 @@ static int _load_params (void)
 						position = _get_int_param (servo, "position");
 					
 						if (id && position)
-							_config_servo_position (id, position); // had its own error reporting
+							_config_servo_position (configp, id, position); // had its own error reporting
 					}
 					else
 						ROS_WARN("Invalid type %d for member %d of 'drive_config/servos' - expected TypeStruct(%d)", i, servo.getType(), XmlRpc::XmlRpcValue::TypeStruct);
@@ -1561,49 +5521,362 @@ static int _load_params (void)
 			}
 			else
 				ROS_WARN("Invalid type %d for 'drive_config/servos' - expected TypeArray(%d)", servos.getType(), XmlRpc::XmlRpcValue::TypeArray);
+			_config_publish (configp);
 		}
 		else
 			ROS_WARN("Invalid type %d for 'drive_config' - expected TypeStruct(%d)", drive.getType(), XmlRpc::XmlRpcValue::TypeStruct);
 	}
 	else
 		ROS_DEBUG("Parameter Server namespace[%s] does not contain 'drive_config", nhp.getNamespace().c_str());
+
+
+	// the deadlines are checked on the ticks of the output scheduler
+	if (_deadline_count && !_io_config.scheduled) {
+		ROS_INFO ("Parameter deadlines requires the output scheduler :: the output scheduler and I/O thread have been enabled");
+		_io_config.scheduled = true;
+		_io_config.enabled = true;
+	}
+
+	// the drive acceleration is ramped on the ticks of the output scheduler
+	if ((_config->drive.acceleration > 0.0) && !_io_config.scheduled) {
+		ROS_INFO ("Parameter drive_config/acceleration requires the output scheduler :: the output scheduler and I/O thread have been enabled");
+		_io_config.scheduled = true;
+		_io_config.enabled = true;
+	}
+
+	_boards_start (needed, pwm);
+	_set_active_board (1);
+	return 0;
 }	
 
 
 // ------------------------------------------------------------------------------------------------------------------------------------
 /**@}*/
-// main
+// controller
 // ------------------------------------------------------------------------------------------------------------------------------------
 
-int main (int argc, char **argv)
+// the topics, services and timer of the running controller
+#define MESSAGE_POOL_SIZE 4         // reused messages of each type; a TCPROS message is only deserialized when its callback is called
+#define PROFILE_NAME_SIZE 16        // room for the motion profile of a pooled message; the longest name is 'trapezoidal'
+
+/// messages of one type reused by the subscribers of the realtime mode
+template <class M> struct message_pool {
+	static boost::shared_ptr<M> messages[MESSAGE_POOL_SIZE];
+};
+template <class M> boost::shared_ptr<M> message_pool<M>::messages[MESSAGE_POOL_SIZE];
+
+
+/**
+ * \private methods to reserve room for every servo in a pooled message so deserializing it never grows its arrays
+ */
+static void _pool_reserve (i2cpwm_board::ServoArray& msg)
+{
+	msg.servos.reserve (MAX_SERVOS);
+}
+
+static void _pool_reserve (i2cpwm_board::ServoFrame& msg)
+{
+	msg.counts.reserve (MAX_SERVOS);
+	msg.values.reserve (MAX_SERVOS);
+}
+
+static void _pool_reserve (i2cpwm_board::ServoMotion& msg)
+{
+	msg.servos.reserve (MAX_SERVOS);
+	msg.profile.reserve (PROFILE_NAME_SIZE);
+}
+
+static void _pool_reserve (i2cpwm_board::PoseRecall& msg)
+{
+	msg.profile.reserve (PROFILE_NAME_SIZE);
+}
+
+static void _pool_reserve (geometry_msgs::Twist&)
+{
+}
+
+
+/**
+ * \private method to give the deserializer of a subscriber a message from the pool
+ *
+ *A pooled message is free once the pool holds its only reference, ie the previous callback has returned.
+ *Every field is overwritten by the deserializer. A new message is only allocated when every pooled message is in use.
+ *Only the ROS spin thread may call this method.
+ *@returns the message
+ */
+template <class M> static boost::shared_ptr<M> _pool_create (void)
+{
+	int i;
+
+	for (i=0; i<MESSAGE_POOL_SIZE; i++) {
+		if (message_pool<M>::messages[i].use_count() == 1)
+			return message_pool<M>::messages[i];
+	}
+	return boost::make_shared<M> ();
+}
+
+
+/**
+ * \private method to set the options of a topic subscriber; in the realtime mode its messages are deserialized into the pool of their type
+ */
+template <class M> static void _subscribe_options (ros::SubscribeOptions& ops, const char* topic, int queue, void (*callback) (const boost::shared_ptr<M const>&))
+{
+	int i;
+
+	if (!_realtime) {
+		ops.init<M> (topic, queue, callback);
+		return;
+	}
+
+	for (i=0; i<MESSAGE_POOL_SIZE; i++) {
+		if (!message_pool<M>::messages[i]) {
+			message_pool<M>::messages[i] = boost::make_shared<M> ();
+			_pool_reserve (*(message_pool<M>::messages[i]));
+		}
+	}
+	ops.init<M> (topic, queue, callback, _pool_create<M>);
+}
+
+
+/**
+ * \private method to subscribe to a topic with the options of i2cpwm_controller_subscribe_options()
+ *
+ *@returns the subscriber
+ */
+static ros::Subscriber _subscribe (ros::NodeHandle& n, const char* topic)
+{
+	ros::SubscribeOptions ops;
+
+	i2cpwm_controller_subscribe_options (topic, ops);
+	return n.subscribe (ops);
+}
+
+
+static ros::ServiceServer _freq_srv, _config_srv, _mode_srv, _stop_srv, _commit_srv, _save_srv;
+static ros::Subscriber _abs_sub, _rel_sub, _frame_sub, _drive_sub, _motion_sub, _pose_abs_sub, _pose_rel_sub, _recall_sub;
+static ros::WallTimer _diagnostics_timer, _state_timer;
+
+
+int i2cpwm_controller_start (ros::NodeHandle& n)
 {
 	// globals
 	_controller_io_device = 1;	// default I2C device on RPi2 and RPi3 = "/dev/i2c-1" Orange Pi Lite = "/dev/i2c-0"
-	_controller_io_handle = 0;
 	_pwm_frequency = 50;		// set the initial pulse frequency to 50 Hz which is standard for RC servos
 
+	if (0 > _load_params (n)) {	// loads parameters and performs initialization
+		i2cpwm_controller_stop ();	// closes any bus opened before the error
+		return -1;
+	}
+
+	_freq_srv =		n.advertiseService 	("set_pwm_frequency", 			set_pwm_frequency);
+	_config_srv =	n.advertiseService 	("config_servos", 				config_servos);			// 'config' will setup the necessary properties of continuous servos and is helpful for standard servos
+	_mode_srv =		n.advertiseService 	("config_drive_mode",			config_drive_mode);		// 'mode' specifies which servos are used for motion and which behavior will be applied when driving
+	_stop_srv =		n.advertiseService 	("stop_servos", 				stop_servos);			// the 'stop' service can be used at any time
+	_commit_srv =	n.advertiseService 	("commit_pose", 				commit_pose);			// 'commit' applies the servos staged by the pose topics all at once
+	_save_srv =		n.advertiseService 	("save_pose", 					save_pose);				// 'save' stores a pose in the pose library for pose_recall
+
+	_abs_sub = 		_subscribe 			(n, "servos_absolute");			// the 'absolute' topic will be used for standard servo motion and testing of continuous servos
+	_rel_sub = 		_subscribe 			(n, "servos_proportional");		// the 'proportion' topic will be used for standard servos and continuous rotation aka drive servos
+	_frame_sub = 	_subscribe 			(n, "servos_frame");			// the 'frame' topic sets many consecutive servos with dense arrays of absolute or proportional values
+	_drive_sub = 	_subscribe 			(n, "servos_drive");			// the 'drive' topic will be used for continuous rotation aka drive servos controlled by Twist messages
+	_pose_abs_sub = _subscribe 			(n, "pose_absolute");			// the 'pose' topics stage values which are written together by commit_pose
+	_pose_rel_sub = _subscribe 			(n, "pose_proportional");
+	_recall_sub = 	_subscribe 			(n, "pose_recall");				// the 'recall' topic moves to a pose of the pose library with one message
+	if (_motion_profiles)
+		_motion_sub = _subscribe 		(n, "servos_motion");			// the 'motion' topic moves standard servos along motion profiles computed by the node
 	
+	if (_realtime)
+		_realtime_start ();	// after the subscribers so their pools are locked too; before the I/O threads so their stacks are
+	if (_io_config.enabled && (0 > _io_start ())) {	// each I/O thread owns its I2C bus from here on
+		i2cpwm_controller_stop ();
+		return -1;
+	}
 
-	ros::init (argc, argv, "i2cpwm_controller");
+	if (_diagnostics_rate > 0.0) {
+		_diagnostics_pub = 		n.advertise<diagnostic_msgs::DiagnosticArray> ("diagnostics", 10);		// bus and callback statistics
+		_diagnostics_timer = 	n.createWallTimer	(ros::WallDuration (1.0 / _diagnostics_rate), _publish_diagnostics);
+	}
+	if (_state_rate > 0.0) {
+		_state_msg.servos.reserve (MAX_SERVOS);
+		memset (_state_seq, 0, sizeof(_state_seq));
+		_state_subscribers = 0;
+		_state_pub = 			n.advertise<i2cpwm_board::ServoArray> ("servos_state", 1);				// the pulse values last written to the servos
+		_state_timer = 			n.createWallTimer	(ros::WallDuration (1.0 / _state_rate), _publish_state);
+	}
+	return 0;
+}
 
-	ros::NodeHandle n;
 
-	ros::ServiceServer freq_srv =		n.advertiseService 	("set_pwm_frequency", 			set_pwm_frequency);
-	ros::ServiceServer config_srv =		n.advertiseService 	("config_servos", 				config_servos);			// 'config' will setup the necessary properties of continuous servos and is helpful for standard servos
-	ros::ServiceServer mode_srv =		n.advertiseService 	("config_drive_mode",			config_drive_mode);		// 'mode' specifies which servos are used for motion and which behavior will be applied when driving
-	ros::ServiceServer stop_srv =		n.advertiseService 	("stop_servos", 				stop_servos);			// the 'stop' service can be used at any time
+void i2cpwm_controller_stop (void)
+{
+	// no callback may queue commands once the I/O threads have exited
+	_abs_sub.shutdown ();
+	_rel_sub.shutdown ();
+	_frame_sub.shutdown ();
+	_drive_sub.shutdown ();
+	_motion_sub.shutdown ();
+	_pose_abs_sub.shutdown ();
+	_pose_rel_sub.shutdown ();
+	_recall_sub.shutdown ();
+	_commit_srv.shutdown ();
+	_save_srv.shutdown ();
+	_freq_srv.shutdown ();
+	_config_srv.shutdown ();
+	_mode_srv.shutdown ();
+	_stop_srv.shutdown ();
+	_diagnostics_timer.stop ();
+	_state_timer.stop ();
+
+	_io_stop();
+	for (int i=0; i<_bus_count; i++) {
+		_bus->close (_buses[i].handle);
+		_buses[i].handle = 0;
+	}
+	_bus_count = 0;
+}
 
-	ros::Subscriber abs_sub = 			n.subscribe 		("servos_absolute", 500, 		servos_absolute);		// the 'absolute' topic will be used for standard servo motion and testing of continuous servos
-	ros::Subscriber rel_sub = 			n.subscribe 		("servos_proportional", 500, 	servos_proportional);	// the 'proportion' topic will be used for standard servos and continuous rotation aka drive servos
-	ros::Subscriber drive_sub = 		n.subscribe 		("servos_drive", 500, 			servos_drive);			// the 'drive' topic will be used for continuous rotation aka drive servos controlled by Twist messages
-	
-	_load_params();	// loads parameters and performs initialization
-	
 
-	ros::spin();
+int i2cpwm_controller_open (const char* device, const char* backend, int frequency)
+{
+	i2cpwm_bus_config bus = { device, MAX_BOARDS, _BASE_ADDR, 0, 0 };
+
+	return i2cpwm_controller_open_buses (backend, frequency, &bus, 1);
+}
+
+
+int i2cpwm_controller_open_buses (const char* backend, int frequency, const i2cpwm_bus_config* buses, int count)
+{
+	int i;
+
+	if (NULL == (_bus = i2c_backend_find (backend))) {
+		ROS_ERROR ("Invalid I2C backend '%s' :: backends are 'linux', 'sim' and 'faulty'", backend);
+		_bus = &i2c_backend_linux;
+		return -1;
+	}
+	_init ();
+
+	for (i=0; i<count; i++) {
+		int number = 0;
+		sscanf (buses[i].device, "/dev/i2c-%d", &number);
+		if (0 > _bus_open (buses[i].device, number, buses[i].boards, buses[i].address ? buses[i].address : _BASE_ADDR, buses[i].mux, buses[i].channel))
+			return -1;
+	}
+
+	// the boards are brought up with a write strategy the adapters support even before a transport is selected
+	if (!_transport_supported (_transport))
+		i2cpwm_controller_transport ("auto");
+
+	int needed[MAX_BOARDS];
+	memset (needed, 0, sizeof(needed));
+	needed[0] = 1;
+	_boards_start (needed, frequency);
+	_set_active_board (1);
+	return 0;
+}
+
+
+void i2cpwm_controller_io_start (void)
+{
+	_io_config.enabled = true;
+	_io_start ();
+}
+
+
+void i2cpwm_controller_sync (void)
+{
+	_io_sync ();
+}
+
+
+void i2cpwm_controller_verify (int rate)
+{
+	_verify_rate = (rate > 0) ? rate : 0;
+}
+
+
+int i2cpwm_controller_transport (const char* name)
+{
+	// the fastest first: one syscall per frame, one per block, one per two registers and one per register
+	static const int order[] = { TRANSPORT_RDWR, TRANSPORT_SMBUS, TRANSPORT_WORD, TRANSPORT_BYTE };
+	int transport = -1;
+	int i;
+
+	for (i=0; i<4; i++) {
+		if (0 == strcmp (name, _transport_names[i]))
+			transport = i;
+	}
+	if (0 == strcmp (name, "i2c_block"))
+		transport = TRANSPORT_SMBUS;
+
+	if ((transport >= 0) && _transport_supported (transport)) {
+		_transport_set (transport);
+		return 0;
+	}
+	if (transport >= 0)
+		ROS_WARN ("The I2C adapter does not support the %s transport :: using the fastest transport it supports", name);
+	else if (0 != strcmp (name, "auto")) {
+		_transport_set (TRANSPORT_SMBUS);
+		return -1;
+	}
+
+	// the functionality the adapters report with I2C_FUNCS selects the fastest write strategy all of them support
+	for (i=0; i<4; i++) {
+		if (_transport_supported (order[i]))
+			break;
+	}
+	_transport_set ((i < 4) ? order[i] : TRANSPORT_BYTE);
+	return 0;
+}
+
+
+int i2cpwm_controller_burst (int bytes)
+{
+	if ((bytes != 0) && ((bytes < 4) || (bytes > (4*MAX_RDWR_CHANNELS))))
+		return -1;
+	_burst_max = bytes;
+	_transport_burst ();
+	return 0;
+}
+
+
+void i2cpwm_controller_trace (i2cpwm_trace_hook hook)
+{
+	_trace_hook = hook;
+}
+
+
+int i2cpwm_controller_realtime (void)
+{
+	return _realtime_start ();
+}
 
-	close (_controller_io_handle);
 
-  return 0;
+int i2cpwm_controller_subscribe_options (const char* topic, ros::SubscribeOptions& ops)
+{
+	if (0 == strcmp (topic, "servos_absolute"))
+		_subscribe_options (ops, topic, 500, servos_absolute);
+	else if (0 == strcmp (topic, "servos_proportional"))
+		_subscribe_options (ops, topic, 500, servos_proportional);
+	else if (0 == strcmp (topic, "servos_frame"))
+		_subscribe_options (ops, topic, 500, servos_frame);
+	else if (0 == strcmp (topic, "servos_drive"))
+		_subscribe_options (ops, topic, (_io_config.conflate ? 1 : 500), servos_drive);	// a conflated drive only needs the newest Twist
+	else if (0 == strcmp (topic, "servos_motion"))
+		_subscribe_options (ops, topic, 500, servos_motion);
+	else if (0 == strcmp (topic, "pose_absolute"))
+		_subscribe_options (ops, topic, 500, pose_absolute);
+	else if (0 == strcmp (topic, "pose_proportional"))
+		_subscribe_options (ops, topic, 500, pose_proportional);
+	else if (0 == strcmp (topic, "pose_recall"))
+		_subscribe_options (ops, topic, 500, pose_recall);
+	else
+		return -1;
+	return 0;
 }
 
+
+void i2cpwm_controller_schedule (int rate)
+{
+	_io_config.scheduled = true;
+	_io_config.rate = (rate > 0) ? rate : 0;
+}
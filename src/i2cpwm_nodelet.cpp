@@ -0,0 +1,93 @@
+/**
+ *
+   \file
+   \brief      ROS nodelet for I2C interfaced 16 channel PWM boards with PCA9685 chip
+   \author     Bradan Lane Studio <info@bradanlane.com>
+   \copyright  Copyright (c) 2016, Bradan Lane Studio
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      - Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      - Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      - The name of Bradan Lane, Bradan Lane Studio nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL BRADAN LANE STUDIOS BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+  Please send comments, questions, or patches to info@bradanlane.com
+
+*/
+
+/**
+  The nodelet runs the same controller as the i2cpwm_board node inside a nodelet manager. A planner loaded into the
+  same manager publishes its ServoArray, ServoFrame, ServoMotion and Twist messages as shared pointers which are passed
+  to the subscribers of the controller without being serialized or copied.
+
+  \code{.sh}
+  # load the controller into its own manager; parameters are set as for the node, see launch/i2cpwm_nodelet.launch
+  rosrun nodelet nodelet standalone i2cpwm_board/I2CPWMNodelet
+  \endcode
+
+  The controller keeps its state in globals, so only one instance may be loaded into a process.
+  Its callbacks use the single threaded node handle of the nodelet as they expect to be called by one thread.
+*/
+
+#include <ros/ros.h>
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+#include "i2cpwm_board/i2cpwm_controller.h"
+
+
+namespace i2cpwm_board {
+
+class I2CPWMNodelet : public nodelet::Nodelet
+{
+public:
+	I2CPWMNodelet () : _started (false) {}
+
+	~I2CPWMNodelet ()
+	{
+		if (_started) {
+			i2cpwm_controller_stop();
+			__atomic_store_n (&_loaded, false, __ATOMIC_RELEASE);	// the manager may load the controller again
+		}
+	}
+
+private:
+	virtual void onInit ()
+	{
+		if (__atomic_exchange_n (&_loaded, true, __ATOMIC_ACQ_REL)) {
+			NODELET_ERROR ("Unable to load %s :: the I2C PWM controller is already loaded in this process", getName().c_str());
+			return;
+		}
+		if (0 > i2cpwm_controller_start (getNodeHandle())) {
+			NODELET_ERROR ("Unable to start the I2C PWM controller :: the I2C bus or the I/O threads could not be started");
+			__atomic_store_n (&_loaded, false, __ATOMIC_RELEASE);
+			return;
+		}
+		_started = true;
+	}
+
+	bool _started;
+	static bool _loaded;		// the controller has one set of globals per process
+};
+
+bool I2CPWMNodelet::_loaded = false;
+
+}
+
+PLUGINLIB_EXPORT_CLASS(i2cpwm_board::I2CPWMNodelet, nodelet::Nodelet)
@@ -0,0 +1,384 @@
+/**
+ *
+   \file
+   \brief      replay of a recorded bag through the I2C PWM controller with a per message trace of each stage
+   \author     Bradan Lane Studio <info@bradanlane.com>
+   \copyright  Copyright (c) 2016, Bradan Lane Studio
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      - Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      - Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      - The name of Bradan Lane, Bradan Lane Studio nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL BRADAN LANE STUDIOS BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+  Please send comments, questions, or patches to info@bradanlane.com
+
+*/
+
+/**
+  The replay runs without a ROS master or PWM hardware. The servos_absolute, servos_proportional, servos_frame and
+  servos_drive messages of a bag are delivered to the controller's topic subscribers at the times they were recorded,
+  or as fast as they are handled, and written to the sim or faulty backend.
+
+  Each message is one line of a CSV trace. The times are nanoseconds from the start of the replay:
+    - bag_ns: when the message was recorded, relative to the first message of the bag
+    - received_ns: when its subscriber was entered
+    - converted_ns: when every value had been converted to a pulse and staged or queued
+    - queued_ns: when the end of the message had been passed to the buses
+    - written_ns: when the last bus with values of the message had written them; without I/O threads this is before queued_ns
+    - buses: bit mask of the buses with values of the message
+
+  A stage the message did not reach, eg a drive message without a drive mode, is left empty.
+
+  \code{.sh}
+  # replay a bag at its recorded rate with the I/O threads and write the trace to a file
+  rosrun i2cpwm_board i2cpwm_replay --bag robot.bag --servos 32 --io-thread --trace robot.csv
+
+  # replay as fast as possible on a 100kHz bus with the time of each transaction spent on the bus
+  rosrun i2cpwm_board i2cpwm_replay --bag robot.bag --speed 0 --backend faulty --bus-hz 100000 --delay
+  \endcode
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include <ros/ros.h>
+#include "i2cpwm_board/i2cpwm_controller.h"
+#include "i2cpwm_board/i2cpwm_tool.h"
+#include "i2cpwm_board/i2c_backend.h"
+
+
+/// @cond PRIVATE_NO_PUBLIC DOC
+
+typedef struct _replay_options {
+	const char* backend;
+	const char* transport;
+	const char* bag;
+	const char* trace;
+	double speed;
+	int servos;
+	int frequency;
+	int bus_hz;
+	int latency_us;
+	double error_rate;
+	int delay;
+	int buses;
+	int io_thread;
+} replay_options;
+
+typedef struct _replay_message {
+	int topic;							// index of i2cpwm_tool_topic_names
+	long long bag;						// record time relative to the first message of the bag
+	long long received;					// monotonic times of the stages or 0 when the message did not reach the stage
+	long long converted;
+	long long queued;
+	long long written;
+	unsigned int buses;					// buses with values of the message
+	unsigned int pending;				// buses which have not yet written the message
+} replay_message;
+
+typedef struct _replay_write {
+	long long stamp;					// the newest message of the frame
+	unsigned int buses;
+	long long now;
+} replay_write;
+
+static std::vector<replay_message> _messages;	// each delivered message in the order of the bag
+static std::vector<replay_write> _writes;		// frames written by the buses; sized before the replay as the I/O threads append to it
+static unsigned int _write_count = 0;			// entries of _writes claimed so far; may exceed its size when it overflowed
+static int _buses = 1;
+
+
+static void _usage (const char* name)
+{
+	fprintf (stderr,
+		"usage: %s --bag FILE [options]\n"
+		"  --bag FILE          replay the servos_absolute, servos_proportional, servos_frame and servos_drive topics of a bag\n"
+		"  --trace FILE        write the CSV trace to a file rather than stdout\n"
+		"  --speed F           multiple of the recorded rate; 0 replays as fast as the messages are handled (default 1)\n"
+		"  --backend NAME      sim or faulty (default sim)\n"
+		"  --transport NAME    smbus, rdwr, word, byte or auto (default smbus)\n"
+		"  --servos N          servos configured as standard servos, 16 per board; the first four are a mecanum drive (default 16)\n"
+		"  --frequency HZ      PWM frequency (default 50)\n"
+		"  --bus-hz HZ         I2C clock of the modelled bus (default 400000)\n"
+		"  --latency-us US     fixed latency of each transaction (default 0)\n"
+		"  --error-rate P      probability of a write error with the faulty backend (default 0)\n"
+		"  --delay             sleep for the modelled time of each transaction\n"
+		"  --buses N           split the boards of the servos across N buses (default 1); more than one bus uses the I/O threads\n"
+		"  --io-thread         write each bus from its own I/O thread\n",
+		name);
+}
+
+
+/**
+ * \private method to record a stage of a message
+ *
+ *Every stage but I2CPWM_TRACE_WRITTEN is reported while the subscriber of the newest message runs on this thread.
+ *Written frames are reported by the I/O threads and only appended here; they are matched with the messages after the replay.
+ */
+static void _trace (int stage, long long stamp, unsigned int buses, long long now)
+{
+	if (stage != I2CPWM_TRACE_WRITTEN) {
+		replay_message* mp = &(_messages.back());
+		if (stage == I2CPWM_TRACE_RECEIVED)
+			mp->received = stamp;
+		else if (stage == I2CPWM_TRACE_CONVERTED)
+			mp->converted = now;
+		else {
+			mp->queued = now;
+			mp->buses = buses;
+			mp->pending = buses;
+		}
+		return;
+	}
+
+	unsigned int n = __atomic_fetch_add (&_write_count, 1, __ATOMIC_RELAXED);
+	if (n < _writes.size()) {
+		_writes[n].stamp = stamp;
+		_writes[n].buses = buses;
+		_writes[n].now = now;
+	}
+}
+
+
+/**
+ * \private method to find when each message was written by all of its buses
+ *
+ *A bus writes its commands in order so a frame includes every message of the bus up to the newest message of the frame.
+ *@param buses the number of buses
+ */
+static void _match_writes (int buses)
+{
+	unsigned int count = std::min ((size_t)_write_count, _writes.size());
+	int bus;
+
+	for (bus=0; bus<buses; bus++) {
+		unsigned int bit = 1u << bus;
+		size_t next = 0;	// first message not yet written by the bus
+
+		for (unsigned int i=0; i<count; i++) {
+			const replay_write* wp = &(_writes[i]);
+			if (!(wp->buses & bit))
+				continue;
+			for (; (next < _messages.size()) && (_messages[next].received <= wp->stamp); next++) {
+				replay_message* mp = &(_messages[next]);
+				if (!(mp->pending & bit))
+					continue;
+				mp->pending &= ~bit;
+				if (wp->now > mp->written)
+					mp->written = wp->now;
+			}
+		}
+	}
+	for (size_t i=0; i<_messages.size(); i++) {
+		if (_messages[i].pending || !_messages[i].queued)
+			_messages[i].written = 0;
+		else if (!_messages[i].buses)
+			_messages[i].written = _messages[i].queued;	// nothing to write, eg every value was invalid
+	}
+}
+
+
+/**
+ * \private method to size the trace once the bag is open
+ *
+ *@param messages the messages of the bag
+ */
+static void _open (unsigned int messages)
+{
+	_messages.reserve (messages);
+	_writes.resize (((size_t)messages * _buses) + 16);	// each bus writes at most one frame per message
+}
+
+
+/**
+ * \private method to add a message to the trace before it is delivered
+ */
+static void _record (int topic, long long bag)
+{
+	replay_message message;
+	memset (&message, 0, sizeof(message));
+	message.topic = topic;
+	message.bag = bag;
+	_messages.push_back (message);
+}
+
+
+static void _deliver_servos (int topic, const i2cpwm_board::ServoArray::ConstPtr& msg, long long bag)
+{
+	_record (topic, bag);
+	if (topic == I2CPWM_TOOL_ABSOLUTE)
+		servos_absolute (msg);
+	else
+		servos_proportional (msg);
+}
+
+
+static void _deliver_frame (const i2cpwm_board::ServoFrame::ConstPtr& msg, long long bag)
+{
+	_record (I2CPWM_TOOL_FRAME, bag);
+	servos_frame (msg);
+}
+
+
+static void _deliver_drive (const geometry_msgs::Twist::ConstPtr& msg, long long bag)
+{
+	_record (I2CPWM_TOOL_DRIVE, bag);
+	servos_drive (msg);
+}
+
+
+static const i2cpwm_tool_handlers _handlers = { _open, _deliver_servos, _deliver_frame, _deliver_drive };
+
+
+static void _print_time (FILE* fp, long long t, long long start, const char* separator)
+{
+	if (t)
+		fprintf (fp, "%lld%s", t - start, separator);
+	else
+		fprintf (fp, "%s", separator);
+}
+
+/// @endcond PRIVATE_NO_PUBLIC DOC
+
+
+int main (int argc, char **argv)
+{
+	replay_options options = { "sim", "smbus", NULL, NULL, 1.0, 16, 50, 400000, 0, 0.0, 0, 1, 0 };
+
+	static struct option long_options[] = {
+		{ "bag",		required_argument,	NULL, 'r' },
+		{ "trace",		required_argument,	NULL, 'o' },
+		{ "speed",		required_argument,	NULL, 'p' },
+		{ "backend",	required_argument,	NULL, 'b' },
+		{ "transport",	required_argument,	NULL, 't' },
+		{ "servos",		required_argument,	NULL, 's' },
+		{ "frequency",	required_argument,	NULL, 'f' },
+		{ "bus-hz",		required_argument,	NULL, 'c' },
+		{ "latency-us",	required_argument,	NULL, 'l' },
+		{ "error-rate",	required_argument,	NULL, 'e' },
+		{ "delay",		no_argument,		NULL, 'd' },
+		{ "buses",		required_argument,	NULL, 'u' },
+		{ "io-thread",	no_argument,		NULL, 'i' },
+		{ "help",		no_argument,		NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int opt;
+	while (-1 != (opt = getopt_long (argc, argv, "r:o:p:b:t:s:f:c:l:e:du:ih", long_options, NULL))) {
+		switch (opt) {
+			case 'r': options.bag = optarg; break;
+			case 'o': options.trace = optarg; break;
+			case 'p': options.speed = atof (optarg); break;
+			case 'b': options.backend = optarg; break;
+			case 't': options.transport = optarg; break;
+			case 's': options.servos = atoi (optarg); break;
+			case 'f': options.frequency = atoi (optarg); break;
+			case 'c': options.bus_hz = atoi (optarg); break;
+			case 'l': options.latency_us = atoi (optarg); break;
+			case 'e': options.error_rate = atof (optarg); break;
+			case 'd': options.delay = 1; break;
+			case 'u': options.buses = atoi (optarg); break;
+			case 'i': options.io_thread = 1; break;
+			default: _usage (argv[0]); return 1;
+		}
+	}
+	if (!options.bag) {
+		_usage (argv[0]);
+		return 1;
+	}
+	if (0 == strcmp (options.backend, "linux")) {
+		fprintf (stderr, "The replay only runs with the sim and faulty backends\n");
+		return 1;
+	}
+	if (options.speed < 0.0) {
+		fprintf (stderr, "Invalid speed %f :: speeds must be 0 or greater\n", options.speed);
+		return 1;
+	}
+	FILE* fp = stdout;
+	if (options.trace && (NULL == (fp = fopen (options.trace, "w")))) {
+		fprintf (stderr, "Unable to write the trace %s :: %s\n", options.trace, strerror (errno));
+		return 1;
+	}
+
+	ros::Time::init ();
+
+	i2c_sim_reset ();
+	i2c_sim_set_faults (options.bus_hz, options.latency_us, 0.0, 0);	// no errors or delays while the boards are set up
+	if (0 > i2cpwm_tool_open_buses (options.backend, options.frequency, options.servos, options.buses, 0))
+		return 1;
+	if (0 > i2cpwm_controller_transport (options.transport)) {
+		fprintf (stderr, "Invalid transport %s :: transports are smbus, rdwr, word, byte and auto\n", options.transport);
+		return 1;
+	}
+	i2cpwm_tool_configure (options.servos);
+	i2cpwm_controller_trace (_trace);
+	if (options.io_thread || (options.buses > 1))
+		i2cpwm_controller_io_start ();
+
+	i2c_sim_set_faults (options.bus_hz, options.latency_us, options.error_rate, options.delay);
+
+	long long start = 0;
+	_buses = options.buses;
+	int count = i2cpwm_tool_replay_bag (options.bag, options.speed, &_handlers, &start);
+	i2cpwm_controller_sync ();
+	long long elapsed = i2cpwm_tool_now () - start;
+
+	i2cpwm_controller_stop ();
+	i2cpwm_controller_trace (NULL);
+	if (count <= 0) {
+		fprintf (stderr, "No messages were delivered\n");
+		return 1;
+	}
+	if (_write_count > _writes.size())
+		fprintf (stderr, "The trace lost %zu written frames :: the written times of the later messages are empty\n", (size_t)_write_count - _writes.size());
+	_match_writes (options.buses);
+
+	std::vector<long long> latencies;
+	latencies.reserve (count);
+	fprintf (fp, "message,topic,bag_ns,received_ns,converted_ns,queued_ns,written_ns,buses\n");
+	for (int i=0; i<count; i++) {
+		const replay_message* mp = &(_messages[i]);
+		fprintf (fp, "%d,%s,%lld,", i+1, i2cpwm_tool_topic_names[mp->topic], mp->bag);
+		_print_time (fp, mp->received, start, ",");
+		_print_time (fp, mp->converted, start, ",");
+		_print_time (fp, mp->queued, start, ",");
+		_print_time (fp, mp->written, start, ",");
+		fprintf (fp, "%u\n", mp->buses);
+		if (mp->written && mp->received)
+			latencies.push_back (mp->written - mp->received);
+	}
+	if (fp != stdout)
+		fclose (fp);
+
+	std::sort (latencies.begin(), latencies.end());
+	fprintf (stderr, "messages              %d (%zu written)\n", count, latencies.size());
+	fprintf (stderr, "elapsed               %.3f s\n", elapsed / 1e9);
+	if (!latencies.empty()) {
+		fprintf (stderr, "latency p50           %.1f us\n", latencies[(latencies.size() - 1) / 2] / 1000.0);
+		fprintf (stderr, "latency p99           %.1f us\n", latencies[((latencies.size() - 1) * 99) / 100] / 1000.0);
+		fprintf (stderr, "latency max           %.1f us\n", latencies.back() / 1000.0);
+	}
+	return 0;
+}
@@ -0,0 +1,221 @@
+/**
+ *
+   \file
+   \brief      bag replay, servo configuration and bus layout shared by the benchmark and replay executables
+   \author     Bradan Lane Studio <info@bradanlane.com>
+   \copyright  Copyright (c) 2016, Bradan Lane Studio
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+      - Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+      - Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+      - The name of Bradan Lane, Bradan Lane Studio nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL BRADAN LANE STUDIOS BE LIABLE FOR ANY
+  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+  Please send comments, questions, or patches to info@bradanlane.com
+
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <string>
+
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+
+#include "i2cpwm_board/i2cpwm_tool.h"
+#include "i2cpwm_board/i2c_backend.h"
+
+
+const char* i2cpwm_tool_topic_names[I2CPWM_TOOL_TOPICS] = { "servos_absolute", "servos_proportional", "servos_frame", "servos_drive" };
+
+
+/// @cond PRIVATE_NO_PUBLIC DOC
+
+#define _MUX_ADDR 0x70							// the multiplexer of each bus with channels
+
+static char _devices[4][32];					// the device names of the buses; the configs refer to them
+
+
+/**
+ * \private method to wait until a message is due
+ *
+ *@param start the monotonic time of the start of the replay
+ *@param bag the record time of the message relative to the first message of the bag
+ *@param speed the multiple of the recorded rate; 0 does not wait
+ */
+static void _wait (long long start, long long bag, double speed)
+{
+	if (speed <= 0.0)
+		return;
+
+	long long due = start + (long long)(bag / speed);
+	struct timespec t;
+	t.tv_sec = due / 1000000000LL;
+	t.tv_nsec = due % 1000000000LL;
+	while (EINTR == clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL))
+		;
+}
+
+/// @endcond PRIVATE_NO_PUBLIC DOC
+
+
+long long i2cpwm_tool_now (void)
+{
+	struct timespec t;
+	clock_gettime (CLOCK_MONOTONIC, &t);
+	return ((long long)t.tv_sec * 1000000000LL) + t.tv_nsec;
+}
+
+
+int i2cpwm_tool_open_buses (const char* backend, int frequency, int servos, int buses, int mux)
+{
+	if ((servos < 1) || (servos > (16*62))) {
+		fprintf (stderr, "Invalid servo count %d :: servo counts must be between 1 and %d\n", servos, 16*62);
+		return -1;
+	}
+	int boards = (servos + 15) / 16;
+	if ((buses < 1) || (buses > 4) || (buses > boards)) {
+		fprintf (stderr, "Invalid bus count %d :: bus counts must be between 1 and 4 and at most one bus per board of the servos\n", buses);
+		return -1;
+	}
+	int channels = mux ? mux : 1;
+	if ((channels < 1) || (channels > 8) || ((buses * channels) > boards)) {
+		fprintf (stderr, "Invalid multiplexer channel count %d :: channel counts must be between 1 and 8 and at most one channel per board of the servos\n", mux);
+		return -1;
+	}
+
+	// the boards of the servos are split evenly across the buses and channels; any remaining boards are on the last bus without a multiplexer
+	i2cpwm_bus_config configs[4*8];
+	int entries = buses * channels;
+	int per_bus = (boards + entries - 1) / entries;
+	for (int i=0; i<entries; i++) {
+		int bus = i / channels;
+		snprintf (_devices[bus], sizeof(_devices[bus]), "/dev/i2c-%d", bus);
+		if (mux && ((i % channels) == 0))
+			i2c_sim_set_mux (_devices[bus], _MUX_ADDR);
+		configs[i].device = _devices[bus];
+		configs[i].boards = ((i == (entries - 1)) && !mux) ? (62 - (per_bus * i)) : per_bus;
+		configs[i].address = 0;
+		configs[i].mux = mux ? _MUX_ADDR : 0;
+		configs[i].channel = i % channels;
+	}
+	return i2cpwm_controller_open_buses (backend, frequency, configs, entries);
+}
+
+
+void i2cpwm_tool_configure (int servos)
+{
+	i2cpwm_board::ServosConfig::Request config_req;
+	i2cpwm_board::ServosConfig::Response config_res;
+	int i;
+
+	for (i=1; i<=servos; i++) {
+		i2cpwm_board::ServoConfig servo;
+		servo.servo = i;
+		servo.center = 333;
+		servo.range = 100;
+		servo.direction = (i & 1) ? 1 : -1;
+		config_req.servos.push_back (servo);
+	}
+	config_servos (config_req, config_res);
+
+	if (servos < 4)
+		return;
+
+	i2cpwm_board::DriveMode::Request drive_req;
+	i2cpwm_board::DriveMode::Response drive_res;
+	drive_req.mode = "mecanum";
+	drive_req.rpm = 60.0;
+	drive_req.radius = 0.062;
+	drive_req.track = 0.2;
+	drive_req.scale = 1.0;
+	drive_req.acceleration = 0.0;	// each Twist steps to its speed
+	for (i=1; i<=4; i++) {
+		i2cpwm_board::Position position;
+		position.servo = i;
+		position.position = i;
+		drive_req.servos.push_back (position);
+	}
+	config_drive_mode (drive_req, drive_res);
+}
+
+
+int i2cpwm_tool_replay_bag (const char* filename, double speed, const i2cpwm_tool_handlers* handlers, long long* start)
+{
+	rosbag::Bag bag;
+	long long first = -1;
+	long long begin;
+	int count = 0;
+
+	try {
+		bag.open (filename, rosbag::bagmode::Read);
+		rosbag::View view (bag);
+
+		if (handlers->open)
+			handlers->open (view.size());
+		begin = i2cpwm_tool_now ();
+		if (start)
+			*start = begin;
+
+		for (rosbag::View::iterator it = view.begin(); it != view.end(); ++it) {
+			const rosbag::MessageInstance& m = *it;
+			const std::string& topic = m.getTopic();
+			int kind;
+
+			for (kind=0; kind<I2CPWM_TOOL_TOPICS; kind++) {
+				if (topic.find (i2cpwm_tool_topic_names[kind]) != std::string::npos)
+					break;
+			}
+			if (kind >= I2CPWM_TOOL_TOPICS)
+				continue;
+
+			geometry_msgs::Twist::ConstPtr twist;
+			i2cpwm_board::ServoFrame::ConstPtr frame;
+			i2cpwm_board::ServoArray::ConstPtr servos;
+			if (kind == I2CPWM_TOOL_DRIVE)
+				twist = m.instantiate<geometry_msgs::Twist>();
+			else if (kind == I2CPWM_TOOL_FRAME)
+				frame = m.instantiate<i2cpwm_board::ServoFrame>();
+			else
+				servos = m.instantiate<i2cpwm_board::ServoArray>();
+			if (!twist && !frame && !servos)
+				continue;
+
+			long long recorded = (long long)m.getTime().toNSec();
+			if (first < 0)
+				first = recorded;
+			_wait (begin, recorded - first, speed);
+
+			if (twist)
+				handlers->drive (twist, recorded - first);
+			else if (frame)
+				handlers->frame (frame, recorded - first);
+			else
+				handlers->servos (kind, servos, recorded - first);
+			count++;
+		}
+		bag.close ();
+	}
+	catch (rosbag::BagException& e) {
+		fprintf (stderr, "Unable to replay bag %s :: %s\n", filename, e.what());
+		return -1;
+	}
+	return count;
+}